@@ -1,7 +1,7 @@
 QT -= gui
 QT += network qmqtt
 
-CONFIG += c++11 console
+CONFIG += c++17 console
 CONFIG -= app_bundle
 
 VERSION = 1.5.0
@@ -20,17 +20,33 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 
 SOURCES += \
+        bindaddresspool.cpp \
         clientnumberpool.cpp \
         clientpool.cpp \
         counters.cpp \
+        epollloop.cpp \
         globals.cpp \
+        histogram.cpp \
+        inflighttable.cpp \
         loadsimulator.cpp \
         main.cpp \
+        metricsserver.cpp \
+        mqttcodec.cpp \
+        nativeconnection.cpp \
         oneclient.cpp \
+        payloadtemplate.cpp \
         poolarguments.cpp \
         poolstarter.cpp \
+        poolstats.cpp \
+        qmqttconnection.cpp \
+        reconnectscheduler.cpp \
+        scenario.cpp \
+        selftestbroker.cpp \
+        sequencetracker.cpp \
+        statswriter.cpp \
         threadloopdriftguage.cpp \
-        utils.cpp
+        utils.cpp \
+        workerthread.cpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -38,13 +54,35 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 HEADERS += \
+    binarypayload.h \
+    bindaddresspool.h \
+    bytebuffer.h \
     clientnumberpool.h \
     clientpool.h \
+    clientsettings.h \
     counters.h \
+    epollloop.h \
     globals.h \
+    histogram.h \
+    inflighttable.h \
     loadsimulator.h \
+    metricsserver.h \
+    mqttcodec.h \
+    mqttconnection.h \
+    nativeconnection.h \
     oneclient.h \
+    payloadtemplate.h \
     poolarguments.h \
     poolstarter.h \
+    poolstats.h \
+    qmqttconnection.h \
+    reconnectscheduler.h \
+    scenario.h \
+    selftestbroker.h \
+    sequencetracker.h \
+    statssnapshot.h \
+    statswriter.h \
     threadloopdriftguage.h \
-    utils.h
+    timingwheel.h \
+    utils.h \
+    workerthread.h
@@ -0,0 +1,57 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef BINARYPAYLOAD_H
+#define BINARYPAYLOAD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define BINARY_PAYLOAD_MAGIC 0x31534c4d // 'MLS1' in little endian.
+
+/**
+ * @brief The BinaryPayloadHeader struct is put at the start of payloads with --binary-payload, so that receivers can get the latency
+ * stamp (and sender and sequence) with one memcpy, instead of parsing text.
+ *
+ * It's in host byte order; the steady clock stamp is only meaningful when sender and receiver are on the same machine anyway.
+ */
+struct BinaryPayloadHeader
+{
+    uint32_t magic = BINARY_PAYLOAD_MAGIC;
+    uint32_t senderId = 0;
+    uint64_t sequence = 0;
+    int64_t steadyTimeMicros = 0;
+
+    /**
+     * @brief parse fills this header from the start of a payload, if it has one.
+     * @return whether the payload started with a valid header.
+     */
+    bool parse(const char *data, size_t len)
+    {
+        if (len < sizeof(BinaryPayloadHeader))
+            return false;
+
+        memcpy(this, data, sizeof(BinaryPayloadHeader));
+        return this->magic == BINARY_PAYLOAD_MAGIC;
+    }
+};
+
+static_assert(sizeof(BinaryPayloadHeader) == 24, "BinaryPayloadHeader is sent as-is, so it can't have padding.");
+
+#endif // BINARYPAYLOAD_H
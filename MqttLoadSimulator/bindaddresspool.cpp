@@ -0,0 +1,156 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "bindaddresspool.h"
+
+#include <string.h>
+#include <netinet/in.h>
+#include <QStringList>
+
+#include "utils.h"
+
+#define MAX_BIND_ADDRESSES 65536
+
+/**
+ * @brief BindAddressPool::BindAddressPool
+ * @param list comma separated addresses and IPv4 CIDR ranges, like "10.0.0.5,10.0.1.0/24". Of ranges, the network and broadcast
+ * addresses are left out.
+ */
+BindAddressPool::BindAddressPool(const QString &list) :
+    next(0)
+{
+    for (const QString &spec : list.split(",", QString::SplitBehavior::SkipEmptyParts))
+    {
+        addSpec(spec.trimmed());
+    }
+
+    if (entries.empty())
+        throw ArgumentException("The bind address list is empty");
+
+    connections.reset(new std::atomic<int64_t>[entries.size()]);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        connections[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void BindAddressPool::addSpec(const QString &spec)
+{
+    if (!spec.contains('/'))
+    {
+        QHostAddress a;
+        if (!a.setAddress(spec))
+            throw ArgumentException(formatString("Invalid bind address '%s'", qPrintable(spec)));
+
+        addAddress(a);
+        return;
+    }
+
+    const QPair<QHostAddress, int> subnet = QHostAddress::parseSubnet(spec);
+
+    if (subnet.first.isNull() || subnet.first.protocol() != QAbstractSocket::IPv4Protocol)
+        throw ArgumentException(formatString("Invalid bind address range '%s'. Only IPv4 ranges are supported.", qPrintable(spec)));
+
+    const int prefix = subnet.second;
+    const uint64_t count = static_cast<uint64_t>(1) << (32 - prefix);
+
+    if (entries.size() + count > MAX_BIND_ADDRESSES)
+        throw ArgumentException(formatString("Bind address range '%s' is too big", qPrintable(spec)));
+
+    const quint32 base = subnet.first.toIPv4Address();
+    const uint64_t first = prefix >= 31 ? 0 : 1;
+    const uint64_t last = prefix >= 31 ? count : count - 1;
+
+    for (uint64_t i = first; i < last; i++)
+    {
+        addAddress(QHostAddress(static_cast<quint32>(base + i)));
+    }
+}
+
+void BindAddressPool::addAddress(const QHostAddress &hostAddress)
+{
+    if (entries.size() >= MAX_BIND_ADDRESSES)
+        throw ArgumentException("Too many bind addresses");
+
+    Entry e;
+    memset(&e.address, 0, sizeof(struct sockaddr_storage));
+
+    if (hostAddress.protocol() == QAbstractSocket::IPv6Protocol)
+    {
+        struct sockaddr_in6 *a = reinterpret_cast<struct sockaddr_in6*>(&e.address);
+        a->sin6_family = AF_INET6;
+        const Q_IPV6ADDR ip6 = hostAddress.toIPv6Address();
+        memcpy(&a->sin6_addr, &ip6, sizeof(a->sin6_addr));
+        e.addressLength = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        struct sockaddr_in *a = reinterpret_cast<struct sockaddr_in*>(&e.address);
+        a->sin_family = AF_INET;
+        a->sin_addr.s_addr = htonl(hostAddress.toIPv4Address());
+        e.addressLength = sizeof(struct sockaddr_in);
+    }
+
+    entries.push_back(e);
+}
+
+/**
+ * @brief BindAddressPool::pick gives the index of the next address, round-robin over all threads.
+ */
+size_t BindAddressPool::pick()
+{
+    return next.fetch_add(1, std::memory_order_relaxed) % entries.size();
+}
+
+size_t BindAddressPool::size() const
+{
+    return entries.size();
+}
+
+/**
+ * @brief BindAddressPool::getAddress gives the address with port 0, so the kernel picks the port.
+ */
+const struct sockaddr *BindAddressPool::getAddress(size_t index, socklen_t &length) const
+{
+    const Entry &e = entries.at(index);
+    length = e.addressLength;
+    return reinterpret_cast<const struct sockaddr*>(&e.address);
+}
+
+void BindAddressPool::connectionOpened(size_t index)
+{
+    connections[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void BindAddressPool::connectionClosed(size_t index)
+{
+    connections[index].fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::vector<int64_t> BindAddressPool::getConnectionCounts() const
+{
+    std::vector<int64_t> result(entries.size());
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        result[i] = connections[i].load(std::memory_order_relaxed);
+    }
+
+    return result;
+}
@@ -0,0 +1,65 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef BINDADDRESSPOOL_H
+#define BINDADDRESSPOOL_H
+
+#include <QString>
+#include <QHostAddress>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <sys/socket.h>
+
+/**
+ * @brief The BindAddressPool class is the set of local source addresses that sockets are bound to, round-robin, and the amount of
+ * connections each currently has. Every source address has its own range of ephemeral ports, so this is how one tester opens many
+ * more connections to one server address than a single source address allows.
+ *
+ * It's shared by all threads.
+ */
+class BindAddressPool
+{
+    struct Entry
+    {
+        struct sockaddr_storage address;
+        socklen_t addressLength = 0;
+    };
+
+    std::vector<Entry> entries;
+    std::unique_ptr<std::atomic<int64_t>[]> connections;
+    std::atomic<size_t> next;
+
+    void addAddress(const QHostAddress &hostAddress);
+    void addSpec(const QString &spec);
+
+public:
+    BindAddressPool(const QString &list);
+    BindAddressPool(const BindAddressPool &other) = delete;
+    BindAddressPool &operator=(const BindAddressPool &other) = delete;
+
+    size_t pick();
+    size_t size() const;
+    const struct sockaddr *getAddress(size_t index, socklen_t &length) const;
+    void connectionOpened(size_t index);
+    void connectionClosed(size_t index);
+    std::vector<int64_t> getConnectionCounts() const;
+};
+
+#endif // BINDADDRESSPOOL_H
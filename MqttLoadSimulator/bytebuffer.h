@@ -0,0 +1,133 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef BYTEBUFFER_H
+#define BYTEBUFFER_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+/**
+ * @brief The ByteBuffer class is a growable buffer with a read and write position, used for socket IO: bytes are appended at the end
+ * and consumed from the front, and the space in between is reused instead of reallocated.
+ */
+class ByteBuffer
+{
+    std::vector<char> buf;
+    size_t readPos = 0;
+    size_t writePos = 0;
+
+public:
+    const char *readPtr() const
+    {
+        return buf.data() + readPos;
+    }
+
+    size_t readable() const
+    {
+        return writePos - readPos;
+    }
+
+    bool empty() const
+    {
+        return readPos == writePos;
+    }
+
+    void consume(size_t n)
+    {
+        readPos += n;
+
+        if (readPos >= writePos)
+        {
+            readPos = 0;
+            writePos = 0;
+        }
+    }
+
+    /**
+     * @brief writePtr gives a pointer to at least n bytes of writable space at the end. Use commit() to say how many were written.
+     */
+    char *writePtr(size_t n)
+    {
+        if (buf.size() - writePos < n)
+        {
+            if (readPos > 0)
+            {
+                memmove(buf.data(), buf.data() + readPos, writePos - readPos);
+                writePos -= readPos;
+                readPos = 0;
+            }
+
+            if (buf.size() - writePos < n)
+                buf.resize(std::max<size_t>(buf.size() * 2, writePos + n));
+        }
+
+        return buf.data() + writePos;
+    }
+
+    size_t writable() const
+    {
+        return buf.size() - writePos;
+    }
+
+    void commit(size_t n)
+    {
+        writePos += n;
+    }
+
+    void append(const void *data, size_t n)
+    {
+        memcpy(writePtr(n), data, n);
+        writePos += n;
+    }
+
+    void appendUint8(uint8_t v)
+    {
+        *writePtr(1) = static_cast<char>(v);
+        writePos++;
+    }
+
+    void appendUint16(uint16_t v)
+    {
+        char *p = writePtr(2);
+        p[0] = static_cast<char>(v >> 8);
+        p[1] = static_cast<char>(v & 0xFF);
+        writePos += 2;
+    }
+
+    void clear()
+    {
+        readPos = 0;
+        writePos = 0;
+    }
+
+    /**
+     * @brief release frees the memory, for when a buffer won't be used for a while, like when a connection is closed.
+     */
+    void release()
+    {
+        clear();
+        std::vector<char>().swap(buf);
+    }
+};
+
+#endif // BYTEBUFFER_H
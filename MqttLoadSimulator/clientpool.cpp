@@ -23,13 +23,36 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <utils.h>
 
 #define PUBLISH_INTERVAL 10
+#define MAX_PUBLISH_SCHEDULE_BUCKETS 4096
+
+/**
+ * @brief publishScheduleBuckets gives the publish schedule enough buckets to hold the longest burst interval in one revolution.
+ */
+static size_t publishScheduleBuckets(const PoolArguments &args)
+{
+    const int64_t longestInterval = static_cast<int64_t>(args.burst_interval) + args.burst_spread;
+    const int64_t buckets = longestInterval / PUBLISH_INTERVAL + 1;
+    return static_cast<size_t>(std::max<int64_t>(1, std::min<int64_t>(buckets, MAX_PUBLISH_SCHEDULE_BUCKETS)));
+}
 
 ClientPool::ClientPool(const PoolArguments &args) : QObject(nullptr),
+    name(args.clientIdPart),
+    publishSchedule(std::chrono::milliseconds(PUBLISH_INTERVAL), publishScheduleBuckets(args)),
+    reconnectScheduler(args.reconnectPolicy, args.reconnectRateLimiter),
     delay(args.delay),
-    deferPublishing(args.deferPublishing)
+    deferPublishing(args.deferPublishing),
+    rate(args.pub_and_sub ? args.rate : 0)
 {
     this->clientPoolRandomId = GetRandomString();
 
+    this->payloadTemplate = args.payloadTemplate;
+    if (!this->payloadTemplate)
+        this->payloadTemplate.reset(new PayloadTemplate(PayloadTemplate::defaultFormat(), 100));
+
+    this->mqtt5PublishOptions = args.mqtt5PublishOptions;
+    this->sslConfiguration = args.sslConfiguration;
+    this->bindAddresses = args.bindAddresses;
+
     connectNextBatchTimer.setSingleShot(delay == 0);
     connectNextBatchTimer.setInterval(static_cast<int>(delay));
     connect(&connectNextBatchTimer, &QTimer::timeout, this, &ClientPool::startClients);
@@ -37,80 +60,111 @@ ClientPool::ClientPool(const PoolArguments &args) : QObject(nullptr),
     if (delay > 0)
         connectNextBatchTimer.start();
 
-    QStringList hostnameList = args.hostnameList.split(",", QString::SplitBehavior::SkipEmptyParts);
+    const QStringList hostnameList = args.getHostnames();
+    const ResolvedHosts emptyResolvedHosts;
+    const ResolvedHosts &resolvedHosts = args.resolvedHosts ? *args.resolvedHosts : emptyResolvedHosts;
 
-    if (hostnameList.isEmpty() && !args.hostname.isEmpty())
-        hostnameList.append(args.hostname);
+    // One epoll instance for all clients of the pool, because a pool lives in one thread.
+    if (args.engine == MqttEngine::Native)
+        this->nativeEngineLoop.reset(new EpollLoop());
 
-    this->clients.reserve(args.amount);
+    initClientSettings(args);
 
     for (int i = 0; i < args.amount; i++)
     {
         const QString &hostname = hostnameList[i % hostnameList.size()];
-        OneClient *oneClient = new OneClient(hostname, args.port, args.username, args.password, args.pub_and_sub, i, args.clientIdPart, args.ssl, this->clientPoolRandomId,
-                                             args.amount, args.delay, args.burst_interval, args.burst_spread, args.burst_size, args.overrideReconnectInterval, args.topic,
-                                             args.qos, args.retain, args.incrementTopicPerBurst, args.clientid, args.cleanSession, args.clientCertificatePath,
-                                             args.clientPrivateKeyPath);
+        const QList<QHostAddress> addresses = resolvedHosts.value(hostname);
+        clients.emplace_back(this->clientSettings, i, hostname, addresses);
+        OneClient *oneClient = &clients.back();
 
-        if (!args.payloadFormat.isEmpty())
-            oneClient->setPayloadFormat(args.payloadFormat, args.payload_max_value);
-        clients.append(oneClient);
-        clientsToConnect.push_back(oneClient);
+        if (oneClient->getPubAndSub() && this->rate <= 0)
+            publishSchedule.schedule(oneClient, oneClient->getNextPublish());
 
     }
 
     publishTimer.setInterval(PUBLISH_INTERVAL);
-    connect(&publishTimer, &QTimer::timeout, this, &ClientPool::publishNextRound);
+    connect(&publishTimer, &QTimer::timeout, this, &ClientPool::onPublishTimer);
 
     if (!this->deferPublishing)
         publishTimer.start();
+
+    this->constructedAt = std::chrono::steady_clock::now();
 }
 
 ClientPool::~ClientPool()
 {
-    qDeleteAll(clients);
+    // Before the epoll loop goes, which happens when the members are destroyed.
+    clients.clear();
 }
 
-Counters ClientPool::getTotalCounters() const
+void ClientPool::initClientSettings(const PoolArguments &args)
 {
-    Counters total;
+    ClientSettings &s = this->clientSettings;
 
-    for(const OneClient *c : clients)
-    {
-        total += c->getCounters();
-    }
+    s.port = args.port;
+    s.sslConfiguration = this->sslConfiguration.get();
+    s.nativeEngineLoop = this->nativeEngineLoop.get();
+    s.bindAddresses = this->bindAddresses.get();
+    s.protocolVersion = args.protocolVersion;
+    s.mqtt5PublishOptions = this->mqtt5PublishOptions.get();
+    s.cleanSession = args.cleanSession;
+
+    s.clientIdPart = args.clientIdPart;
+    s.clientid = args.clientid;
+    s.clientPoolRandomId = this->clientPoolRandomId;
+    s.username = args.username;
+    s.password = args.password;
+    s.randomUsername = args.username.contains("%1");
+    s.randomPassword = args.password.contains("%1");
+
+    s.pubAndSub = args.pub_and_sub;
+    s.totalClients = args.amount;
+    s.topic = args.topic;
+    s.sharedSubscriptionGroup = args.sharedSubscriptionGroup;
+    s.burstInterval = args.burst_interval;
+    s.burstSpread = args.burst_spread;
+    s.burstSize = args.burst_size;
+    s.qos = args.qos;
+    s.retain = args.retain;
+    s.incrementTopicPerBurst = args.incrementTopicPerBurst;
+    s.maxInflight = args.maxInflight;
+    s.payloadTemplate = this->payloadTemplate.get();
+    s.binaryPayload = args.binaryPayload;
 
-    return total;
+    s.reconnectScheduler = &this->reconnectScheduler;
+    s.stats = &this->stats;
 }
 
-int ClientPool::getClientCount() const
+/**
+ * @brief ClientPool::getTotalCounters can be called from any thread, and doesn't depend on the amount of clients.
+ */
+Counters ClientPool::getTotalCounters() const
 {
-    return clients.size();
+    return stats.counters.load();
 }
 
-std::vector<LatencyValues> ClientPool::getAllLatencies() const
+int ClientPool::getClientCount() const
 {
-    std::vector<LatencyValues> result;
-    result.reserve(clients.size());
+    return static_cast<int>(clients.size());
+}
 
-    std::for_each(clients.begin(), clients.end(), [&result] (OneClient *c) {
-        LatencyValues l = c->getLatencies();
-        if (c->getPubAndSub() && l.min > std::chrono::microseconds(0))
-        {
-            result.push_back(c->getLatencies());
-        }
-    });
+const QString &ClientPool::getName() const
+{
+    return this->name;
+}
 
-    return result;
+const PoolStats &ClientPool::getStats() const
+{
+    return this->stats;
 }
 
 void ClientPool::startClients()
 {
     int i = 0;
-    while(!this->clientsToConnect.empty())
+    while(this->nextClientToConnect < this->clients.size())
     {
-        OneClient *client = this->clientsToConnect.pop();
-        client->connectToHost();
+        OneClient &client = this->clients[this->nextClientToConnect++];
+        client.connectToHost();
 
         // Doing this with the timer to avoid blocking the event loop and allowing other events to be processed first.
         if (this->delay > 0)
@@ -128,7 +182,7 @@ void ClientPool::startClients()
         }
     }
 
-    if (clientsToConnect.empty())
+    if (this->nextClientToConnect >= this->clients.size())
     {
         connectNextBatchTimer.stop();
 
@@ -137,14 +191,85 @@ void ClientPool::startClients()
     }
 }
 
-void ClientPool::publishNextRound()
+/**
+ * @brief ClientPool::publishNextRound only visits the clients whose publish interval expired, so the cost of this scales with the
+ * publish rate, not with the amount of clients.
+ */
+void ClientPool::publishNextRound(std::chrono::time_point<std::chrono::steady_clock> now)
 {
-    // TODO: ordered map and break if next client in future?
+    if (this->rate > 0)
+    {
+        publishAtRate(now);
+        return;
+    }
 
-    auto now = std::chrono::steady_clock::now();
+    publishSchedule.advance(now, [this, now](OneClient *c) {
+        c->publishIfIntervalExpired(now);
+        publishSchedule.schedule(c, c->getNextPublish());
+    });
+}
 
-    for(OneClient *c : qAsConst(clients))
+void ClientPool::onPublishTimer()
+{
+    publishNextRound(std::chrono::steady_clock::now());
+}
+
+OneClient *ClientPool::getNextRatePublisher()
+{
+    for (size_t i = 0; i < clients.size(); i++)
     {
-        c->publishIfIntervalExpired(now);
+        OneClient *c = &clients[nextRatePublisher];
+        nextRatePublisher = (nextRatePublisher + 1) % clients.size();
+
+        if (c->canPublish())
+            return c;
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief ClientPool::publishAtRate is the open-loop publisher: message n is due at schedule start + n / rate, regardless of how
+ * long earlier ones took. Messages that are late because we're lagging are sent as soon as we get to it, but carry their intended
+ * time as latency stamp, to correct for coordinated omission.
+ *
+ * The schedule is paused while none of the pool's clients can publish, otherwise connecting would count as latency.
+ */
+void ClientPool::publishAtRate(std::chrono::time_point<std::chrono::steady_clock> now)
+{
+    if (!rateScheduleStarted)
+    {
+        rateScheduleStarted = true;
+        rateScheduleStart = now;
+        rateScheduleSent = 0;
+    }
+
+    const double secondsSinceStart = std::chrono::duration<double>(now - rateScheduleStart).count();
+    const uint64_t due = static_cast<uint64_t>(secondsSinceStart * this->rate);
+
+    while (rateScheduleSent < due)
+    {
+        OneClient *c = getNextRatePublisher();
+
+        if (!c)
+        {
+            rateScheduleStarted = false;
+            break;
+        }
+
+        const std::chrono::duration<double> offset(rateScheduleSent / this->rate);
+        const auto intendedAt = rateScheduleStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset);
+        c->publishScheduled(intendedAt);
+        rateScheduleSent++;
     }
 }
+
+double ClientPool::getTargetRate() const
+{
+    return this->rate;
+}
+
+std::chrono::time_point<std::chrono::steady_clock> ClientPool::getConstructedAt() const
+{
+    return this->constructedAt;
+}
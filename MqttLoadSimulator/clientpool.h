@@ -22,30 +22,60 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 
 #include <QObject>
 #include <oneclient.h>
-#include <QStack>
-#include <QVector>
+#include <deque>
 
 #include "counters.h"
 #include "poolarguments.h"
+#include "poolstats.h"
+#include "timingwheel.h"
+#include "epollloop.h"
+#include "reconnectscheduler.h"
+#include "clientsettings.h"
 
 class ClientPool : public QObject
 {
     Q_OBJECT
 
-    QVector<OneClient*> clients;
-    QStack<OneClient*> clientsToConnect;
+    const QString name;
+    std::unique_ptr<EpollLoop> nativeEngineLoop;
+    std::deque<OneClient> clients;
+    size_t nextClientToConnect = 0;
     QTimer connectNextBatchTimer;
     QTimer publishTimer;
+    TimingWheel<OneClient*> publishSchedule;
+    ReconnectScheduler reconnectScheduler;
     uint delay;
     bool deferPublishing;
     QString clientPoolRandomId;
+    std::shared_ptr<const PayloadTemplate> payloadTemplate;
+    std::shared_ptr<const Mqtt5PublishOptions> mqtt5PublishOptions;
+    std::shared_ptr<const QSslConfiguration> sslConfiguration;
+    std::shared_ptr<BindAddressPool> bindAddresses;
+    PoolStats stats;
+    ClientSettings clientSettings;
+
+    const double rate;
+    bool rateScheduleStarted = false;
+    std::chrono::time_point<std::chrono::steady_clock> rateScheduleStart;
+    uint64_t rateScheduleSent = 0;
+    size_t nextRatePublisher = 0;
+
+    std::chrono::time_point<std::chrono::steady_clock> constructedAt;
+
+    void initClientSettings(const PoolArguments &args);
+    OneClient *getNextRatePublisher();
+    void publishAtRate(std::chrono::time_point<std::chrono::steady_clock> now);
 public:
     explicit ClientPool(const PoolArguments &args);
     ~ClientPool();
 
     Counters getTotalCounters() const;
     int getClientCount() const;
-    std::vector<LatencyValues> getAllLatencies() const;
+    const QString &getName() const;
+    const PoolStats &getStats() const;
+    double getTargetRate() const;
+    std::chrono::time_point<std::chrono::steady_clock> getConstructedAt() const;
+    void publishNextRound(std::chrono::time_point<std::chrono::steady_clock> now);
 
 signals:
 
@@ -53,7 +83,7 @@ public slots:
     void startClients();
 
 private slots:
-    void publishNextRound();
+    void onPublishTimer();
 };
 
 #endif // CLIENTPOOL_H
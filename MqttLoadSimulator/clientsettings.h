@@ -0,0 +1,73 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef CLIENTSETTINGS_H
+#define CLIENTSETTINGS_H
+
+#include <QString>
+#include <QSslConfiguration>
+
+#include "payloadtemplate.h"
+#include "mqttcodec.h"
+#include "epollloop.h"
+#include "bindaddresspool.h"
+#include "reconnectscheduler.h"
+#include "poolstats.h"
+
+/**
+ * @brief The ClientSettings struct is what all clients of a pool have in common. The ClientPool owns it, and doesn't change it once
+ * the clients exist, so a OneClient only has to hold what's different per client.
+ */
+struct ClientSettings
+{
+    quint16 port = 0;
+    const QSslConfiguration *sslConfiguration = nullptr;
+    EpollLoop *nativeEngineLoop = nullptr;
+    BindAddressPool *bindAddresses = nullptr;
+    quint8 protocolVersion = MQTT_PROTOCOL_VERSION_3_1_1;
+    const Mqtt5PublishOptions *mqtt5PublishOptions = nullptr;
+    bool cleanSession = true;
+
+    QString clientIdPart;
+    QString clientid;
+    QString clientPoolRandomId;
+    QString username;
+    QString password;
+    bool randomUsername = false;
+    bool randomPassword = false;
+
+    bool pubAndSub = false;
+    int totalClients = 0;
+    QString topic;
+    QString sharedSubscriptionGroup;
+    int burstInterval = 0;
+    uint burstSpread = 0;
+    int burstSize = 0;
+    uint qos = 0;
+    bool retain = false;
+    bool incrementTopicPerBurst = false;
+    uint maxInflight = 0;
+    const PayloadTemplate *payloadTemplate = nullptr;
+    bool binaryPayload = false;
+
+    ReconnectScheduler *reconnectScheduler = nullptr;
+    PoolStats *stats = nullptr;
+};
+
+#endif // CLIENTSETTINGS_H
@@ -18,8 +18,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 */
 
 #include "counters.h"
-#include <algorithm>
-#include <numeric>
 
 void Counters::operator+=(const Counters &rhs)
 {
@@ -28,6 +26,13 @@ void Counters::operator+=(const Counters &rhs)
     connect += rhs.connect;
     disconnect += rhs.disconnect;
     error += rhs.error;
+    socketWrites += rhs.socketWrites;
+    ackTimeout += rhs.ackTimeout;
+    ackDuplicate += rhs.ackDuplicate;
+    lost += rhs.lost;
+    duplicate += rhs.duplicate;
+    reordered += rhs.reordered;
+    subscribeFailed += rhs.subscribeFailed;
 }
 
 Counters Counters::operator-(const Counters &rhs) const
@@ -38,6 +43,13 @@ Counters Counters::operator-(const Counters &rhs) const
     r.connect = connect - rhs.connect;
     r.disconnect = disconnect - rhs.disconnect;
     r.error = error - rhs.error;
+    r.socketWrites = socketWrites - rhs.socketWrites;
+    r.ackTimeout = ackTimeout - rhs.ackTimeout;
+    r.ackDuplicate = ackDuplicate - rhs.ackDuplicate;
+    r.lost = lost - rhs.lost;
+    r.duplicate = duplicate - rhs.duplicate;
+    r.reordered = reordered - rhs.reordered;
+    r.subscribeFailed = subscribeFailed - rhs.subscribeFailed;
     return r;
 }
 
@@ -52,31 +64,63 @@ void Counters::normalizeToPerSecond(std::chrono::milliseconds period)
     connect *= factor;
     disconnect *= factor;
     error *= factor;
+    socketWrites *= factor;
+    ackTimeout *= factor;
+    ackDuplicate *= factor;
+    lost *= factor;
+    duplicate *= factor;
+    reordered *= factor;
+    subscribeFailed *= factor;
 }
 
-LatencyValues::LatencyValues(const std::vector<std::chrono::microseconds> &latencies)
+AtomicCounters::AtomicCounters() :
+    received(0),
+    publish(0),
+    connect(0),
+    disconnect(0),
+    error(0),
+    socketWrites(0),
+    ackTimeout(0),
+    ackDuplicate(0),
+    lost(0),
+    duplicate(0),
+    reordered(0),
+    subscribeFailed(0)
 {
-    if (latencies.empty())
-        return;
-
-    std::vector<std::chrono::microseconds> real_values;
-    real_values.reserve(latencies.size());
-
-    std::copy_if(latencies.begin(), latencies.end(), std::back_inserter(real_values), [] (const std::chrono::microseconds &x) {
-        return x > std::chrono::microseconds(0);
-    });
 
-    if (real_values.empty())
-        return;
+}
 
-    auto pair = std::minmax_element(real_values.begin(), real_values.end());
+Counters AtomicCounters::load() const
+{
+    Counters r;
+    r.received = received.load(std::memory_order_relaxed);
+    r.publish = publish.load(std::memory_order_relaxed);
+    r.connect = connect.load(std::memory_order_relaxed);
+    r.disconnect = disconnect.load(std::memory_order_relaxed);
+    r.error = error.load(std::memory_order_relaxed);
+    r.socketWrites = socketWrites.load(std::memory_order_relaxed);
+    r.ackTimeout = ackTimeout.load(std::memory_order_relaxed);
+    r.ackDuplicate = ackDuplicate.load(std::memory_order_relaxed);
+    r.lost = lost.load(std::memory_order_relaxed);
+    r.duplicate = duplicate.load(std::memory_order_relaxed);
+    r.reordered = reordered.load(std::memory_order_relaxed);
+    r.subscribeFailed = subscribeFailed.load(std::memory_order_relaxed);
+    return r;
+}
 
-    if (pair.first == real_values.end())
+/**
+ * @brief LatencyValues::LatencyValues summarizes a histogram with values in microseconds.
+ */
+LatencyValues::LatencyValues(const Histogram &latencies)
+{
+    if (latencies.getTotalCount() == 0)
         return;
 
-    this->min = *pair.first;
-    this->max = *pair.second;
-
-    const auto sum = std::accumulate(real_values.begin(), real_values.end(), std::chrono::microseconds(0));
-    this->avg = sum / real_values.size();
+    this->min = std::chrono::microseconds(latencies.getMin());
+    this->avg = std::chrono::microseconds(static_cast<int64_t>(latencies.getMean()));
+    this->p50 = std::chrono::microseconds(latencies.getValueAtPercentile(50.0));
+    this->p90 = std::chrono::microseconds(latencies.getValueAtPercentile(90.0));
+    this->p99 = std::chrono::microseconds(latencies.getValueAtPercentile(99.0));
+    this->p999 = std::chrono::microseconds(latencies.getValueAtPercentile(99.9));
+    this->max = std::chrono::microseconds(latencies.getMax());
 }
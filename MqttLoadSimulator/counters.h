@@ -23,6 +23,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdint.h>
 #include <chrono>
 #include <vector>
+#include <atomic>
+
+#include "histogram.h"
 
 struct Counters
 {
@@ -31,20 +34,64 @@ struct Counters
     uint64_t connect = 0;
     uint64_t disconnect = 0;
     uint64_t error = 0;
+    uint64_t socketWrites = 0;
+    uint64_t ackTimeout = 0;
+    uint64_t ackDuplicate = 0;
+    uint64_t lost = 0;
+    uint64_t duplicate = 0;
+    uint64_t reordered = 0;
+    uint64_t subscribeFailed = 0;
 
     void operator+=(const Counters &rhs);
     Counters operator-(const Counters &rhs) const;
     void normalizeToPerSecond(std::chrono::milliseconds period);
 };
 
+/**
+ * @brief The AtomicCounters struct is what the clients of one ClientPool count into, and what the stats timer reads from another thread.
+ *
+ * There is only one writing thread, so increment() doesn't need an atomic read-modify-write; relaxed loads and stores suffice to
+ * avoid the data race. The alignment keeps them on their own cache line.
+ */
+struct alignas(64) AtomicCounters
+{
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> publish;
+    std::atomic<uint64_t> connect;
+    std::atomic<uint64_t> disconnect;
+    std::atomic<uint64_t> error;
+    std::atomic<uint64_t> socketWrites;
+    std::atomic<uint64_t> ackTimeout;
+    std::atomic<uint64_t> ackDuplicate;
+    std::atomic<uint64_t> lost;
+    std::atomic<uint64_t> duplicate;
+    std::atomic<uint64_t> reordered;
+    std::atomic<uint64_t> subscribeFailed;
+
+    AtomicCounters();
+    AtomicCounters(const AtomicCounters &other) = delete;
+    AtomicCounters &operator=(const AtomicCounters &other) = delete;
+
+    static void increment(std::atomic<uint64_t> &counter, uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Counters load() const;
+};
+
 struct LatencyValues
 {
     std::chrono::microseconds min = std::chrono::microseconds(0);
     std::chrono::microseconds avg = std::chrono::microseconds(0);
+    std::chrono::microseconds p50 = std::chrono::microseconds(0);
+    std::chrono::microseconds p90 = std::chrono::microseconds(0);
+    std::chrono::microseconds p99 = std::chrono::microseconds(0);
+    std::chrono::microseconds p999 = std::chrono::microseconds(0);
     std::chrono::microseconds max = std::chrono::microseconds(0);
 
     LatencyValues() = default;
-    LatencyValues(const std::vector<std::chrono::microseconds> &latencies);
+    LatencyValues(const Histogram &latencies);
 };
 
 #endif // COUNTERS_H
@@ -0,0 +1,129 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "epollloop.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+
+#define EPOLL_MAX_EVENTS 1024
+#define EPOLL_MAX_ROUNDS 4
+#define EPOLL_TIMER_RESOLUTION 100
+#define EPOLL_TIMER_BUCKETS 1024
+
+void EpollHandler::onEpollTimer(std::chrono::time_point<std::chrono::steady_clock> now)
+{
+    (void)now;
+}
+
+EpollLoop::EpollLoop() : QObject(nullptr),
+    events(EPOLL_MAX_EVENTS),
+    timers(std::chrono::milliseconds(EPOLL_TIMER_RESOLUTION), EPOLL_TIMER_BUCKETS)
+{
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (this->epollFd < 0)
+        throw std::runtime_error(std::string("Error creating epoll instance: ") + strerror(errno));
+
+    notifier.reset(new QSocketNotifier(this->epollFd, QSocketNotifier::Read));
+    connect(notifier.get(), &QSocketNotifier::activated, this, &EpollLoop::onEpollReady);
+
+    housekeepingTimer.setInterval(EPOLL_TIMER_RESOLUTION);
+    connect(&housekeepingTimer, &QTimer::timeout, this, &EpollLoop::onHousekeepingTimeout);
+    housekeepingTimer.start();
+}
+
+EpollLoop::~EpollLoop()
+{
+    notifier.reset();
+
+    if (this->epollFd >= 0)
+    {
+        close(this->epollFd);
+        this->epollFd = -1;
+    }
+}
+
+void EpollLoop::add(int fd, uint32_t events, EpollHandler *handler)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = events;
+    ev.data.ptr = handler;
+
+    if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        throw std::runtime_error(std::string("Error adding socket to epoll: ") + strerror(errno));
+}
+
+void EpollLoop::modify(int fd, uint32_t events, EpollHandler *handler)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = events;
+    ev.data.ptr = handler;
+
+    if (epoll_ctl(this->epollFd, EPOLL_CTL_MOD, fd, &ev) != 0)
+        throw std::runtime_error(std::string("Error modifying socket in epoll: ") + strerror(errno));
+}
+
+void EpollLoop::remove(int fd)
+{
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+/**
+ * @brief EpollLoop::scheduleTimer makes the loop call handler->onEpollTimer() at (about) 'when'. The resolution is coarse, and a handler
+ * that is destroyed should not have timers pending.
+ */
+void EpollLoop::scheduleTimer(EpollHandler *handler, std::chrono::time_point<std::chrono::steady_clock> when)
+{
+    timers.schedule(handler, when);
+}
+
+/**
+ * @brief EpollLoop::onEpollReady handles a limited amount of events per call, so one busy loop doesn't starve the rest of the Qt event
+ * loop. Epoll is level-triggered, so the notifier fires again for what is left.
+ */
+void EpollLoop::onEpollReady()
+{
+    for (int round = 0; round < EPOLL_MAX_ROUNDS; round++)
+    {
+        const int n = epoll_wait(this->epollFd, events.data(), events.size(), 0);
+
+        for (int i = 0; i < n; i++)
+        {
+            EpollHandler *handler = static_cast<EpollHandler*>(events[i].data.ptr);
+            handler->onEpollEvents(events[i].events);
+        }
+
+        if (n < static_cast<int>(events.size()))
+            break;
+    }
+}
+
+void EpollLoop::onHousekeepingTimeout()
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    timers.advance(now, [now](EpollHandler *handler) {
+        handler->onEpollTimer(now);
+    });
+}
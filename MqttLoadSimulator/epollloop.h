@@ -0,0 +1,71 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef EPOLLLOOP_H
+#define EPOLLLOOP_H
+
+#include <QObject>
+#include <QTimer>
+#include <QSocketNotifier>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <sys/epoll.h>
+
+#include "timingwheel.h"
+
+class EpollHandler
+{
+public:
+    virtual ~EpollHandler() = default;
+    virtual void onEpollEvents(uint32_t events) = 0;
+    virtual void onEpollTimer(std::chrono::time_point<std::chrono::steady_clock> now);
+};
+
+/**
+ * @brief The EpollLoop class watches many sockets with one epoll instance, and is itself driven by the Qt event loop of its thread
+ * through one QSocketNotifier, instead of one notifier per socket.
+ *
+ * It also has a coarse timer facility for things like keep-alive, so handlers don't need a QTimer each.
+ */
+class EpollLoop : public QObject
+{
+    Q_OBJECT
+
+    int epollFd = -1;
+    std::unique_ptr<QSocketNotifier> notifier;
+    std::vector<struct epoll_event> events;
+    QTimer housekeepingTimer;
+    TimingWheel<EpollHandler*> timers;
+
+private slots:
+    void onEpollReady();
+    void onHousekeepingTimeout();
+
+public:
+    EpollLoop();
+    ~EpollLoop();
+
+    void add(int fd, uint32_t events, EpollHandler *handler);
+    void modify(int fd, uint32_t events, EpollHandler *handler);
+    void remove(int fd);
+    void scheduleTimer(EpollHandler *handler, std::chrono::time_point<std::chrono::steady_clock> when);
+};
+
+#endif // EPOLLLOOP_H
@@ -0,0 +1,225 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "histogram.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "utils.h"
+
+size_t Histogram::bucketCount()
+{
+    return (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * (1 << (SUB_BUCKET_BITS - 1));
+}
+
+uint64_t Histogram::lowestEquivalentValue(size_t index)
+{
+    const size_t halfSubBucketCount = 1 << (SUB_BUCKET_BITS - 1);
+
+    if (index < 2 * halfSubBucketCount)
+        return index;
+
+    const size_t shift = index / halfSubBucketCount - 1;
+    const uint64_t subBucket = index - shift * halfSubBucketCount;
+    return subBucket << shift;
+}
+
+uint64_t Histogram::highestEquivalentValue(size_t index)
+{
+    return lowestEquivalentValue(index + 1) - 1;
+}
+
+Histogram::Histogram() :
+    counts(bucketCount())
+{
+
+}
+
+/**
+ * @brief Histogram::record is the non-concurrent version of HistogramRecorder::record.
+ */
+void Histogram::record(uint64_t value)
+{
+    counts[indexOf(value)]++;
+    totalCount++;
+    sum += value;
+}
+
+void Histogram::operator+=(const Histogram &rhs)
+{
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        counts[i] += rhs.counts[i];
+    }
+
+    totalCount += rhs.totalCount;
+    sum += rhs.sum;
+}
+
+/**
+ * @brief Histogram::operator- is meant to get the values of an interval, by subtracting an earlier snapshot of the same recorder.
+ */
+Histogram Histogram::operator-(const Histogram &rhs) const
+{
+    Histogram r;
+
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        r.counts[i] = counts[i] - std::min(counts[i], rhs.counts[i]);
+        r.totalCount += r.counts[i];
+    }
+
+    r.sum = sum - std::min(sum, rhs.sum);
+    return r;
+}
+
+uint64_t Histogram::getTotalCount() const
+{
+    return totalCount;
+}
+
+uint64_t Histogram::getSum() const
+{
+    return sum;
+}
+
+/**
+ * @brief Histogram::getCountAtOrBelow counts whole buckets, so values that are equivalent to the given one are included.
+ */
+uint64_t Histogram::getCountAtOrBelow(uint64_t value) const
+{
+    const size_t last = std::min(indexOf(value), counts.size() - 1);
+
+    uint64_t result = 0;
+    for (size_t i = 0; i <= last; i++)
+    {
+        result += counts[i];
+    }
+
+    return result;
+}
+
+/**
+ * @brief Histogram::getValueAtPercentile
+ * @param percentile 0 to 100.
+ * @return the highest value that is equivalent to the one at the percentile, so the result errs on the pessimistic side.
+ */
+uint64_t Histogram::getValueAtPercentile(double percentile) const
+{
+    if (totalCount == 0)
+        return 0;
+
+    percentile = std::min(std::max(percentile, 0.0), 100.0);
+    const uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * totalCount)));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        seen += counts[i];
+
+        if (seen >= target)
+            return highestEquivalentValue(i);
+    }
+
+    return getMax();
+}
+
+uint64_t Histogram::getMin() const
+{
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        if (counts[i] > 0)
+            return lowestEquivalentValue(i);
+    }
+
+    return 0;
+}
+
+uint64_t Histogram::getMax() const
+{
+    for (size_t i = counts.size(); i > 0; i--)
+    {
+        if (counts[i - 1] > 0)
+            return highestEquivalentValue(i - 1);
+    }
+
+    return 0;
+}
+
+double Histogram::getMean() const
+{
+    if (totalCount == 0)
+        return 0;
+
+    return static_cast<double>(sum) / static_cast<double>(totalCount);
+}
+
+/**
+ * @brief Histogram::getPercentileDistribution gives a table of all non-empty buckets, in the spirit of HdrHistogram's percentile output.
+ * @param valueDivider to convert the recorded unit to the displayed unit, like 1000.0 to show microseconds as milliseconds.
+ * @param unit name of the displayed unit.
+ */
+std::string Histogram::getPercentileDistribution(double valueDivider, const std::string &unit) const
+{
+    std::string result = formatString("%16s %12s %14s\n", formatString("Value (%s)", unit.c_str()).c_str(), "Percentile", "TotalCount");
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        if (counts[i] == 0)
+            continue;
+
+        seen += counts[i];
+        const double percentile = static_cast<double>(seen) / static_cast<double>(totalCount);
+        result += formatString("%16.3f %12.6f %14lu\n", highestEquivalentValue(i) / valueDivider, percentile, seen);
+    }
+
+    result += formatString("#[Mean = %.3f %s, Max = %.3f %s, Total count = %lu]\n", getMean() / valueDivider, unit.c_str(),
+                           getMax() / valueDivider, unit.c_str(), totalCount);
+    return result;
+}
+
+HistogramRecorder::HistogramRecorder() :
+    counts(new std::atomic<uint64_t>[Histogram::bucketCount()]),
+    sum(0)
+{
+    for (size_t i = 0; i < Histogram::bucketCount(); i++)
+    {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief HistogramRecorder::getSnapshot can be called from any thread. The snapshot is not atomic as a whole, but each bucket is.
+ */
+Histogram HistogramRecorder::getSnapshot() const
+{
+    Histogram r;
+
+    for (size_t i = 0; i < r.counts.size(); i++)
+    {
+        const uint64_t n = counts[i].load(std::memory_order_relaxed);
+        r.counts[i] = n;
+        r.totalCount += n;
+    }
+
+    r.sum = sum.load(std::memory_order_relaxed);
+    return r;
+}
@@ -0,0 +1,113 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <string>
+
+/**
+ * @brief The Histogram class counts values in log-linear buckets, like HdrHistogram does: values below 2^SUB_BUCKET_BITS are
+ * counted exactly, and above that, every power of two is split in 2^(SUB_BUCKET_BITS-1) buckets. That keeps the relative error
+ * under 1/64 with fixed memory, and recording is O(1).
+ *
+ * This is the plain value type, used for snapshots and reporting. See HistogramRecorder for the one that is recorded into.
+ */
+class Histogram
+{
+    std::vector<uint64_t> counts;
+    uint64_t totalCount = 0;
+    uint64_t sum = 0;
+
+    friend class HistogramRecorder;
+
+public:
+    static const int SUB_BUCKET_BITS = 7;
+    static const int MAX_VALUE_BITS = 36;
+
+    static size_t bucketCount();
+    static uint64_t lowestEquivalentValue(size_t index);
+    static uint64_t highestEquivalentValue(size_t index);
+
+    static size_t indexOf(uint64_t value)
+    {
+        const uint64_t subBucketCount = 1 << SUB_BUCKET_BITS;
+
+        if (value < subBucketCount)
+            return value;
+
+        if (value >> MAX_VALUE_BITS)
+            value = (static_cast<uint64_t>(1) << MAX_VALUE_BITS) - 1;
+
+        const int msb = 63 - __builtin_clzll(value);
+        const int shift = msb - SUB_BUCKET_BITS + 1;
+        return shift * (subBucketCount / 2) + (value >> shift);
+    }
+
+    Histogram();
+
+    void record(uint64_t value);
+    void operator+=(const Histogram &rhs);
+    Histogram operator-(const Histogram &rhs) const;
+
+    uint64_t getTotalCount() const;
+    uint64_t getSum() const;
+    uint64_t getCountAtOrBelow(uint64_t value) const;
+    uint64_t getValueAtPercentile(double percentile) const;
+    uint64_t getMin() const;
+    uint64_t getMax() const;
+    double getMean() const;
+    std::string getPercentileDistribution(double valueDivider, const std::string &unit) const;
+};
+
+/**
+ * @brief The HistogramRecorder class is recorded into by one thread, and can be read by others at any time without locking.
+ *
+ * Because there is only one writer, an increment is a relaxed load and store instead of a (much more expensive) atomic
+ * read-modify-write.
+ */
+class HistogramRecorder
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<uint64_t> sum;
+
+    static void increment(std::atomic<uint64_t> &a, uint64_t n)
+    {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+public:
+    HistogramRecorder();
+    HistogramRecorder(const HistogramRecorder &other) = delete;
+    HistogramRecorder &operator=(const HistogramRecorder &other) = delete;
+
+    void record(uint64_t value)
+    {
+        increment(counts[Histogram::indexOf(value)], 1);
+        increment(sum, value);
+    }
+
+    Histogram getSnapshot() const;
+};
+
+#endif // HISTOGRAM_H
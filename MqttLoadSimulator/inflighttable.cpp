@@ -0,0 +1,211 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "inflighttable.h"
+
+#include <algorithm>
+
+#define INFLIGHT_INITIAL_CAPACITY 16
+#define INFLIGHT_MAX_CAPACITY 65536
+#define INFLIGHT_EXPIRY_INTERVAL_MICROS 1000000
+
+/**
+ * @brief InflightTable::InflightTable
+ * @param maxInflight the window, or 0 for no limit.
+ */
+InflightTable::InflightTable(uint32_t maxInflight) :
+    maxInflight(std::min<uint32_t>(maxInflight, INFLIGHT_MAX_CAPACITY))
+{
+
+}
+
+void InflightTable::resize(uint32_t newCapacity)
+{
+    std::unique_ptr<Entry[]> old = std::move(entries);
+    const uint32_t oldCapacity = capacity;
+
+    entries.reset(new Entry[newCapacity]);
+    capacity = newCapacity;
+
+    for (uint32_t i = 0; i < oldCapacity; i++)
+    {
+        const Entry &e = old[i];
+
+        if (e.qos > 0)
+            entries[e.packetId % capacity] = e;
+    }
+}
+
+/**
+ * @brief InflightTable::getInitialCapacity makes room for two windows, so that in-order acks don't make the table grow.
+ */
+uint32_t InflightTable::getInitialCapacity() const
+{
+    uint32_t result = INFLIGHT_INITIAL_CAPACITY;
+
+    while (result < 2 * maxInflight && result < INFLIGHT_MAX_CAPACITY)
+    {
+        result *= 2;
+    }
+
+    return result;
+}
+
+/**
+ * @brief InflightTable::setServerLimit sets the window the server allows, or 0 for none. It can change with every connect.
+ */
+void InflightTable::setServerLimit(uint32_t limit)
+{
+    serverLimit = limit;
+}
+
+bool InflightTable::isFull() const
+{
+    return (maxInflight > 0 && count >= maxInflight) || (serverLimit > 0 && count >= serverLimit);
+}
+
+uint32_t InflightTable::size() const
+{
+    return count;
+}
+
+/**
+ * @brief InflightTable::add
+ * @return the amount of entries evicted, which is only when the packet id is still in flight, and those are lost as far as tracking
+ * goes.
+ */
+int InflightTable::add(uint16_t packetId, uint8_t qos, int64_t nowMicros)
+{
+    if (!entries)
+        resize(getInitialCapacity());
+
+    while (capacity < INFLIGHT_MAX_CAPACITY && entries[packetId % capacity].qos > 0)
+    {
+        resize(capacity * 2);
+    }
+
+    Entry &e = entries[packetId % capacity];
+    int evicted = 0;
+
+    if (e.qos > 0)
+    {
+        evicted = 1;
+        count--;
+    }
+
+    e.packetId = packetId;
+    e.qos = qos;
+    e.pubrecReceived = false;
+    e.sentAtMicros = nowMicros;
+    count++;
+    return evicted;
+}
+
+/**
+ * @brief InflightTable::ack registers an ack, and frees the entry when it's the last one for its QoS.
+ * @param latencyMicros set to the time since the publish was sent.
+ * @return false for an ack we aren't waiting for, like a duplicate.
+ */
+bool InflightTable::ack(uint16_t packetId, PublishAck ack, int64_t nowMicros, int64_t &latencyMicros)
+{
+    if (!entries)
+        return false;
+
+    Entry &e = entries[packetId % capacity];
+
+    if (e.qos == 0 || e.packetId != packetId)
+        return false;
+
+    switch (ack)
+    {
+    case PublishAck::Puback:
+        if (e.qos != 1)
+            return false;
+        break;
+    case PublishAck::Pubrec:
+        if (e.qos != 2 || e.pubrecReceived)
+            return false;
+        e.pubrecReceived = true;
+        break;
+    case PublishAck::Pubcomp:
+        // QMQTT doesn't tell us about PUBREC, so we can't insist on it.
+        if (e.qos != 2)
+            return false;
+        break;
+    }
+
+    latencyMicros = std::max<int64_t>(0, nowMicros - e.sentAtMicros);
+
+    if (ack != PublishAck::Pubrec)
+    {
+        e.qos = 0;
+        count--;
+    }
+
+    return true;
+}
+
+/**
+ * @brief InflightTable::expire removes entries sent before the given time.
+ * @return the amount removed.
+ */
+int InflightTable::expire(int64_t olderThanMicros)
+{
+    if (count == 0)
+        return 0;
+
+    int result = 0;
+
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        Entry &e = entries[i];
+
+        if (e.qos > 0 && e.sentAtMicros < olderThanMicros)
+        {
+            e.qos = 0;
+            count--;
+            result++;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief InflightTable::expireIfDue expires what is older than the timeout when the table is full, and otherwise at most once a
+ * second, so publishes that are never acknowledged are counted while the connection stays up, without scanning on every publish.
+ * @return the amount removed.
+ */
+int InflightTable::expireIfDue(int64_t nowMicros, int64_t timeoutMicros)
+{
+    if (!isFull() && nowMicros < nextExpiryCheckMicros)
+        return 0;
+
+    nextExpiryCheckMicros = nowMicros + INFLIGHT_EXPIRY_INTERVAL_MICROS;
+    return expire(nowMicros - timeoutMicros);
+}
+
+/**
+ * @brief InflightTable::clear is for when the connection is gone, and with it, any chance of getting the acks.
+ * @return the amount removed.
+ */
+int InflightTable::clear()
+{
+    return expire(INT64_MAX);
+}
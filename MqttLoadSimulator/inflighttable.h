@@ -0,0 +1,73 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef INFLIGHTTABLE_H
+#define INFLIGHTTABLE_H
+
+#include <stdint.h>
+#include <memory>
+
+#include "mqttconnection.h"
+
+/**
+ * @brief The InflightTable class tracks a client's QoS 1 and 2 publishes that aren't fully acknowledged yet.
+ *
+ * It's an array indexed by packet id modulo the capacity, which is a power of two, and works because we hand out packet ids
+ * sequentially. When a slot is still taken, because packet ids wrapped from 65535 to 1 or acks came out of order, the table grows
+ * instead of evicting. At 65536 every packet id has its own slot, so then only an id that is reused while still in flight is evicted.
+ * It's allocated on first use, so clients that don't publish with QoS > 0 pay nothing.
+ *
+ * The maximum is the window, and isFull() is the backpressure. The server's receive maximum is a window too, whichever is smaller.
+ */
+class InflightTable
+{
+    struct Entry
+    {
+        int64_t sentAtMicros = 0;
+        uint16_t packetId = 0;
+        uint8_t qos = 0; // 0 means a free slot.
+        bool pubrecReceived = false;
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    const uint32_t maxInflight;
+    uint32_t serverLimit = 0;
+    uint32_t capacity = 0;
+    uint32_t count = 0;
+    int64_t nextExpiryCheckMicros = 0;
+
+    void resize(uint32_t newCapacity);
+    uint32_t getInitialCapacity() const;
+
+public:
+    InflightTable(uint32_t maxInflight);
+    InflightTable(const InflightTable &other) = delete;
+    InflightTable &operator=(const InflightTable &other) = delete;
+
+    void setServerLimit(uint32_t limit);
+    bool isFull() const;
+    uint32_t size() const;
+    int add(uint16_t packetId, uint8_t qos, int64_t nowMicros);
+    bool ack(uint16_t packetId, PublishAck ack, int64_t nowMicros, int64_t &latencyMicros);
+    int expire(int64_t olderThanMicros);
+    int expireIfDue(int64_t nowMicros, int64_t timeoutMicros);
+    int clear();
+};
+
+#endif // INFLIGHTTABLE_H
@@ -21,10 +21,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include "stdio.h"
 #include "utils.h"
 #include "poolarguments.h"
+#include "globals.h"
 #include "cassert"
 
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <numeric>
+
 #define STATS_INTERVAL 1000
 
+int LoadSimulator::quitSignalFds[2] = {-1, -1};
+
 LoadSimulator::LoadSimulator(int &argc, char **argv) : QCoreApplication(argc, argv),
     statsTimer()
 {
@@ -33,11 +41,56 @@ LoadSimulator::LoadSimulator(int &argc, char **argv) : QCoreApplication(argc, ar
     connect(&statsTimer, &QTimer::timeout, this, &LoadSimulator::onStatsTimeout);
     statsTimer.start();
 
-    for(int i = 0; i < QThread::idealThreadCount(); i++)
+    if (pipe2(quitSignalFds, O_CLOEXEC | O_NONBLOCK) != 0)
+        throw std::runtime_error("Error creating signal pipe");
+
+    quitSignalNotifier.reset(new QSocketNotifier(quitSignalFds[0], QSocketNotifier::Read));
+    connect(quitSignalNotifier.get(), &QSocketNotifier::activated, this, &LoadSimulator::onQuitSignal);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(struct sigaction));
+    sa.sa_handler = &LoadSimulator::handleQuitSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+}
+
+LoadSimulator::~LoadSimulator()
+{
+    for(auto &t : threads)
     {
-        std::unique_ptr<QThread> t(new QThread());
-        t->start();
+        t->quit();
+        t->wait();
+    }
+
+    if (selfTestBrokerThread)
+    {
+        selfTestBrokerThread->quit();
+        selfTestBrokerThread->wait();
+    }
+
+    if (statsWriterThread)
+    {
+        // Let the writer finish the records still queued, before stopping its thread.
+        QMetaObject::invokeMethod(statsWriter.get(), [](){}, Qt::BlockingQueuedConnection);
+        statsWriterThread->quit();
+        statsWriterThread->wait();
+    }
+}
+
+/**
+ * @brief LoadSimulator::startThreads starts the worker threads. Call it once, before creating pools.
+ * @param amount the amount of threads.
+ * @param cpus when not empty, thread i is pinned to cpus[i % cpus.size()].
+ */
+void LoadSimulator::startThreads(int amount, const std::vector<int> &cpus)
+{
+    for(int i = 0; i < amount; i++)
+    {
+        const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        std::unique_ptr<QThread> t(new WorkerThread(cpu));
         t->setObjectName(QString("MqttLoadSim %1").arg(i));
+        t->start();
         threads.push_back(std::move(t));
     }
 
@@ -45,44 +98,101 @@ LoadSimulator::LoadSimulator(int &argc, char **argv) : QCoreApplication(argc, ar
     {
         std::unique_ptr<ThreadLoopDriftGuage> t(new ThreadLoopDriftGuage());
         t->moveToThread(threads[i].get());
-        t->start();
+        QTimer::singleShot(0, t.get(), &ThreadLoopDriftGuage::start);
         threadDriftGuages.push_back(std::move(t));
     }
+
+    prevThreadLags.resize(threadDriftGuages.size());
+    prevThreadBusyTimes.resize(threadDriftGuages.size());
 }
 
-LoadSimulator::~LoadSimulator()
+/**
+ * @brief LoadSimulator::setStatsOutput makes every stats interval also be written to a file, by a separate thread.
+ * @param path file to write; CSV when it ends in '.csv', JSON lines otherwise.
+ */
+void LoadSimulator::setStatsOutput(const QString &path)
 {
-    for(auto &t : threads)
-    {
-        t->quit();
-        t->wait();
-    }
+    statsWriter.reset(new StatsWriter(path));
+    statsWriterThread.reset(new QThread());
+    statsWriterThread->setObjectName("MqttLoadSim stats");
+    statsWriter->moveToThread(statsWriterThread.get());
+    statsWriterThread->start();
+}
+
+/**
+ * @brief LoadSimulator::setMetricsPort starts serving metrics for Prometheus on the port, updated every stats interval.
+ */
+void LoadSimulator::setMetricsPort(quint16 port)
+{
+    metricsServer.reset(new MetricsServer(port));
+}
+
+/**
+ * @brief LoadSimulator::setPoolBreakdown shows the rates and latency of every pool, by name, on top of the totals. For scenarios, in
+ * which pools differ in more than their amount.
+ */
+void LoadSimulator::setPoolBreakdown(bool value)
+{
+    poolBreakdown = value;
+}
+
+/**
+ * @brief LoadSimulator::startSelfTestBroker starts the loopback broker for --self-test, in a thread of its own.
+ * @param port 0 for any free port.
+ * @return the port it listens on.
+ */
+quint16 LoadSimulator::startSelfTestBroker(quint16 port)
+{
+    selfTestBroker.reset(new SelfTestBroker(port));
+    selfTestBrokerThread.reset(new WorkerThread(-1));
+    selfTestBrokerThread->setObjectName("MqttLoadSim broker");
+    selfTestBroker->moveToThread(selfTestBrokerThread.get());
+
+    selfTestBrokerGuage.reset(new ThreadLoopDriftGuage());
+    selfTestBrokerGuage->moveToThread(selfTestBrokerThread.get());
+
+    selfTestBrokerThread->start();
+    QTimer::singleShot(0, selfTestBroker.get(), &SelfTestBroker::start);
+    QTimer::singleShot(0, selfTestBrokerGuage.get(), &ThreadLoopDriftGuage::start);
+
+    return selfTestBroker->getPort();
 }
 
 /**
  * @brief LoadSimulator::createPoolsBasedOnArgument creates as many clients as specified by args, but divides them over the threads.
  * @param args
+ *
+ * Every thread gets amount / threads clients, and the remainder is given out one by one. Where that remainder goes rotates per call,
+ * so that the active and passive pools don't pile their extra clients on the same threads.
  */
 void LoadSimulator::createPoolsBasedOnArgument(const PoolArguments &args)
 {
     if (args.amount == 0)
         return;
 
-    std::vector<int> subamounts(threads.size());
-    const int n = args.amount / threads.size() + (args.amount % threads.size());
+    const int threadCount = threads.size();
+    std::vector<int> subamounts(threadCount, args.amount / threadCount);
+    const int remainder = args.amount % threadCount;
 
-    int totalAmount = args.amount;
-    for(int &c : subamounts)
+    for (int i = 0; i < remainder; i++)
     {
-        c = std::min<int>(n, totalAmount);
-        totalAmount -= n;
-
-        if (totalAmount <= 0)
-            break;
+        subamounts[(remainderOffset + i) % threadCount]++;
     }
 
+    remainderOffset = (remainderOffset + remainder) % threadCount;
+
     assert(std::accumulate(subamounts.begin(), subamounts.end(), 0) == args.amount);
 
+    if (args.pub_and_sub)
+        targetRate += args.rate;
+
+    if (args.bindAddresses)
+        bindAddresses = args.bindAddresses;
+
+    // Only the binary payload has the sender and sequence needed for it.
+    if (args.binaryPayload)
+        sequenceTracking = true;
+
     for (uint i = 0; i < subamounts.size(); i++)
     {
         int c = subamounts[i];
@@ -91,134 +201,542 @@ void LoadSimulator::createPoolsBasedOnArgument(const PoolArguments &args)
 
         PoolArguments args2(args);
         args2.amount = c;
+        args2.rate = args.rate * c / args.amount;
 
-        std::unique_ptr<PoolStarter> ps(new PoolStarter(args2));
+        std::unique_ptr<PoolStarter> ps(new PoolStarter(args2, i));
         ps->moveToThread(threads[i].get());
         QTimer::singleShot(0, ps.get(), &PoolStarter::makeClientPool);
         starters.push_back(std::move(ps));
     }
 }
 
-std::string LoadSimulator::getDriftString(Drift drift) const
+/**
+ * @brief LoadSimulator::getDriftString judges the worst thread, because one overloaded thread is enough to skew the results.
+ */
+std::string LoadSimulator::getDriftString(const std::vector<ThreadLoad> &loads) const
 {
+    ThreadLoad worst;
+    double busySum = 0;
+
+    for (const ThreadLoad &l : loads)
+    {
+        worst.lagP99Ms = std::max(worst.lagP99Ms, l.lagP99Ms);
+        worst.lagMaxMs = std::max(worst.lagMaxMs, l.lagMaxMs);
+        worst.busyRatio = std::max(worst.busyRatio, l.busyRatio);
+        busySum += l.busyRatio;
+    }
+
+    const double busyAvg = loads.empty() ? 0.0 : busySum / loads.size();
+
     std::string col = "\033[01;32m";
     std::string status = "OK";
 
-    if (drift.avg > 200 || drift.max > 200)
+    if (worst.lagP99Ms > 100 || worst.lagMaxMs > 200 || worst.busyRatio > 0.98)
     {
         col = "\033[01;31m";
         status = "tester overload!";
     }
-    else if (drift.avg > 100 || drift.max > 100)
+    else if (worst.lagP99Ms > 20 || worst.lagMaxMs > 100 || worst.busyRatio > 0.9)
     {
         col = "\033[01;33m";
         status = "lagging...";
     }
 
-    std::string s = formatString("%sAvg: %.2f ms, max: %d ms (%s)\033[00m", col.c_str(), drift.avg, drift.max, status.c_str());
+    std::string s = formatString("%sp99: %.1f ms, max: %.1f ms. Busy: avg %.0f%%, max %.0f%% (%s)\033[00m", col.c_str(), worst.lagP99Ms,
+                                 worst.lagMaxMs, busyAvg * 100.0, worst.busyRatio * 100.0, status.c_str());
     return s;
 }
 
-Drift LoadSimulator::getAvgDriftLoop() const
+/**
+ * @brief LoadSimulator::sampleThreadLoads gives the loop lag and busy ratio of each thread since the previous call.
+ * @param interval time since the previous call.
+ */
+std::vector<ThreadLoad> LoadSimulator::sampleThreadLoads(std::chrono::nanoseconds interval)
 {
-    Drift result;
-
-    std::vector<int> sizes(threadDriftGuages.size());
+    std::vector<ThreadLoad> result(threadDriftGuages.size());
 
     for(uint i = 0; i < threadDriftGuages.size(); i++)
     {
-        auto &t = threadDriftGuages[i];
-        int n = t->getMainLoopDrift();
-        sizes[i] = n;
-        result.max = std::max<int>(n, result.max);
+        const Histogram lags = threadDriftGuages[i]->getLagSnapshot();
+        const std::chrono::nanoseconds busy = threadDriftGuages[i]->getBusyTime();
+
+        const Histogram intervalLags = lags - prevThreadLags[i];
+        result[i].lagP99Ms = intervalLags.getValueAtPercentile(99.0) / 1000.0;
+        result[i].lagMaxMs = intervalLags.getMax() / 1000.0;
+
+        if (interval.count() > 0)
+        {
+            const double ratio = static_cast<double>((busy - prevThreadBusyTimes[i]).count()) / static_cast<double>(interval.count());
+            result[i].busyRatio = std::min(std::max(ratio, 0.0), 1.0);
+        }
+
+        prevThreadLags[i] = lags;
+        prevThreadBusyTimes[i] = busy;
+    }
+
+    return result;
+}
+
+/**
+ * @brief LoadSimulator::getBindAddressString summarizes the connections per source address, to show how close we are to running out
+ * of ephemeral ports on one.
+ */
+std::string LoadSimulator::getBindAddressString() const
+{
+    if (!bindAddresses)
+        return std::string();
+
+    const std::vector<int64_t> counts = bindAddresses->getConnectionCounts();
+    const auto minmax = std::minmax_element(counts.begin(), counts.end());
+
+    return formatString(", from %zu source addresses (connections per address min/max: \033[01;36m%ld\033[00m / \033[01;36m%ld\033[00m)",
+                        counts.size(), *minmax.first, *minmax.second);
+}
+
+/**
+ * @brief getHistogramsString shows p50/p99/max of the histograms that have values.
+ */
+static std::string getHistogramsString(const std::vector<std::pair<const char*, const Histogram*>> &histograms)
+{
+    std::string result;
+
+    for (const auto &named : histograms)
+    {
+        const Histogram &h = *named.second;
+
+        if (h.getTotalCount() == 0)
+            continue;
+
+        result += formatString("%s: \033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m ms. ", named.first,
+                               h.getValueAtPercentile(50.0) / 1000.0, h.getValueAtPercentile(99.0) / 1000.0, h.getMax() / 1000.0);
+    }
+
+    return result;
+}
+
+/**
+ * @brief LoadSimulator::getConnectPhasesString shows the connection phases of the interval, if there were any connects, and subscriptions
+ * the server refused, if any.
+ */
+std::string LoadSimulator::getConnectPhasesString(const StatsHistograms &interval, const Counters &cnt) const
+{
+    std::string result = getHistogramsString({{"TCP connect", &interval.tcpConnect}, {"CONNACK", &interval.connack}, {"SUBACK", &interval.suback}});
+
+    if (result.empty())
+        result = "none in this interval.";
+
+    if (cnt.subscribeFailed > 0)
+        result += formatString(" \033[01;31mSubscribe failures\033[00m: %lu.", cnt.subscribeFailed);
+
+    return "\n\033[01mConnection phases\033[00m (p50/p99/max): " + result;
+}
+
+/**
+ * @brief LoadSimulator::getAckString shows the ack latencies of QoS 1 and 2 publishes, or nothing when there are none.
+ */
+std::string LoadSimulator::getAckString(const StatsHistograms &interval, const Counters &cnt) const
+{
+    if (!showAcks)
+        return std::string();
+
+    std::string result = getHistogramsString({{"PUBACK", &interval.puback}, {"PUBREC", &interval.pubrec}, {"PUBCOMP", &interval.pubcomp}});
+
+    return formatString("\n\033[01mPublish acks\033[00m (p50/p99/max): %sTimed out: %lu. Duplicate: %lu.", result.c_str(), cnt.ackTimeout,
+                        cnt.ackDuplicate);
+}
+
+/**
+ * @brief LoadSimulator::getConnectStormSummary summarizes the initial connects of all clients, which is when a server is stressed most
+ * by connection handling.
+ */
+std::string LoadSimulator::getConnectStormSummary(const StatsHistograms &histograms, int clients, std::chrono::nanoseconds duration) const
+{
+    const double seconds = std::chrono::duration<double>(duration).count();
+    std::string result = formatString("\n\033[01mConnect storm\033[00m: %d clients connected in \033[01;36m%.2f s\033[00m (%.0f/s). ", clients,
+                                      seconds, seconds > 0 ? clients / seconds : 0.0);
+
+    const LatencyValues connack(histograms.connack);
+    const LatencyValues suback(histograms.suback);
+
+    if (histograms.tcpConnect.getTotalCount() > 0)
+    {
+        const LatencyValues tcp(histograms.tcpConnect);
+        result += formatString("TCP connect p50/p99/max: %.1f / %.1f / %.1f ms. ", tcp.p50.count() / 1000.0, tcp.p99.count() / 1000.0,
+                               tcp.max.count() / 1000.0);
+    }
+
+    result += formatString("CONNACK p50/p99/max: %.1f / %.1f / %.1f ms. SUBACK p50/p99/max: %.1f / %.1f / %.1f ms.",
+                           connack.p50.count() / 1000.0, connack.p99.count() / 1000.0, connack.max.count() / 1000.0,
+                           suback.p50.count() / 1000.0, suback.p99.count() / 1000.0, suback.max.count() / 1000.0);
+    return result;
+}
+
+/**
+ * @brief LoadSimulator::getMemoryString is for verbose mode: what the clients cost in memory of our process. Kernel memory for the
+ * sockets is not included.
+ */
+std::string LoadSimulator::getMemoryString(int clients) const
+{
+    if (!Globals::verbose || clients == 0)
+        return std::string();
+
+    const size_t resident = getResidentMemory();
+    const size_t used = resident - std::min(resident, residentMemoryAtStart);
+    return formatString("\n\033[01mMemory\033[00m: %.1f MB resident, \033[01;36m%.0f bytes per client\033[00m.", resident / 1048576.0,
+                        static_cast<double>(used) / clients);
+}
+
+/**
+ * @brief LoadSimulator::getSelfTestString shows how busy the self-test broker is. When it's close to fully busy, the numbers are the
+ * ceiling of the broker stand-in, not of the tester.
+ */
+std::string LoadSimulator::getSelfTestString(std::chrono::nanoseconds interval)
+{
+    if (!selfTestBroker)
+        return std::string();
+
+    const uint64_t received = selfTestBroker->getReceived();
+    const uint64_t delivered = selfTestBroker->getDelivered();
+    const std::chrono::nanoseconds busy = selfTestBrokerGuage->getBusyTime();
+    const double seconds = std::chrono::duration<double>(interval).count();
+
+    double busyRatio = 0;
+    double receivedRate = 0;
+    double deliveredRate = 0;
+
+    if (seconds > 0)
+    {
+        busyRatio = std::min(std::max(std::chrono::duration<double>(busy - prevSelfTestBusyTime).count() / seconds, 0.0), 1.0);
+        receivedRate = (received - prevSelfTestReceived) / seconds;
+        deliveredRate = (delivered - prevSelfTestDelivered) / seconds;
+    }
+
+    prevSelfTestReceived = received;
+    prevSelfTestDelivered = delivered;
+    prevSelfTestBusyTime = busy;
+
+    const char *color = busyRatio >= 0.9 ? "\033[01;31m" : "\033[01;36m";
+    return formatString("\n\033[01mSelf-test broker\033[00m: %ld connections. In: \033[01;36m%.0f/s\033[00m. Out: \033[01;36m%.0f/s\033[00m. "
+                        "Busy: %s%.0f%%\033[00m.", selfTestBroker->getSessionCount(), receivedRate, deliveredRate, color, busyRatio * 100.0);
+}
+
+/**
+ * @brief LoadSimulator::getPoolBreakdownString gives a line per pool name. A pool is split over the threads, so its ClientPools are
+ * added up.
+ * @param intervals what every pool in 'pools' did since the previous interval.
+ */
+std::string LoadSimulator::getPoolBreakdownString(const std::vector<PoolSnapshot> &pools, const std::vector<PoolTotals> &intervals,
+                                                  std::chrono::milliseconds period) const
+{
+    if (!poolBreakdown)
+        return std::string();
+
+    std::string result;
+    std::vector<bool> done(pools.size(), false);
+
+    for (size_t i = 0; i < pools.size(); i++)
+    {
+        if (done[i])
+            continue;
+
+        int clients = 0;
+        Counters rates;
+        Histogram latency;
+
+        for (size_t j = i; j < pools.size(); j++)
+        {
+            if (pools[j].name != pools[i].name)
+                continue;
+
+            clients += pools[j].clients;
+            rates += intervals[j].counters;
+            latency += intervals[j].latency;
+            done[j] = true;
+        }
+
+        rates.normalizeToPerSecond(period);
+        const LatencyValues l(latency);
+
+        result += formatString("\n\033[01mPool '%s'\033[00m: %d clients. Sent: \033[01;36m%ld/s\033[00m. Recv: \033[01;36m%ld/s\033[00m. "
+                               "Errors: %ld/s. Latency (p50/p99/max): \033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m / "
+                               "\033[01;36m%.1f\033[00m ms.", qPrintable(pools[i].name), clients, rates.publish, rates.received, rates.error,
+                               l.p50.count() / 1000.0, l.p99.count() / 1000.0, l.max.count() / 1000.0);
     }
 
-    result.avg = std::accumulate(sizes.begin(), sizes.end(), 0.0) / sizes.size();
     return result;
 }
 
+/**
+ * @brief LoadSimulator::updateRecovery follows episodes of clients being disconnected after the initial connect storm, like when the
+ * server restarts, to see how long it takes until all clients are back.
+ * @param firstRecentDisconnectAt the earliest of the pools' last disconnect times that are after the previous recovery.
+ * @return a line for the stats display.
+ */
+std::string LoadSimulator::updateRecovery(int disconnected, int64_t lastConnectedAt, int64_t firstRecentDisconnectAt)
+{
+    if (connectStormSummary.empty())
+        return std::string();
+
+    if (!recovering && disconnected > 0)
+    {
+        recovering = true;
+        recoveryStartedAt = firstRecentDisconnectAt > 0 ? firstRecentDisconnectAt : lastConnectedAt;
+        recoveryClients = 0;
+    }
+
+    if (recovering)
+    {
+        recoveryClients = std::max(recoveryClients, disconnected);
+
+        if (disconnected == 0)
+        {
+            recovering = false;
+            recoveryEndedAt = lastConnectedAt;
+            lastRecoverySeconds = std::max<int64_t>(0, recoveryEndedAt - recoveryStartedAt) / 1e9;
+            lastRecoveryClients = recoveryClients;
+        }
+    }
+
+    if (recovering)
+    {
+        const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        return formatString("\n\033[01mRecovery\033[00m: \033[01;33m%d clients down\033[00m (at most %d), for %.1f s so far.", disconnected,
+                            recoveryClients, (now - recoveryStartedAt) / 1e9);
+    }
+
+    if (lastRecoverySeconds >= 0)
+    {
+        return formatString("\n\033[01mLast recovery\033[00m: %d clients reconnected in \033[01;36m%.2f s\033[00m.", lastRecoveryClients,
+                            lastRecoverySeconds);
+    }
+
+    return std::string();
+}
+
 void LoadSimulator::onStatsTimeout()
 {
     Counters cnt;
     int totalClients = 0;
 
-    std::vector<LatencyValues> latencies;
+    StatsHistograms histograms;
+    std::chrono::time_point<std::chrono::steady_clock> firstConstructedAt = std::chrono::steady_clock::time_point::max();
+    std::chrono::time_point<std::chrono::steady_clock> lastConstructedAt = startedAt;
+    int64_t lastConnectedAt = 0;
+    int64_t firstRecentDisconnectAt = 0;
+    std::vector<PoolSnapshot> pools;
+    std::vector<PoolTotals> poolIntervals;
 
     for(std::unique_ptr<PoolStarter> &s : starters)
     {
-        std::unique_ptr<ClientPool> &c = s->getClientPool();
+        const ClientPool *c = s->getClientPool();
 
         if (!c)
             return;
 
-        cnt += c->getTotalCounters();
-        totalClients += c->getClientCount();
-
-        const std::vector<LatencyValues> l = c->getAllLatencies();
-        latencies.insert(latencies.end(), l.begin(), l.end());
+        PoolSnapshot pool;
+        pool.name = c->getName();
+        pool.thread = s->getThreadIndex();
+        pool.clients = c->getClientCount();
+        pool.counters = c->getTotalCounters();
+
+        cnt += pool.counters;
+        totalClients += pool.clients;
+
+        const StatsHistograms poolHistograms = c->getStats().getHistograms();
+        histograms += poolHistograms;
+
+        // The pools are made once and never reordered, so the index in 'starters' identifies one.
+        if (prevPoolTotals.size() <= pools.size())
+            prevPoolTotals.resize(pools.size() + 1);
+
+        PoolTotals &prevPool = prevPoolTotals[pools.size()];
+        PoolTotals poolInterval;
+        poolInterval.counters = pool.counters - prevPool.counters;
+        poolInterval.latency = poolHistograms.latency - prevPool.latency;
+        pool.latency = LatencyValues(poolInterval.latency);
+        prevPool.counters = pool.counters;
+        prevPool.latency = poolHistograms.latency;
+        poolIntervals.push_back(std::move(poolInterval));
+
+        firstConstructedAt = std::min(firstConstructedAt, c->getConstructedAt());
+        lastConstructedAt = std::max(lastConstructedAt, c->getConstructedAt());
+        lastConnectedAt = std::max(lastConnectedAt, c->getStats().lastConnectedAt.load(std::memory_order_relaxed));
+
+        const int64_t lastDisconnectedAt = c->getStats().lastDisconnectedAt.load(std::memory_order_relaxed);
+        if (lastDisconnectedAt > std::max(recoveryEndedAt, connectStormEndedAt) && (firstRecentDisconnectAt == 0 || lastDisconnectedAt < firstRecentDisconnectAt))
+            firstRecentDisconnectAt = lastDisconnectedAt;
+        pools.push_back(pool);
     }
 
-    LatencyValues latency_summary;
-
-    if (!latencies.empty())
-    {
-        std::vector<std::chrono::microseconds> mins;
-        mins.reserve(latencies.size());
-        std::vector<std::chrono::microseconds> avgs;
-        avgs.reserve(latencies.size());
-        std::vector<std::chrono::microseconds> maxs;
-        maxs.reserve(latencies.size());
-
-        std::for_each(latencies.begin(), latencies.end(), [&](LatencyValues &v) {
-            mins.push_back(v.min);
-            avgs.push_back(v.avg);
-            maxs.push_back(v.max);
-        });
-
-        auto mins_pos = std::min_element(mins.begin(), mins.end());
-        if (mins_pos != mins.end())
-            latency_summary.min = *mins_pos;
+    if (allConstructedAfter.count() < 0)
+        allConstructedAfter = std::chrono::duration_cast<std::chrono::milliseconds>(lastConstructedAt - startedAt);
 
-        auto maxs_pos = std::max_element(maxs.begin(), maxs.end());
-        if (maxs_pos != maxs.end())
-            latency_summary.max = *maxs_pos;
+    const StatsHistograms intervalHistograms = histograms - prevHistograms;
+    const LatencyValues latency_summary(intervalHistograms.latency);
 
-        const auto sum_avg = std::accumulate(avgs.begin(), avgs.end(), std::chrono::microseconds(0));
-        latency_summary.avg = sum_avg / avgs.size();
+    // The first time all clients are connected at once, the initial connect storm is over.
+    const uint64_t connected = cnt.connect - std::min(cnt.connect, cnt.disconnect);
+    if (connectStormSummary.empty() && totalClients > 0 && connected >= static_cast<uint64_t>(totalClients))
+    {
+        const std::chrono::nanoseconds lastConnectedSinceEpoch(lastConnectedAt);
+        const std::chrono::nanoseconds stormDuration = lastConnectedSinceEpoch - std::chrono::duration_cast<std::chrono::nanoseconds>(firstConstructedAt.time_since_epoch());
+        connectStormSummary = getConnectStormSummary(histograms, totalClients, stormDuration);
+        connectStormEndedAt = lastConnectedAt;
     }
 
+    const int disconnected = static_cast<int>(totalClients - std::min<uint64_t>(connected, totalClients));
+    const std::string recoveryString = updateRecovery(disconnected, lastConnectedAt, firstRecentDisconnectAt);
+    const std::string memoryString = getMemoryString(totalClients);
+    const std::string selfTestString = getSelfTestString(std::chrono::steady_clock::now() - prevCountWhen);
+
     Counters diff = cnt - prevCounts;
     std::chrono::milliseconds msSinceLastTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - prevCountWhen);
     diff.normalizeToPerSecond(msSinceLastTime);
 
-    Drift drift = getAvgDriftLoop();
+    const std::vector<ThreadLoad> threadLoads = sampleThreadLoads(std::chrono::steady_clock::now() - prevCountWhen);
+    const std::string poolBreakdownString = getPoolBreakdownString(pools, poolIntervals, msSinceLastTime);
+
+    if (statsWriter || metricsServer)
+    {
+        StatsSnapshot snapshot;
+        snapshot.unixTimeMs = QDateTime::currentMSecsSinceEpoch();
+        snapshot.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count();
+        snapshot.clients = totalClients;
+        snapshot.disconnectedClients = disconnected;
+        snapshot.lastRecoverySeconds = lastRecoverySeconds;
+        snapshot.targetRate = targetRate;
+        snapshot.totals = cnt;
+        snapshot.rates = diff;
+        snapshot.latency = latency_summary;
+        snapshot.tcpConnect = LatencyValues(intervalHistograms.tcpConnect);
+        snapshot.connack = LatencyValues(intervalHistograms.connack);
+        snapshot.suback = LatencyValues(intervalHistograms.suback);
+        snapshot.puback = LatencyValues(intervalHistograms.puback);
+        snapshot.pubrec = LatencyValues(intervalHistograms.pubrec);
+        snapshot.pubcomp = LatencyValues(intervalHistograms.pubcomp);
+        snapshot.threadLoads = threadLoads;
+        snapshot.pools = std::move(pools);
+
+        if (metricsServer)
+            metricsServer->update(snapshot, histograms);
+
+        if (statsWriter)
+        {
+            StatsWriter *writer = statsWriter.get();
+            QMetaObject::invokeMethod(writer, [writer, snapshot]() {
+                writer->write(snapshot);
+            }, Qt::QueuedConnection);
+        }
+    }
 
     const uint64_t diffCount = std::max(cnt.publish, cnt.received) - std::min(cnt.publish, cnt.received);
 
-    std::string driftString = getDriftString(drift);
-    std::string line = formatString("\rVersion: %s. \033[01m"
-                                    "\nClients\033[00m: %d on %d threads. "
-                                    "\033[01mSent\033[00m: %ld (\033[01;36m%ld/s\033[00m). "
+    std::string targetRateString;
+    if (targetRate > 0)
+        targetRateString = formatString(", target \033[01;36m%.0f/s\033[00m", targetRate);
+
+    // Only the native engine counts its socket writes.
+    std::string socketWritesString;
+    if (cnt.socketWrites > 0)
+    {
+        const double writesPerMessage = diff.publish > 0 ? static_cast<double>(diff.socketWrites) / static_cast<double>(diff.publish) : 0.0;
+        socketWritesString = formatString("\033[01mSocket writes per sent msg\033[00m: \033[01;36m%.2f\033[00m. ", writesPerMessage);
+    }
+
+    std::string sequenceString;
+    if (sequenceTracking)
+    {
+        sequenceString = formatString("\033[01mLost\033[00m: %ld (\033[01;36m%ld/s\033[00m). \033[01mDuplicate\033[00m: %ld. \033[01mReordered\033[00m: %ld. ",
+                                      cnt.lost, diff.lost, cnt.duplicate, cnt.reordered);
+    }
+
+    const std::string bindAddressString = getBindAddressString();
+    showAcks = showAcks || histograms.puback.getTotalCount() > 0 || histograms.pubcomp.getTotalCount() > 0 || cnt.ackTimeout > 0;
+    const std::string connectPhasesString = getConnectPhasesString(intervalHistograms, cnt);
+    const std::string ackString = getAckString(intervalHistograms, cnt);
+    std::string driftString = getDriftString(threadLoads);
+    std::string line = formatString("\rVersion: %s. All clients constructed in \033[01;36m%.2f s\033[00m. \033[01m"
+                                    "\nClients\033[00m: %d on %d threads%s. "
+                                    "\033[01mSent\033[00m: %ld (\033[01;36m%ld/s\033[00m%s). "
                                     "\033[01mRecv\033[00m: %ld (\033[01;36m%ld/s\033[00m). "
-                                    "\033[01mRecv-Sent\033[00m: %ld. "
+                                    "\033[01mRecv-Sent\033[00m: %ld. %s"
                                     "\033[01mConnects\033[00m: %ld (\033[01;36m%ld/s\033[00m). "
                                     "\033[01mDisconnects\033[00m: %ld (\033[01;36m%ld/s\033[00m). "
-                                    "\033[01mErrors\033[00m: %ld (\033[01;36m%ld/s\033[00m). "
-                                    "\n\033[01mMessage latency\033[00m (min/avg/max): \033[01;36m%.1f ms\033[00m / \033[01;36m%.1f ms\033[00m / \033[01;36m%.1f ms\033[00m. "
-                                    "\n\033[01mThread loop drift\033[00m: %s",
-                                    applicationVersion().toStdString().c_str(),
-                                    totalClients, threads.size(), cnt.publish, diff.publish, cnt.received, diff.received, diffCount,
+                                    "\033[01mErrors\033[00m: %ld (\033[01;36m%ld/s\033[00m). %s"
+                                    "\n\033[01mMessage latency\033[00m (min/avg/p50/p90/p99/p99.9/max): "
+                                    "\033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m / "
+                                    "\033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m / \033[01;36m%.1f\033[00m ms. "
+                                    "%s%s%s%s%s%s%s"
+                                    "\n\033[01mThread loop lag\033[00m (worst thread): %s",
+                                    applicationVersion().toStdString().c_str(), allConstructedAfter.count() / 1000.0,
+                                    totalClients, threads.size(), bindAddressString.c_str(), cnt.publish, diff.publish, targetRateString.c_str(), cnt.received, diff.received, diffCount, sequenceString.c_str(),
                                     cnt.connect, diff.connect,
-                                    cnt.disconnect, diff.disconnect, cnt.error, diff.error,
-                                    latency_summary.min / 1000.0, latency_summary.avg / 1000.0, latency_summary.max / 1000.0,
-                                    driftString.c_str());
+                                    cnt.disconnect, diff.disconnect, cnt.error, diff.error, socketWritesString.c_str(),
+                                    latency_summary.min.count() / 1000.0, latency_summary.avg.count() / 1000.0, latency_summary.p50.count() / 1000.0,
+                                    latency_summary.p90.count() / 1000.0, latency_summary.p99.count() / 1000.0, latency_summary.p999.count() / 1000.0,
+                                    latency_summary.max.count() / 1000.0,
+                                    ackString.c_str(), connectPhasesString.c_str(), connectStormSummary.c_str(), recoveryString.c_str(),
+                                    memoryString.c_str(), selfTestString.c_str(), poolBreakdownString.c_str(), driftString.c_str());
+
+    // Clear what we printed last time, in VT100 codes. The amount of lines varies, because of the connect storm summary.
+    for (int i = 1; i < linesPrinted; i++)
+    {
+        fputs("\033[2K\033[A", stdout);
+    }
+    if (linesPrinted > 0)
+        fputs("\033[2K", stdout);
 
-    if (firstTimePrinted)
-        fputs("\033[2K\033[A1\033[2K\033[A1\033[2K\033[A1\033[2K", stdout); // clear four lines in VT100 codes
-    firstTimePrinted = true;
+    linesPrinted = std::count(line.begin(), line.end(), '\n') + 1;
     fputs(line.c_str(), stdout);
     fflush(stdout);
 
     prevCounts = cnt;
+    prevHistograms = histograms;
     prevCountWhen = std::chrono::steady_clock::now();
 }
+
+/**
+ * @brief LoadSimulator::onQuitSignal is called in the event loop, after SIGINT or SIGTERM, so we can exit normally.
+ */
+void LoadSimulator::onQuitSignal()
+{
+    char buf[16];
+    while (read(quitSignalFds[0], buf, sizeof(buf)) > 0) {}
+
+    quit();
+}
+
+void LoadSimulator::handleQuitSignal(int signal)
+{
+    Q_UNUSED(signal)
+
+    // Only async-signal-safe things allowed here, so we just wake up the event loop.
+    const char c = 1;
+    const ssize_t written = write(quitSignalFds[1], &c, 1);
+    Q_UNUSED(written)
+}
+
+/**
+ * @brief LoadSimulator::printLatencyDistribution prints the message latency histogram of the whole run. Meant for at exit.
+ */
+void LoadSimulator::printLatencyDistribution() const
+{
+    Histogram latencies;
+
+    for(const std::unique_ptr<PoolStarter> &s : starters)
+    {
+        const ClientPool *c = s->getClientPool();
+
+        if (!c)
+            continue;
+
+        latencies += c->getStats().latency.getSnapshot();
+    }
+
+    if (latencies.getTotalCount() == 0)
+        return;
+
+    fputs("\n\nMessage latency distribution of the whole run:\n\n", stdout);
+    fputs(latencies.getPercentileDistribution(1000.0, "ms").c_str(), stdout);
+    fflush(stdout);
+}
@@ -25,17 +25,28 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <QTimer>
 #include <chrono>
 #include <QThread>
+#include <QSocketNotifier>
 #include <memory>
 
 #include "clientpool.h"
 #include "counters.h"
+#include "histogram.h"
+#include "metricsserver.h"
 #include "poolstarter.h"
+#include "selftestbroker.h"
+#include "statssnapshot.h"
+#include "statswriter.h"
 #include "threadloopdriftguage.h"
+#include "utils.h"
+#include "workerthread.h"
 
-struct Drift
+/**
+ * @brief The PoolTotals struct is what one ClientPool counted and recorded, kept to get its rates and latency per interval.
+ */
+struct PoolTotals
 {
-    double avg = 0;
-    int max = 0;
+    Counters counters;
+    Histogram latency;
 };
 
 /**
@@ -47,22 +58,75 @@ class LoadSimulator : public QCoreApplication
 
     QTimer statsTimer;
     Counters prevCounts;
-    bool firstTimePrinted = false;
+    StatsHistograms prevHistograms;
+    std::vector<PoolTotals> prevPoolTotals;
+    double targetRate = 0;
+    int remainderOffset = 0;
+    std::shared_ptr<BindAddressPool> bindAddresses;
+    int linesPrinted = 0;
+    bool showAcks = false;
+    bool sequenceTracking = false;
+    bool poolBreakdown = false;
+    std::string connectStormSummary;
+    int64_t connectStormEndedAt = 0;
+
+    bool recovering = false;
+    int64_t recoveryStartedAt = 0;
+    int64_t recoveryEndedAt = 0;
+    int recoveryClients = 0;
+    double lastRecoverySeconds = -1;
+    int lastRecoveryClients = 0;
     std::chrono::time_point<std::chrono::steady_clock> prevCountWhen = std::chrono::steady_clock::now();
+    const std::chrono::time_point<std::chrono::steady_clock> startedAt = std::chrono::steady_clock::now();
+    std::chrono::milliseconds allConstructedAfter = std::chrono::milliseconds(-1);
+    const size_t residentMemoryAtStart = getResidentMemory();
 
     std::vector<std::unique_ptr<PoolStarter>> starters;
     std::vector<std::unique_ptr<QThread>> threads;
 
     std::vector<std::unique_ptr<ThreadLoopDriftGuage>> threadDriftGuages;
+    std::vector<Histogram> prevThreadLags;
+    std::vector<std::chrono::nanoseconds> prevThreadBusyTimes;
+
+    std::unique_ptr<QThread> statsWriterThread;
+    std::unique_ptr<StatsWriter> statsWriter;
+    std::unique_ptr<MetricsServer> metricsServer;
+
+    std::unique_ptr<QThread> selfTestBrokerThread;
+    std::unique_ptr<SelfTestBroker> selfTestBroker;
+    std::unique_ptr<ThreadLoopDriftGuage> selfTestBrokerGuage;
+    uint64_t prevSelfTestReceived = 0;
+    uint64_t prevSelfTestDelivered = 0;
+    std::chrono::nanoseconds prevSelfTestBusyTime = std::chrono::nanoseconds(0);
+
+    static int quitSignalFds[2];
+    std::unique_ptr<QSocketNotifier> quitSignalNotifier;
 
-    std::string getDriftString(Drift drift) const;
-    Drift getAvgDriftLoop() const;
+    std::string getDriftString(const std::vector<ThreadLoad> &loads) const;
+    std::string getBindAddressString() const;
+    std::string getConnectPhasesString(const StatsHistograms &interval, const Counters &cnt) const;
+    std::string getAckString(const StatsHistograms &interval, const Counters &cnt) const;
+    std::string updateRecovery(int disconnected, int64_t lastConnectedAt, int64_t firstRecentDisconnectAt);
+    std::string getConnectStormSummary(const StatsHistograms &histograms, int clients, std::chrono::nanoseconds duration) const;
+    std::string getMemoryString(int clients) const;
+    std::string getSelfTestString(std::chrono::nanoseconds interval);
+    std::string getPoolBreakdownString(const std::vector<PoolSnapshot> &pools, const std::vector<PoolTotals> &intervals,
+                                       std::chrono::milliseconds period) const;
+    std::vector<ThreadLoad> sampleThreadLoads(std::chrono::nanoseconds interval);
+    static void handleQuitSignal(int signal);
 private slots:
     void onStatsTimeout();
+    void onQuitSignal();
 public:
     explicit LoadSimulator(int &argc, char **argv);
     ~LoadSimulator();
+    void startThreads(int amount, const std::vector<int> &cpus);
+    void setStatsOutput(const QString &path);
+    void setMetricsPort(quint16 port);
+    void setPoolBreakdown(bool value);
+    quint16 startSelfTestBroker(quint16 port);
     void createPoolsBasedOnArgument(const PoolArguments &args);
+    void printLatencyDistribution() const;
 
 signals:
 
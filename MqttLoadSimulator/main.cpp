@@ -33,6 +33,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include "globals.h"
 #include "poolarguments.h"
 #include "clientnumberpool.h"
+#include "payloadtemplate.h"
+#include "scenario.h"
 
 int main(int argc, char *argv[])
 {
@@ -55,9 +57,15 @@ int main(int argc, char *argv[])
 
     QCommandLineOption hostnameListOption("hostname-list", "Comma-separated list of hostnames clients will pick round-robin. You need to give a server "
                                                            "multiple IPs and use this when testing more than 30k-ish connections, to work around the TCP "
-                                                           "ephemeral port limit.", "list");
+                                                           "ephemeral port limit, or use --bind-address-list.", "list");
     parser.addOption(hostnameListOption);
 
+    QCommandLineOption bindAddressListOption("bind-address-list", "Comma-separated list of local source addresses and IPv4 CIDR ranges that "
+                                                                  "clients bind to round-robin. Each source address has its own ephemeral "
+                                                                  "ports, so with enough of them, you don't need multiple server IPs. "
+                                                                  "Requires the native engine.", "list");
+    parser.addOption(bindAddressListOption);
+
     QCommandLineOption portOption("port", "Target port. Default: 1883|8883", "port", "1883");
     parser.addOption(portOption);
 
@@ -70,12 +78,23 @@ int main(int argc, char *argv[])
     QCommandLineOption clientPrivateKeyOption("client-private-key", "Private key belonging to the client certificate above.", "path");
     parser.addOption(clientPrivateKeyOption);
 
+    QCommandLineOption sslCiphersOption("ssl-ciphers", "Colon separated list of OpenSSL cipher names to offer. Default: Qt's default.", "ciphers");
+    parser.addOption(sslCiphersOption);
+
+    QCommandLineOption sslSessionResumptionOption("ssl-session-resumption", "Resume the SSL session on reconnect, instead of doing a full handshake.");
+    parser.addOption(sslSessionResumptionOption);
+
     QCommandLineOption amountActiveOption("amount-active", "Amount of active clients. Default: 1.", "amount", "1");
     parser.addOption(amountActiveOption);
 
     QCommandLineOption amountPassiveOption("amount-passive", "Amount of passive clients with one silent subscription. Default: 1.", "amount", "1");
     parser.addOption(amountPassiveOption);
 
+    QCommandLineOption scenarioOption("scenario", "JSON file with any number of client pools, each with its own amount, topic, QoS, "
+                                                  "bursts or rate and payload, instead of --amount-active and --amount-passive. What a "
+                                                  "pool doesn't set comes from the command line. Stats are also shown per pool. See the README.", "file");
+    parser.addOption(scenarioOption);
+
     QCommandLineOption usernameOption("username", "Username. DEFAULT: user. Any occurance of %1 will be replaced by a random string, also on each reconnect. "
                                                   "Useful for stress-testing the auth mechanism of a server.", "username", "user");
     parser.addOption(usernameOption);
@@ -96,24 +115,76 @@ int main(int argc, char *argv[])
     QCommandLineOption clientMessageCountPerBurstOption("msg-per-burst", "Publish x messages per <burst interval>, per client. Default: 25", "amount", "25");
     parser.addOption(clientMessageCountPerBurstOption);
 
-    QCommandLineOption overrideReconnectIntervalOption("reconnect-interval", "Time between reconnect on error. Default: dynamic.", "ms", "-1");
-    parser.addOption(overrideReconnectIntervalOption);
+    QCommandLineOption rateOption("rate", "Publish open-loop at a total of <rate> messages per second, spread over all active clients, instead of "
+                                          "using bursts. Latency is measured from the moment a message was scheduled to be sent, so stalls in the "
+                                          "tester or the server can't hide. Default: 0 (off)", "msg/s", "0");
+    parser.addOption(rateOption);
+
+    QCommandLineOption reconnectIntervalOption("reconnect-interval", "Time before reconnecting after an error. It doubles with every failed "
+                                                                     "attempt in a row, up to --reconnect-backoff-max. Default: 5000.", "ms", "5000");
+    parser.addOption(reconnectIntervalOption);
+
+    QCommandLineOption reconnectBackoffMaxOption("reconnect-backoff-max", "Maximum time before reconnecting. Default: 60000.", "ms", "60000");
+    parser.addOption(reconnectBackoffMaxOption);
+
+    QCommandLineOption reconnectJitterOption("reconnect-jitter", "Fraction of the reconnect delay that is random, from 0 (none) to 1 "
+                                                                 "(anywhere between 0 and the delay). Default: 1.", "fraction", "1");
+    parser.addOption(reconnectJitterOption);
+
+    QCommandLineOption reconnectRateOption("reconnect-rate", "Maximum total amount of reconnects per second. Clients that are due wait in line. "
+                                                             "Default: 0, no limit.", "amount", "0");
+    parser.addOption(reconnectRateOption);
 
     QCommandLineOption topic("topic", "Topic for passive clients to subscribe to and active clients to publish to. Any occurance of %1 is "
                                       "replaced by a number per client, modulo <topic-modulo>. Default: random per client", "topic");
     parser.addOption(topic);
 
     QCommandLineOption payload_format("payload-format", "Override the payload string. Placeholders are available. "
-                                                        "Possible placeholders: %%utc_time%% for an UTC time string, %%value%% for a random int. Also "
+                                                        "Possible placeholders: %%utc_time%% for an UTC time string, %%random_value%% (or "
+                                                        "%%value%%) for a random int, %%seq%% for the publish counter of the client, "
+                                                        "%%client_id%%, %%topic%%, and %%padding:<n>%% for <n> bytes of filler. Also "
                                                         "include %%latency%% to put in the data required for latency calculation.", "format");
     parser.addOption(payload_format);
 
-    QCommandLineOption payload_max_value("payload-max-value", "The maximum value of the %%value%% placeholder from the payload format. Default: 100", "value", "100");
+    QCommandLineOption payload_max_value("payload-max-value", "The maximum value of the %%random_value%% placeholder from the payload format. Default: 100", "value", "100");
     parser.addOption(payload_max_value);
 
+    QCommandLineOption binaryPayloadOption("binary-payload", "Publish a small binary header (sender, sequence number and latency stamp) as "
+                                                             "payload instead of text. Much cheaper to produce and parse, so use it when the "
+                                                             "tester has to sustain very high message rates. Also enables loss, duplicate and reordering detection. "
+                                                             "Overrides --payload-format.");
+    parser.addOption(binaryPayloadOption);
+
+    QCommandLineOption engineOption("engine", "MQTT implementation: 'qmqtt', or 'native' for our own epoll based one, which uses far less "
+                                              "CPU and memory per client, but doesn't do SSL. Default: qmqtt", "engine", "qmqtt");
+    parser.addOption(engineOption);
+
+    QCommandLineOption protocolVersionOption("protocol-version", "MQTT protocol version: 3.1, 3.1.1 or 5. Version 5 requires the native engine. "
+                                                                 "Default: 3.1.1", "version", "3.1.1");
+    parser.addOption(protocolVersionOption);
+
+    QCommandLineOption topicAliasesOption("topic-aliases", "MQTT 5: publish with topic aliases, as far as the server's topic alias maximum allows.");
+    parser.addOption(topicAliasesOption);
+
+    QCommandLineOption userPropertyOption("user-property", "MQTT 5: add user property to every publish. Can be given multiple times.", "key=value");
+    parser.addOption(userPropertyOption);
+
+    QCommandLineOption messageExpiryOption("message-expiry-interval", "MQTT 5: message expiry interval of publishes, in seconds. Default: none", "seconds", "0");
+    parser.addOption(messageExpiryOption);
+
+    QCommandLineOption sharedSubscriptionOption("shared-subscription-group", "Make the passive clients subscribe with '$share/<group>/', so the "
+                                                                             "server distributes messages over them. They "
+                                                                             "only see part of every sender's sequence, so they don't do "
+                                                                             "loss detection.", "group");
+    parser.addOption(sharedSubscriptionOption);
+
     QCommandLineOption qosOption("qos", "QoS of publish and subscribe. Default: 0", "qos", "0");
     parser.addOption(qosOption);
 
+    QCommandLineOption maxInflightOption("max-inflight", "With QoS > 0, the amount of unacknowledged publishes per client after which it stops "
+                                                         "publishing until acks come in. Default: 0, no limit.", "amount", "0");
+    parser.addOption(maxInflightOption);
+
     QCommandLineOption retainOption("retain", "Set retain flag on messages");
     parser.addOption(retainOption);
 
@@ -127,12 +198,34 @@ int main(int argc, char *argv[])
     QCommandLineOption topicModuloOption("topic-modulo", "When using --topic, the counter modulo for '%1'. Default: 1000", "modulo", "1000");
     parser.addOption(topicModuloOption);
 
-    QCommandLineOption incrementTopicPerBurst("increment-topic-per-burst", "Use the '%1' in --topic to increment per publish burst.");
+    QCommandLineOption incrementTopicPerBurst("increment-topic-per-burst", "Use the '%1' in --topic to increment per publish burst. "
+                                                                           "Subscribers then only see part of every sender's sequence, "
+                                                                           "so they don't do loss detection.");
     parser.addOption(incrementTopicPerBurst);
 
     QCommandLineOption deferPublishing("defer-publishing", "Defer publishing (within thread) until all clients are connected. Helps the 'recv - sent' stat.");
     parser.addOption(deferPublishing);
 
+    QCommandLineOption threadsOption("threads", "Amount of worker threads. Default: amount of CPUs, or the length of --cpu-list.", "amount");
+    parser.addOption(threadsOption);
+
+    QCommandLineOption cpuListOption("cpu-list", "Pin the worker threads to these CPUs, round-robin, like '0-3,8'. Use it to keep the tester "
+                                                 "off the cores of a server on the same machine.", "list");
+    parser.addOption(cpuListOption);
+
+    QCommandLineOption statsOutputOption("stats-output", "Also write the stats of every interval to this file: CSV when it ends in '.csv', "
+                                                         "JSON lines otherwise. Includes a per-pool and per-thread breakdown.", "file");
+    parser.addOption(statsOutputOption);
+
+    QCommandLineOption metricsPortOption("metrics-port", "Serve metrics in OpenMetrics (Prometheus) format on this port, at '/metrics'. "
+                                                         "Updated every stats interval.", "port");
+    parser.addOption(metricsPortOption);
+
+    QCommandLineOption selfTestOption("self-test", "Test against a minimal MQTT broker on loopback, started in a thread of its own, to measure "
+                                                   "the ceiling of the tester on this machine. It routes by exact topic and 'prefix/#', acks QoS "
+                                                   "1 and 2, and delivers with QoS 0. Uses '--port' when given, a free port otherwise.");
+    parser.addOption(selfTestOption);
+
     QCommandLineOption verboseOption("verbose", "Print debugging info. Warning: ugly.");
     parser.addOption(verboseOption);
 
@@ -165,14 +258,36 @@ int main(int argc, char *argv[])
         const int burstInterval = parseIntOption<int>(parser, clientBurstIntervaltOption);
         const uint burst_spread = parseIntOption<uint>(parser, clientBurstIntervalSpreadOption);
         const int burstSize = parseIntOption<int>(parser, clientMessageCountPerBurstOption);
-        const int overrideReconnectInterval = parseIntOption<int>(parser, overrideReconnectIntervalOption);
+        ReconnectPolicy reconnectPolicy;
+        reconnectPolicy.initialDelay = std::chrono::milliseconds(parseIntOption<uint>(parser, reconnectIntervalOption));
+        reconnectPolicy.maxDelay = std::chrono::milliseconds(parseIntOption<uint>(parser, reconnectBackoffMaxOption));
+        reconnectPolicy.maxDelay = std::max(reconnectPolicy.maxDelay, reconnectPolicy.initialDelay);
         const uint delay = parseIntOption<uint>(parser, clientStartupDelayOption);
         const uint modulo = parseIntOption<uint>(parser, topicModuloOption);
         const uint qos = parseIntOption<uint>(parser, qosOption);
+        const uint maxInflight = parseIntOption<uint>(parser, maxInflightOption);
+
+        bool rateParsed = false;
+        const double rate = parser.value(rateOption).toDouble(&rateParsed);
 
         if (burstInterval <= 0)
             throw ArgumentException("Burst interval must be > 0");
 
+        if (!rateParsed || rate < 0)
+            throw ArgumentException("Rate must be a number >= 0");
+
+        bool reconnectJitterParsed = false;
+        reconnectPolicy.jitter = parser.value(reconnectJitterOption).toDouble(&reconnectJitterParsed);
+
+        if (!reconnectJitterParsed || reconnectPolicy.jitter < 0 || reconnectPolicy.jitter > 1)
+            throw ArgumentException("Reconnect jitter must be a number from 0 to 1");
+
+        bool reconnectRateParsed = false;
+        const double reconnectRate = parser.value(reconnectRateOption).toDouble(&reconnectRateParsed);
+
+        if (!reconnectRateParsed || reconnectRate < 0)
+            throw ArgumentException("Reconnect rate must be a number >= 0");
+
         if (qos > 2)
             throw ArgumentException("QoS must be <= 2");
 
@@ -184,6 +299,68 @@ int main(int argc, char *argv[])
                 port = 8883;
         }
 
+        MqttEngine engine = MqttEngine::Qmqtt;
+        const QString engineName = parser.value(engineOption);
+        if (engineName == "native")
+            engine = MqttEngine::Native;
+        else if (engineName != "qmqtt")
+            throw ArgumentException("Engine must be 'qmqtt' or 'native'");
+
+        if (engine == MqttEngine::Native && ssl)
+            throw ArgumentException("The native engine doesn't support SSL");
+
+        const bool selfTest = parser.isSet(selfTestOption);
+
+        if (selfTest && ssl)
+            throw ArgumentException("The self-test broker doesn't support SSL");
+
+        if (selfTest && (parser.isSet(hostnameOption) || parser.isSet(hostnameListOption)))
+            throw ArgumentException("'--self-test' can't be combined with '--hostname' or '--hostname-list'");
+
+        const bool scenario = parser.isSet(scenarioOption);
+
+        if (scenario && (parser.isSet(amountActiveOption) || parser.isSet(amountPassiveOption)))
+            throw ArgumentException("With '--scenario', the amount of clients is set per pool in the scenario");
+
+        std::shared_ptr<BindAddressPool> bindAddresses;
+        if (parser.isSet(bindAddressListOption))
+        {
+            if (engine != MqttEngine::Native)
+                throw ArgumentException("Binding to source addresses requires '--engine native'");
+
+            bindAddresses.reset(new BindAddressPool(parser.value(bindAddressListOption)));
+        }
+
+        quint8 protocolVersion = MQTT_PROTOCOL_VERSION_3_1_1;
+        const QString protocolVersionName = parser.value(protocolVersionOption);
+        if (protocolVersionName == "3.1")
+            protocolVersion = MQTT_PROTOCOL_VERSION_3_1;
+        else if (protocolVersionName == "5")
+            protocolVersion = MQTT_PROTOCOL_VERSION_5;
+        else if (protocolVersionName != "3.1.1")
+            throw ArgumentException("Protocol version must be 3.1, 3.1.1 or 5");
+
+        if (protocolVersion == MQTT_PROTOCOL_VERSION_5 && engine != MqttEngine::Native)
+            throw ArgumentException("MQTT 5 requires '--engine native'");
+
+        const uint32_t messageExpiryInterval = parseIntOption<uint>(parser, messageExpiryOption);
+
+        std::vector<std::pair<QByteArray, QByteArray>> userProperties;
+        for (const QString &userProperty : parser.values(userPropertyOption))
+        {
+            const int sep = userProperty.indexOf('=');
+
+            if (sep <= 0)
+                throw ArgumentException("User properties must be given as key=value");
+
+            userProperties.emplace_back(userProperty.left(sep).toUtf8(), userProperty.mid(sep + 1).toUtf8());
+        }
+
+        const bool topicAliases = parser.isSet(topicAliasesOption);
+
+        if (protocolVersion != MQTT_PROTOCOL_VERSION_5 && (topicAliases || !userProperties.empty() || messageExpiryInterval > 0))
+            throw ArgumentException("Topic aliases, user properties and message expiry require '--protocol-version 5'");
+
         if (parser.isSet(clientCertificateOption) ^ parser.isSet(clientPrivateKeyOption))
         {
             const QStringList cnames = clientCertificateOption.names();
@@ -193,16 +370,16 @@ int main(int argc, char *argv[])
                                     arg(cnames.first(), knames.first()).toStdString());
         }
 
-        const QString clientCertPath = parser.value(clientCertificateOption);
-        const QString clientPrivateKeyPath = parser.value(clientPrivateKeyOption);
-
-        if (parser.isSet(clientCertificateOption) || parser.isSet(clientPrivateKeyOption))
+        // Made once and shared by all clients, so certificate and key aren't read and parsed per client.
+        std::shared_ptr<const QSslConfiguration> sslConfiguration;
+        if (ssl)
         {
-            QFile clientCertFile(clientCertPath);
-            QFile clientPrivateKeyFile(clientPrivateKeyPath);
-
-            if (!clientCertFile.open(QFile::ReadOnly) || !clientPrivateKeyFile.open(QFile::ReadOnly))
-                throw ArgumentException("Can't read client cert or private key");
+            sslConfiguration.reset(new QSslConfiguration(createSslConfiguration(parser.value(clientCertificateOption), parser.value(clientPrivateKeyOption),
+                                                                                parser.value(sslCiphersOption), parser.isSet(sslSessionResumptionOption))));
+        }
+        else if (parser.isSet(sslCiphersOption) || parser.isSet(sslSessionResumptionOption))
+        {
+            throw ArgumentException("Ciphers and session resumption require '--ssl'");
         }
 
         if (parser.isSet(verboseOption))
@@ -212,6 +389,28 @@ int main(int argc, char *argv[])
 
         ClientNumberPool::setModulo(modulo);
 
+        std::vector<int> cpus;
+        if (parser.isSet(cpuListOption))
+            cpus = parseCpuList(parser.value(cpuListOption));
+
+        int threadCount = cpus.empty() ? QThread::idealThreadCount() : static_cast<int>(cpus.size());
+        if (parser.isSet(threadsOption))
+            threadCount = parseIntOption<int>(parser, threadsOption);
+
+        if (threadCount <= 0)
+            throw ArgumentException("Amount of threads must be > 0");
+
+        a.startThreads(threadCount, cpus);
+
+        if (parser.isSet(statsOutputOption))
+            a.setStatsOutput(parser.value(statsOutputOption));
+
+        if (parser.isSet(metricsPortOption))
+            a.setMetricsPort(parseIntOption<quint16>(parser, metricsPortOption));
+
+        if (selfTest)
+            port = a.startSelfTestBroker(parser.isSet(portOption) ? port : 0);
+
 #ifdef Q_OS_LINUX
         rlim_t rlim = 1000000;
         if (Globals::verbose)
@@ -224,8 +423,9 @@ int main(int argc, char *argv[])
 #endif
 
         PoolArguments activePoolArgs;
-        activePoolArgs.hostname = parser.value(hostnameOption);
+        activePoolArgs.hostname = selfTest ? QString("127.0.0.1") : parser.value(hostnameOption);
         activePoolArgs.hostnameList = parser.value(hostnameListOption);
+        activePoolArgs.bindAddresses = bindAddresses;
         activePoolArgs.port = port;
         activePoolArgs.username = parser.value(usernameOption);
         activePoolArgs.password = parser.value(passwordOption);
@@ -233,36 +433,66 @@ int main(int argc, char *argv[])
         activePoolArgs.amount = amountActive;
         activePoolArgs.clientIdPart = "active";
         activePoolArgs.delay = delay;
-        activePoolArgs.ssl = ssl;
-        activePoolArgs.clientCertificatePath = clientCertPath;
-        activePoolArgs.clientPrivateKeyPath = clientPrivateKeyPath;
+        activePoolArgs.sslConfiguration = sslConfiguration;
         activePoolArgs.burst_interval = burstInterval;
         activePoolArgs.burst_spread = burst_spread;
         activePoolArgs.burst_size = burstSize;
-        activePoolArgs.overrideReconnectInterval = overrideReconnectInterval;
+        activePoolArgs.rate = rate;
+        activePoolArgs.reconnectPolicy = reconnectPolicy;
+
+        // The reconnect rate is a total, so all pools share one limiter.
+        if (reconnectRate > 0)
+            activePoolArgs.reconnectRateLimiter = std::make_shared<ReconnectRateLimiter>(reconnectRate);
         activePoolArgs.topic = parser.value(topic);
         activePoolArgs.qos = qos;
+        activePoolArgs.maxInflight = maxInflight;
         activePoolArgs.retain = parser.isSet(retainOption);
         activePoolArgs.incrementTopicPerBurst = parser.isSet(incrementTopicPerBurst);
         activePoolArgs.clientid = parser.value(clientidOption);
         activePoolArgs.cleanSession = !parser.isSet(disableCleanSessionOption);
         activePoolArgs.deferPublishing = parser.isSet(deferPublishing);
-        activePoolArgs.payload_max_value = parseIntOption<int>(parser, payload_max_value);
 
-        if (parser.isSet(payload_format))
+        const QString payloadFormat = parser.isSet(payload_format) ? parser.value(payload_format) : PayloadTemplate::defaultFormat();
+        const int payloadMaxValue = parseIntOption<int>(parser, payload_max_value);
+        activePoolArgs.payloadTemplate.reset(new PayloadTemplate(payloadFormat, payloadMaxValue));
+
+        activePoolArgs.binaryPayload = parser.isSet(binaryPayloadOption);
+        activePoolArgs.engine = engine;
+        activePoolArgs.protocolVersion = protocolVersion;
+        activePoolArgs.sharedSubscriptionGroup = parser.value(sharedSubscriptionOption);
+
+        if (protocolVersion == MQTT_PROTOCOL_VERSION_5)
+            activePoolArgs.mqtt5PublishOptions.reset(new Mqtt5PublishOptions(topicAliases, messageExpiryInterval, userProperties));
+
+        activePoolArgs.resolveHostnames();
+        PoolStarter::warmUpNetworkStack(activePoolArgs);
+
+        if (scenario)
         {
-            activePoolArgs.payloadFormat = parser.value(payload_format);
-        }
+            // The command line arguments are the defaults of the scenario's pools.
+            std::vector<PoolArguments> scenarioPools = loadScenario(parser.value(scenarioOption), activePoolArgs, payloadFormat, payloadMaxValue);
 
-        a.createPoolsBasedOnArgument(activePoolArgs);
+            for (const PoolArguments &pool : scenarioPools)
+            {
+                a.createPoolsBasedOnArgument(pool);
+            }
 
-        PoolArguments passivePoolArgs(activePoolArgs);
-        passivePoolArgs.pub_and_sub = false;
-        passivePoolArgs.amount = amountPassive;
-        passivePoolArgs.clientIdPart = "passive";
-        a.createPoolsBasedOnArgument(passivePoolArgs);
+            a.setPoolBreakdown(true);
+        }
+        else
+        {
+            a.createPoolsBasedOnArgument(activePoolArgs);
+
+            PoolArguments passivePoolArgs(activePoolArgs);
+            passivePoolArgs.pub_and_sub = false;
+            passivePoolArgs.amount = amountPassive;
+            passivePoolArgs.clientIdPart = "passive";
+            a.createPoolsBasedOnArgument(passivePoolArgs);
+        }
 
-        return a.exec();
+        const int result = a.exec();
+        a.printLatencyDistribution();
+        return result;
     }
     catch (std::exception &ex)
     {
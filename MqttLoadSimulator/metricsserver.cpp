@@ -0,0 +1,236 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "metricsserver.h"
+
+#include "utils.h"
+
+#define MAX_REQUEST_LINE 8192
+#define CONNECTION_TIMEOUT_MS 10000
+
+/**
+ * @brief Latency bucket bounds in microseconds, spread like Prometheus' default buckets.
+ */
+static const uint64_t latencyBucketBounds[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+                                               1000000, 2500000, 5000000, 10000000};
+
+MetricsServer::MetricsServer(quint16 port) : QObject(nullptr)
+{
+    if (!server.listen(QHostAddress(QHostAddress::Any), port))
+        throw ArgumentException(formatString("Can't listen on metrics port %d: %s", port, qPrintable(server.errorString())));
+
+    connect(&server, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+void MetricsServer::update(const StatsSnapshot &snapshot, const StatsHistograms &histograms)
+{
+    this->snapshot = snapshot;
+    this->histograms = histograms;
+    this->hasSnapshot = true;
+}
+
+void MetricsServer::onNewConnection()
+{
+    while (server.hasPendingConnections())
+    {
+        QTcpSocket *socket = server.nextPendingConnection();
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+
+        // Connections that don't send a request, or don't take the answer, would otherwise stay open forever. The timer dies with the socket.
+        QTimer::singleShot(CONNECTION_TIMEOUT_MS, socket, [socket]() { socket->abort(); });
+    }
+}
+
+/**
+ * @brief MetricsServer::onReadyRead only looks at the request line, and always answers with 'Connection: close', so there is no
+ * need to parse headers or deal with keep-alive.
+ */
+void MetricsServer::onReadyRead(QTcpSocket *socket)
+{
+    if (!socket->canReadLine())
+    {
+        if (socket->bytesAvailable() > MAX_REQUEST_LINE)
+            socket->abort();
+        return;
+    }
+
+    const QByteArray requestLine = socket->readLine(MAX_REQUEST_LINE);
+    socket->disconnect(this);
+
+    const QList<QByteArray> fields = requestLine.trimmed().split(' ');
+    const QByteArray method = fields.value(0);
+    const QByteArray path = fields.value(1);
+
+    std::string status = "200 OK";
+    std::string contentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+    std::string body;
+
+    if (method != "GET")
+    {
+        status = "405 Method Not Allowed";
+        contentType = "text/plain";
+        body = "Only GET is supported.\n";
+    }
+    else if (path != "/metrics" && !path.startsWith("/metrics?"))
+    {
+        status = "404 Not Found";
+        contentType = "text/plain";
+        body = "Metrics are at /metrics.\n";
+    }
+    else
+    {
+        body = getMetrics();
+    }
+
+    const std::string response = formatString("HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                                              status.c_str(), contentType.c_str(), body.size()) + body;
+    socket->write(response.data(), response.size());
+    socket->disconnectFromHost();
+}
+
+static std::string escapeLabel(const QString &value)
+{
+    std::string result;
+
+    for (const char c : value.toStdString())
+    {
+        if (c == '\\' || c == '"')
+            result += '\\';
+
+        if (c == '\n')
+        {
+            result += "\\n";
+            continue;
+        }
+
+        result += c;
+    }
+
+    return result;
+}
+
+/**
+ * @brief writeHistogram renders a histogram with values in microseconds as one in seconds.
+ */
+static void writeHistogram(std::string &r, const char *name, const char *help, const Histogram &h)
+{
+    r += formatString("# TYPE %s histogram\n# HELP %s %s\n", name, name, help);
+
+    for (const uint64_t bound : latencyBucketBounds)
+    {
+        r += formatString("%s_bucket{le=\"%g\"} %lu\n", name, bound / 1000000.0, h.getCountAtOrBelow(bound));
+    }
+
+    r += formatString("%s_bucket{le=\"+Inf\"} %lu\n", name, h.getTotalCount());
+    r += formatString("%s_sum %.6f\n", name, h.getSum() / 1000000.0);
+    r += formatString("%s_count %lu\n", name, h.getTotalCount());
+}
+
+/**
+ * @brief MetricsServer::getMetrics renders the last snapshot. Counters are per pool, labeled with pool name and thread, so dashboards
+ * can sum them any way they want.
+ */
+std::string MetricsServer::getMetrics() const
+{
+    std::string r;
+
+    struct CounterDef
+    {
+        const char *name;
+        const char *help;
+        uint64_t Counters::*field;
+    };
+
+    const CounterDef counterDefs[] = {
+        {"mqttloadsim_messages_sent", "Messages published.", &Counters::publish},
+        {"mqttloadsim_messages_received", "Messages received.", &Counters::received},
+        {"mqttloadsim_connects", "Successful connects.", &Counters::connect},
+        {"mqttloadsim_disconnects", "Disconnects of connected clients.", &Counters::disconnect},
+        {"mqttloadsim_errors", "Connection errors.", &Counters::error},
+        {"mqttloadsim_socket_writes", "Socket writes, native engine only.", &Counters::socketWrites},
+        {"mqttloadsim_ack_timeouts", "QoS 1 and 2 publishes that were never acknowledged.", &Counters::ackTimeout},
+        {"mqttloadsim_ack_duplicates", "Acks for publishes that weren't waiting for one.", &Counters::ackDuplicate},
+        {"mqttloadsim_messages_lost", "Received sequence gaps, binary payload only.", &Counters::lost},
+        {"mqttloadsim_messages_duplicate", "Messages received more than once, binary payload only.", &Counters::duplicate},
+        {"mqttloadsim_messages_reordered", "Messages received out of order, binary payload only.", &Counters::reordered},
+        {"mqttloadsim_subscribe_failures", "Subscriptions the server refused, native engine only.", &Counters::subscribeFailed}
+    };
+
+    if (hasSnapshot)
+    {
+        for (const CounterDef &def : counterDefs)
+        {
+            r += formatString("# TYPE %s counter\n# HELP %s %s\n", def.name, def.name, def.help);
+
+            for (const PoolSnapshot &p : snapshot.pools)
+            {
+                r += formatString("%s_total{pool=\"%s\",thread=\"%d\"} %lu\n", def.name, escapeLabel(p.name).c_str(), p.thread, p.counters.*def.field);
+            }
+        }
+
+        r += "# TYPE mqttloadsim_clients gauge\n# HELP mqttloadsim_clients Clients by connection state.\n";
+        for (const PoolSnapshot &p : snapshot.pools)
+        {
+            const int64_t connected = std::max<int64_t>(0, static_cast<int64_t>(p.counters.connect) - static_cast<int64_t>(p.counters.disconnect));
+            const int64_t notConnected = std::max<int64_t>(0, p.clients - connected);
+            const std::string name = escapeLabel(p.name);
+            r += formatString("mqttloadsim_clients{pool=\"%s\",thread=\"%d\",state=\"connected\"} %ld\n", name.c_str(), p.thread, connected);
+            r += formatString("mqttloadsim_clients{pool=\"%s\",thread=\"%d\",state=\"disconnected\"} %ld\n", name.c_str(), p.thread, notConnected);
+        }
+
+        if (snapshot.lastRecoverySeconds >= 0)
+        {
+            r += "# TYPE mqttloadsim_last_recovery_seconds gauge\n# HELP mqttloadsim_last_recovery_seconds How long it took for all clients "
+                 "to be connected again, the last time some were disconnected.\n";
+            r += formatString("mqttloadsim_last_recovery_seconds %.3f\n", snapshot.lastRecoverySeconds);
+        }
+
+        r += "# TYPE mqttloadsim_target_rate gauge\n# HELP mqttloadsim_target_rate Configured total publish rate per second, 0 for burst mode.\n";
+        r += formatString("mqttloadsim_target_rate %.3f\n", snapshot.targetRate);
+
+        r += "# TYPE mqttloadsim_thread_loop_lag_seconds gauge\n# HELP mqttloadsim_thread_loop_lag_seconds Event loop lag of the worker thread, "
+             "p99 and max over the last interval.\n";
+        for (size_t i = 0; i < snapshot.threadLoads.size(); i++)
+        {
+            const ThreadLoad &t = snapshot.threadLoads[i];
+            r += formatString("mqttloadsim_thread_loop_lag_seconds{thread=\"%zu\",quantile=\"0.99\"} %.4f\n", i, t.lagP99Ms / 1000.0);
+            r += formatString("mqttloadsim_thread_loop_lag_seconds{thread=\"%zu\",quantile=\"1\"} %.4f\n", i, t.lagMaxMs / 1000.0);
+        }
+
+        r += "# TYPE mqttloadsim_thread_busy_ratio gauge\n# HELP mqttloadsim_thread_busy_ratio Fraction of the last interval the worker "
+             "thread's event loop spent handling events instead of waiting.\n";
+        for (size_t i = 0; i < snapshot.threadLoads.size(); i++)
+        {
+            r += formatString("mqttloadsim_thread_busy_ratio{thread=\"%zu\"} %.3f\n", i, snapshot.threadLoads[i].busyRatio);
+        }
+    }
+
+    writeHistogram(r, "mqttloadsim_latency_seconds", "Message latency, from publish to receive.", histograms.latency);
+    writeHistogram(r, "mqttloadsim_tcp_connect_seconds", "TCP connect time, native engine only.", histograms.tcpConnect);
+    writeHistogram(r, "mqttloadsim_connack_seconds", "Time from CONNECT to CONNACK. With QMQTT, including TCP connect and TLS handshake.",
+                   histograms.connack);
+    writeHistogram(r, "mqttloadsim_suback_seconds", "Time from SUBSCRIBE to SUBACK.", histograms.suback);
+    writeHistogram(r, "mqttloadsim_puback_seconds", "Time from PUBLISH to PUBACK.", histograms.puback);
+    writeHistogram(r, "mqttloadsim_pubrec_seconds", "Time from PUBLISH to PUBREC, native engine only.", histograms.pubrec);
+    writeHistogram(r, "mqttloadsim_pubcomp_seconds", "Time from PUBLISH to PUBCOMP.", histograms.pubcomp);
+
+    r += "# EOF\n";
+    return r;
+}
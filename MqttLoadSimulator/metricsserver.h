@@ -0,0 +1,58 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <string>
+
+#include "histogram.h"
+#include "poolstats.h"
+#include "statssnapshot.h"
+
+/**
+ * @brief The MetricsServer class is a minimal HTTP listener that serves the tester's metrics in OpenMetrics (Prometheus) format.
+ *
+ * It lives in the main thread and serves whatever was last given to update(), which the stats timer does every interval. So a
+ * scrape never touches the worker threads, and is at most one interval old.
+ */
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+
+    QTcpServer server;
+    StatsSnapshot snapshot;
+    StatsHistograms histograms;
+    bool hasSnapshot = false;
+
+    std::string getMetrics() const;
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+
+public:
+    MetricsServer(quint16 port);
+
+    void update(const StatsSnapshot &snapshot, const StatsHistograms &histograms);
+};
+
+#endif // METRICSSERVER_H
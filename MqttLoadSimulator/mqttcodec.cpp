@@ -0,0 +1,622 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "mqttcodec.h"
+
+MqttProtocolError::MqttProtocolError(const std::string &s) : std::runtime_error(s)
+{
+
+}
+
+#define MQTT5_PROPERTY_MESSAGE_EXPIRY_INTERVAL 0x02
+#define MQTT5_PROPERTY_SERVER_KEEP_ALIVE 0x13
+#define MQTT5_PROPERTY_RECEIVE_MAXIMUM 0x21
+#define MQTT5_PROPERTY_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT5_PROPERTY_TOPIC_ALIAS 0x23
+#define MQTT5_PROPERTY_MAXIMUM_QOS 0x24
+#define MQTT5_PROPERTY_USER_PROPERTY 0x26
+
+Mqtt5PublishOptions::Mqtt5PublishOptions(bool topicAliases, uint32_t messageExpiryInterval,
+                                         const std::vector<std::pair<QByteArray, QByteArray>> &userProperties) :
+    topicAliases(topicAliases)
+{
+    ByteBuffer buf;
+
+    if (messageExpiryInterval > 0)
+    {
+        buf.appendUint8(MQTT5_PROPERTY_MESSAGE_EXPIRY_INTERVAL);
+        buf.appendUint16(messageExpiryInterval >> 16);
+        buf.appendUint16(messageExpiryInterval & 0xFFFF);
+    }
+
+    for (const std::pair<QByteArray, QByteArray> &p : userProperties)
+    {
+        MqttCodec::writeUserProperty(buf, p.first, p.second);
+    }
+
+    this->properties = QByteArray(buf.readPtr(), static_cast<int>(buf.readable()));
+}
+
+size_t MqttCodec::varIntSize(size_t value)
+{
+    size_t result = 1;
+
+    while (value >= 128)
+    {
+        value /= 128;
+        result++;
+    }
+
+    return result;
+}
+
+void MqttCodec::writeFixedHeader(ByteBuffer &out, uint8_t firstByte, size_t remainingLength)
+{
+    out.appendUint8(firstByte);
+    writeVarInt(out, remainingLength);
+}
+
+void MqttCodec::writeVarInt(ByteBuffer &out, size_t value)
+{
+    if (value > 268435455)
+        throw MqttProtocolError("Value too big for MQTT variable byte integer");
+
+    do
+    {
+        uint8_t b = value % 128;
+        value /= 128;
+
+        if (value > 0)
+            b |= 0x80;
+
+        out.appendUint8(b);
+    } while (value > 0);
+}
+
+void MqttCodec::writeString(ByteBuffer &out, const char *data, size_t length)
+{
+    if (length > 0xFFFF)
+        throw MqttProtocolError("String too long for MQTT");
+
+    out.appendUint16(static_cast<uint16_t>(length));
+    out.append(data, length);
+}
+
+void MqttCodec::writeUserProperty(ByteBuffer &out, const QByteArray &key, const QByteArray &value)
+{
+    out.appendUint8(MQTT5_PROPERTY_USER_PROPERTY);
+    writeString(out, key.constData(), key.size());
+    writeString(out, value.constData(), value.size());
+}
+
+void MqttCodec::writeConnect(ByteBuffer &out, const MqttConnectOptions &options)
+{
+    const bool v31 = options.protocolVersion == MQTT_PROTOCOL_VERSION_3_1;
+    const bool v5 = options.protocolVersion == MQTT_PROTOCOL_VERSION_5;
+
+    size_t remainingLength = (v31 ? 12 : 10) + (v5 ? 1 : 0) + 2 + options.clientId.size();
+
+    if (options.hasUsername)
+        remainingLength += 2 + options.username.size();
+
+    if (options.hasPassword)
+        remainingLength += 2 + options.password.size();
+
+    uint8_t flags = 0;
+
+    if (options.hasUsername)
+        flags |= 0x80;
+
+    if (options.hasPassword)
+        flags |= 0x40;
+
+    if (options.cleanSession)
+        flags |= 0x02;
+
+    writeFixedHeader(out, static_cast<uint8_t>(MqttPacketType::Connect) << 4, remainingLength);
+
+    if (v31)
+        writeString(out, "MQIsdp", 6);
+    else
+        writeString(out, "MQTT", 4);
+
+    out.appendUint8(options.protocolVersion);
+    out.appendUint8(flags);
+    out.appendUint16(options.keepAlive);
+
+    // We don't need any of the connect properties, and not giving a topic alias maximum means the server won't use aliases on us.
+    if (v5)
+        writeVarInt(out, 0);
+    writeString(out, options.clientId.constData(), options.clientId.size());
+
+    if (options.hasUsername)
+        writeString(out, options.username.constData(), options.username.size());
+
+    if (options.hasPassword)
+        writeString(out, options.password.constData(), options.password.size());
+}
+
+void MqttCodec::writeSubscribe(ByteBuffer &out, uint16_t packetId, const QByteArray &topicFilter, uint8_t qos, uint8_t protocolVersion)
+{
+    const bool v5 = protocolVersion == MQTT_PROTOCOL_VERSION_5;
+    const size_t remainingLength = 2 + (v5 ? 1 : 0) + 2 + topicFilter.size() + 1;
+    writeFixedHeader(out, (static_cast<uint8_t>(MqttPacketType::Subscribe) << 4) | 0x02, remainingLength);
+    out.appendUint16(packetId);
+
+    if (v5)
+        writeVarInt(out, 0);
+    writeString(out, topicFilter.constData(), topicFilter.size());
+    out.appendUint8(qos);
+}
+
+/**
+ * @brief MqttCodec::writePublish
+ * @param properties null for MQTT 3, and the pre-encoded properties for MQTT 5 (which may be empty).
+ * @param topicAlias MQTT 5 only; 0 for none. To use an alias that the server already knows, give an empty topic.
+ */
+void MqttCodec::writePublish(ByteBuffer &out, const char *topic, size_t topicLength, const char *payload, size_t payloadLength,
+                             uint8_t qos, bool retain, uint16_t packetId, const QByteArray *properties, uint16_t topicAlias)
+{
+    size_t propertiesLength = 0;
+
+    if (properties)
+        propertiesLength = properties->size() + (topicAlias > 0 ? 3 : 0);
+
+    const size_t propertiesSize = properties ? varIntSize(propertiesLength) + propertiesLength : 0;
+    const size_t remainingLength = 2 + topicLength + (qos > 0 ? 2 : 0) + propertiesSize + payloadLength;
+
+    // Making room for the whole packet at once, so the appends below don't check for space one by one.
+    out.writePtr(1 + varIntSize(remainingLength) + remainingLength);
+
+    uint8_t firstByte = static_cast<uint8_t>(MqttPacketType::Publish) << 4;
+    firstByte |= (qos & 0x03) << 1;
+
+    if (retain)
+        firstByte |= 0x01;
+
+    writeFixedHeader(out, firstByte, remainingLength);
+    writeString(out, topic, topicLength);
+
+    if (qos > 0)
+        out.appendUint16(packetId);
+
+    if (properties)
+    {
+        writeVarInt(out, propertiesLength);
+
+        if (topicAlias > 0)
+        {
+            out.appendUint8(MQTT5_PROPERTY_TOPIC_ALIAS);
+            out.appendUint16(topicAlias);
+        }
+
+        out.append(properties->constData(), properties->size());
+    }
+
+    out.append(payload, payloadLength);
+}
+
+/**
+ * @brief MqttCodec::writeAck writes PUBACK, PUBREC, PUBREL or PUBCOMP.
+ */
+void MqttCodec::writeAck(ByteBuffer &out, MqttPacketType type, uint16_t packetId)
+{
+    uint8_t firstByte = static_cast<uint8_t>(type) << 4;
+
+    if (type == MqttPacketType::Pubrel)
+        firstByte |= 0x02;
+
+    writeFixedHeader(out, firstByte, 2);
+    out.appendUint16(packetId);
+}
+
+/**
+ * @brief MqttCodec::writeEmpty writes packets without body, like PINGREQ, PINGRESP and DISCONNECT.
+ */
+void MqttCodec::writeEmpty(ByteBuffer &out, MqttPacketType type)
+{
+    writeFixedHeader(out, static_cast<uint8_t>(type) << 4, 0);
+}
+
+/**
+ * @brief MqttCodec::writeConnack never has a session present, and no MQTT 5 properties.
+ */
+void MqttCodec::writeConnack(ByteBuffer &out, uint8_t reasonCode, uint8_t protocolVersion)
+{
+    const bool v5 = protocolVersion == MQTT_PROTOCOL_VERSION_5;
+    writeFixedHeader(out, static_cast<uint8_t>(MqttPacketType::Connack) << 4, v5 ? 3 : 2);
+    out.appendUint8(0);
+    out.appendUint8(reasonCode);
+
+    if (v5)
+        writeVarInt(out, 0);
+}
+
+/**
+ * @brief MqttCodec::writeSuback grants every filter the QoS it asked for.
+ */
+void MqttCodec::writeSuback(ByteBuffer &out, uint16_t packetId, const std::vector<MqttTopicFilterView> &filters, uint8_t protocolVersion)
+{
+    const bool v5 = protocolVersion == MQTT_PROTOCOL_VERSION_5;
+    writeFixedHeader(out, static_cast<uint8_t>(MqttPacketType::Suback) << 4, 2 + (v5 ? 1 : 0) + filters.size());
+    out.appendUint16(packetId);
+
+    if (v5)
+        writeVarInt(out, 0);
+
+    for (const MqttTopicFilterView &f : filters)
+        out.appendUint8(f.qos);
+}
+
+/**
+ * @brief MqttCodec::readFixedHeader
+ * @return false when there isn't enough data yet to know the header.
+ */
+bool MqttCodec::readFixedHeader(const char *data, size_t length, MqttFixedHeader &header)
+{
+    if (length < 2)
+        return false;
+
+    size_t multiplier = 1;
+    size_t value = 0;
+
+    for (size_t i = 1; i < 5; i++)
+    {
+        if (i >= length)
+            return false;
+
+        const uint8_t b = static_cast<uint8_t>(data[i]);
+        value += (b & 0x7F) * multiplier;
+        multiplier *= 128;
+
+        if ((b & 0x80) == 0)
+        {
+            header.firstByte = static_cast<uint8_t>(data[0]);
+            header.headerLength = i + 1;
+            header.remainingLength = value;
+            return true;
+        }
+    }
+
+    throw MqttProtocolError("Malformed remaining length");
+}
+
+static uint16_t readUint16(const char *p)
+{
+    return (static_cast<uint8_t>(p[0]) << 8) | static_cast<uint8_t>(p[1]);
+}
+
+/**
+ * @brief MqttCodec::readVarInt
+ * @return the amount of bytes the integer took.
+ */
+size_t MqttCodec::readVarInt(const char *data, size_t length, size_t &value)
+{
+    size_t multiplier = 1;
+    value = 0;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        if (i >= length)
+            throw MqttProtocolError("Variable byte integer beyond packet");
+
+        const uint8_t b = static_cast<uint8_t>(data[i]);
+        value += (b & 0x7F) * multiplier;
+        multiplier *= 128;
+
+        if ((b & 0x80) == 0)
+            return i + 1;
+    }
+
+    throw MqttProtocolError("Malformed variable byte integer");
+}
+
+/**
+ * @brief MqttCodec::skipProperty gives the size of the value of an MQTT 5 property, so properties we don't care about can be stepped over.
+ */
+size_t MqttCodec::skipProperty(uint8_t id, const char *data, size_t length)
+{
+    size_t size = 0;
+
+    switch (id)
+    {
+    case 0x01: // Payload format indicator
+    case 0x17: // Request problem information
+    case 0x19: // Request response information
+    case 0x24: // Maximum QoS
+    case 0x25: // Retain available
+    case 0x28: // Wildcard subscription available
+    case 0x29: // Subscription identifier available
+    case 0x2A: // Shared subscription available
+        size = 1;
+        break;
+    case 0x13: // Server keep alive
+    case 0x21: // Receive maximum
+    case 0x22: // Topic alias maximum
+    case 0x23: // Topic alias
+        size = 2;
+        break;
+    case 0x02: // Message expiry interval
+    case 0x11: // Session expiry interval
+    case 0x18: // Will delay interval
+    case 0x27: // Maximum packet size
+        size = 4;
+        break;
+    case 0x0B: // Subscription identifier
+    {
+        size_t value = 0;
+        size = readVarInt(data, length, value);
+        break;
+    }
+    case 0x03: // Content type
+    case 0x08: // Response topic
+    case 0x09: // Correlation data
+    case 0x12: // Assigned client identifier
+    case 0x15: // Authentication method
+    case 0x16: // Authentication data
+    case 0x1A: // Response information
+    case 0x1C: // Server reference
+    case 0x1F: // Reason string
+        if (length < 2)
+            throw MqttProtocolError("Property beyond packet");
+        size = 2 + readUint16(data);
+        break;
+    case MQTT5_PROPERTY_USER_PROPERTY:
+    {
+        if (length < 2)
+            throw MqttProtocolError("Property beyond packet");
+        const size_t keySize = 2 + readUint16(data);
+        if (length < keySize + 2)
+            throw MqttProtocolError("Property beyond packet");
+        size = keySize + 2 + readUint16(data + keySize);
+        break;
+    }
+    default:
+        throw MqttProtocolError("Unknown MQTT 5 property");
+    }
+
+    if (size > length)
+        throw MqttProtocolError("Property beyond packet");
+
+    return size;
+}
+
+/**
+ * @brief MqttCodec::readConnack
+ * @param body the packet after the fixed header. It has to be complete.
+ */
+void MqttCodec::readConnack(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion, MqttConnackView &connack)
+{
+    const size_t length = header.remainingLength;
+
+    if (length < 2)
+        throw MqttProtocolError("CONNACK too short");
+
+    connack.sessionPresent = body[0] & 0x01;
+    connack.reasonCode = static_cast<uint8_t>(body[1]);
+
+    if (protocolVersion != MQTT_PROTOCOL_VERSION_5 || length == 2)
+        return;
+
+    size_t propertiesLength = 0;
+    size_t pos = 2;
+    pos += readVarInt(body + pos, length - pos, propertiesLength);
+
+    if (pos + propertiesLength > length)
+        throw MqttProtocolError("CONNACK properties beyond packet");
+
+    const size_t end = pos + propertiesLength;
+
+    while (pos < end)
+    {
+        const uint8_t id = static_cast<uint8_t>(body[pos++]);
+        const size_t size = skipProperty(id, body + pos, end - pos);
+
+        if (id == MQTT5_PROPERTY_TOPIC_ALIAS_MAXIMUM)
+            connack.topicAliasMaximum = readUint16(body + pos);
+
+        if (id == MQTT5_PROPERTY_SERVER_KEEP_ALIVE)
+        {
+            connack.serverKeepAlive = readUint16(body + pos);
+            connack.hasServerKeepAlive = true;
+        }
+
+        if (id == MQTT5_PROPERTY_RECEIVE_MAXIMUM)
+        {
+            connack.receiveMaximum = readUint16(body + pos);
+
+            if (connack.receiveMaximum == 0)
+                throw MqttProtocolError("Receive maximum of 0 in CONNACK");
+        }
+
+        if (id == MQTT5_PROPERTY_MAXIMUM_QOS)
+        {
+            connack.maximumQos = static_cast<uint8_t>(body[pos]);
+
+            if (connack.maximumQos > 1)
+                throw MqttProtocolError("Invalid maximum QoS in CONNACK");
+        }
+
+        pos += size;
+    }
+}
+
+/**
+ * @brief MqttCodec::readPublish
+ * @param body the packet after the fixed header. It has to be complete.
+ */
+void MqttCodec::readPublish(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion, MqttPublishView &publish)
+{
+    const size_t length = header.remainingLength;
+
+    if (length < 2)
+        throw MqttProtocolError("Publish too short");
+
+    publish.qos = (header.firstByte >> 1) & 0x03;
+    publish.retain = header.firstByte & 0x01;
+
+    if (publish.qos > 2)
+        throw MqttProtocolError("Invalid QoS in publish");
+
+    publish.topicLength = readUint16(body);
+    size_t pos = 2;
+
+    if (pos + publish.topicLength > length)
+        throw MqttProtocolError("Publish topic beyond packet");
+
+    publish.topic = body + pos;
+    pos += publish.topicLength;
+
+    publish.packetId = 0;
+    if (publish.qos > 0)
+    {
+        if (pos + 2 > length)
+            throw MqttProtocolError("Publish packet id beyond packet");
+
+        publish.packetId = readUint16(body + pos);
+        pos += 2;
+    }
+
+    if (protocolVersion == MQTT_PROTOCOL_VERSION_5)
+    {
+        size_t propertiesLength = 0;
+        pos += readVarInt(body + pos, length - pos, propertiesLength);
+
+        if (pos + propertiesLength > length)
+            throw MqttProtocolError("Publish properties beyond packet");
+
+        pos += propertiesLength;
+    }
+
+    publish.payload = body + pos;
+    publish.payloadLength = length - pos;
+}
+
+/**
+ * @brief MqttCodec::readPacketId reads the packet id that acks, SUBACK and such start with.
+ */
+uint16_t MqttCodec::readPacketId(const MqttFixedHeader &header, const char *body)
+{
+    if (header.remainingLength < 2)
+        throw MqttProtocolError("Packet too short for packet id");
+
+    return readUint16(body);
+}
+
+/**
+ * @brief MqttCodec::readSubackReasonCode gives the reason code of the first topic filter, which is the only one we subscribe with.
+ * Codes of 0x80 and up mean the subscription failed.
+ * @param body the packet after the fixed header. It has to be complete.
+ */
+uint8_t MqttCodec::readSubackReasonCode(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion)
+{
+    const size_t length = header.remainingLength;
+    size_t pos = 2;
+
+    if (length <= pos)
+        throw MqttProtocolError("SUBACK too short");
+
+    if (protocolVersion == MQTT_PROTOCOL_VERSION_5)
+    {
+        size_t propertiesLength = 0;
+        pos += readVarInt(body + pos, length - pos, propertiesLength);
+        pos += propertiesLength;
+    }
+
+    if (pos >= length)
+        throw MqttProtocolError("SUBACK without reason codes");
+
+    return static_cast<uint8_t>(body[pos]);
+}
+
+/**
+ * @brief MqttCodec::readConnect only reads the protocol version and keep-alive, because the self-test broker doesn't check the rest.
+ * @param body the packet after the fixed header. It has to be complete.
+ */
+void MqttCodec::readConnect(const MqttFixedHeader &header, const char *body, MqttConnectView &connect)
+{
+    const size_t length = header.remainingLength;
+
+    if (length < 2)
+        throw MqttProtocolError("CONNECT too short");
+
+    const size_t pos = 2 + readUint16(body);
+
+    // Version, flags and keep-alive.
+    if (pos + 4 > length)
+        throw MqttProtocolError("CONNECT too short");
+
+    connect.protocolVersion = static_cast<uint8_t>(body[pos]);
+    connect.keepAlive = readUint16(body + pos + 2);
+}
+
+/**
+ * @brief MqttCodec::readSubscribe
+ * @param body the packet after the fixed header. It has to be complete.
+ * @param filters gets the topic filters, which point into body.
+ * @return the packet id.
+ */
+uint16_t MqttCodec::readSubscribe(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion, std::vector<MqttTopicFilterView> &filters)
+{
+    const size_t length = header.remainingLength;
+
+    if (length < 2)
+        throw MqttProtocolError("SUBSCRIBE too short");
+
+    const uint16_t packetId = readUint16(body);
+    size_t pos = 2;
+
+    if (protocolVersion == MQTT_PROTOCOL_VERSION_5)
+    {
+        size_t propertiesLength = 0;
+        pos += readVarInt(body + pos, length - pos, propertiesLength);
+        pos += propertiesLength;
+    }
+
+    filters.clear();
+
+    while (pos < length)
+    {
+        if (pos + 2 > length)
+            throw MqttProtocolError("SUBSCRIBE filter beyond packet");
+
+        MqttTopicFilterView f;
+        f.filterLength = readUint16(body + pos);
+        pos += 2;
+
+        // The filter and its options byte.
+        if (pos + f.filterLength + 1 > length)
+            throw MqttProtocolError("SUBSCRIBE filter beyond packet");
+
+        f.filter = body + pos;
+        pos += f.filterLength;
+        f.qos = static_cast<uint8_t>(body[pos]) & 0x03;
+        pos++;
+
+        if (f.qos > 2)
+            throw MqttProtocolError("Invalid QoS in SUBSCRIBE");
+
+        filters.push_back(f);
+    }
+
+    if (filters.empty())
+        throw MqttProtocolError("SUBSCRIBE without filters");
+
+    return packetId;
+}
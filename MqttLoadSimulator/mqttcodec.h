@@ -0,0 +1,184 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef MQTTCODEC_H
+#define MQTTCODEC_H
+
+#include <QByteArray>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+#include "bytebuffer.h"
+
+enum class MqttPacketType : uint8_t
+{
+    Connect = 1,
+    Connack = 2,
+    Publish = 3,
+    Puback = 4,
+    Pubrec = 5,
+    Pubrel = 6,
+    Pubcomp = 7,
+    Subscribe = 8,
+    Suback = 9,
+    Unsubscribe = 10,
+    Unsuback = 11,
+    Pingreq = 12,
+    Pingresp = 13,
+    Disconnect = 14,
+    Auth = 15
+};
+
+#define MQTT_PROTOCOL_VERSION_3_1 3
+#define MQTT_PROTOCOL_VERSION_3_1_1 4
+#define MQTT_PROTOCOL_VERSION_5 5
+
+class MqttProtocolError : public std::runtime_error
+{
+public:
+    MqttProtocolError(const std::string &s);
+};
+
+struct MqttConnectOptions
+{
+    QByteArray clientId;
+    QByteArray username;
+    QByteArray password;
+    bool hasUsername = false;
+    bool hasPassword = false;
+    bool cleanSession = true;
+    uint16_t keepAlive = 60;
+    uint8_t protocolVersion = MQTT_PROTOCOL_VERSION_3_1_1;
+};
+
+/**
+ * @brief The Mqtt5PublishOptions struct is what the MQTT 5 clients of a pool add to every publish. The properties that are the same
+ * for every message are encoded once, here.
+ */
+struct Mqtt5PublishOptions
+{
+    bool topicAliases = false;
+    QByteArray properties;
+
+    Mqtt5PublishOptions(bool topicAliases, uint32_t messageExpiryInterval, const std::vector<std::pair<QByteArray, QByteArray>> &userProperties);
+};
+
+struct MqttConnackView
+{
+    bool sessionPresent = false;
+    uint8_t reasonCode = 0;
+    uint16_t topicAliasMaximum = 0;
+    uint16_t serverKeepAlive = 0;
+    bool hasServerKeepAlive = false;
+
+    /**
+     * @brief receiveMaximum is how many QoS 1 and 2 publishes the server accepts unacknowledged, and maximumQos the highest QoS it
+     * accepts publishes with. The defaults are for when the server doesn't say, like with MQTT 3.
+     */
+    uint16_t receiveMaximum = 65535;
+    uint8_t maximumQos = 2;
+};
+
+struct MqttFixedHeader
+{
+    uint8_t firstByte = 0;
+    size_t headerLength = 0;
+    size_t remainingLength = 0;
+
+    MqttPacketType type() const
+    {
+        return static_cast<MqttPacketType>(firstByte >> 4);
+    }
+
+    size_t packetLength() const
+    {
+        return headerLength + remainingLength;
+    }
+};
+
+/**
+ * @brief The MqttPublishView struct points into the buffer a PUBLISH was received in, so reading one doesn't copy anything.
+ */
+struct MqttPublishView
+{
+    const char *topic = nullptr;
+    size_t topicLength = 0;
+    uint8_t qos = 0;
+    bool retain = false;
+    uint16_t packetId = 0;
+    const char *payload = nullptr;
+    size_t payloadLength = 0;
+};
+
+/**
+ * @brief The MqttConnectView struct is the part of a received CONNECT that the self-test broker needs.
+ */
+struct MqttConnectView
+{
+    uint8_t protocolVersion = 0;
+    uint16_t keepAlive = 0;
+};
+
+struct MqttTopicFilterView
+{
+    const char *filter = nullptr;
+    size_t filterLength = 0;
+    uint8_t qos = 0;
+};
+
+/**
+ * @brief The MqttCodec class encodes MQTT 3.1, 3.1.1 and 5 packets directly into a ByteBuffer, and decodes them in place.
+ *
+ * Of MQTT 5, it only knows the properties we actually use. Others that the server sends are skipped.
+ *
+ * The server side is only what the self-test broker needs: reading CONNECT and SUBSCRIBE, and writing CONNACK and SUBACK.
+ */
+class MqttCodec
+{
+    static void writeFixedHeader(ByteBuffer &out, uint8_t firstByte, size_t remainingLength);
+    static void writeVarInt(ByteBuffer &out, size_t value);
+    static void writeString(ByteBuffer &out, const char *data, size_t length);
+    static size_t readVarInt(const char *data, size_t length, size_t &value);
+    static size_t skipProperty(uint8_t id, const char *data, size_t length);
+
+public:
+    static size_t varIntSize(size_t value);
+    static void writeUserProperty(ByteBuffer &out, const QByteArray &key, const QByteArray &value);
+
+    static void writeConnect(ByteBuffer &out, const MqttConnectOptions &options);
+    static void writeSubscribe(ByteBuffer &out, uint16_t packetId, const QByteArray &topicFilter, uint8_t qos, uint8_t protocolVersion);
+    static void writePublish(ByteBuffer &out, const char *topic, size_t topicLength, const char *payload, size_t payloadLength,
+                             uint8_t qos, bool retain, uint16_t packetId, const QByteArray *properties = nullptr, uint16_t topicAlias = 0);
+    static void writeAck(ByteBuffer &out, MqttPacketType type, uint16_t packetId);
+    static void writeEmpty(ByteBuffer &out, MqttPacketType type);
+    static void writeConnack(ByteBuffer &out, uint8_t reasonCode, uint8_t protocolVersion);
+    static void writeSuback(ByteBuffer &out, uint16_t packetId, const std::vector<MqttTopicFilterView> &filters, uint8_t protocolVersion);
+
+    static bool readFixedHeader(const char *data, size_t length, MqttFixedHeader &header);
+    static void readConnack(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion, MqttConnackView &connack);
+    static void readPublish(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion, MqttPublishView &publish);
+    static uint16_t readPacketId(const MqttFixedHeader &header, const char *body);
+    static uint8_t readSubackReasonCode(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion);
+    static void readConnect(const MqttFixedHeader &header, const char *body, MqttConnectView &connect);
+    static uint16_t readSubscribe(const MqttFixedHeader &header, const char *body, uint8_t protocolVersion, std::vector<MqttTopicFilterView> &filters);
+};
+
+#endif // MQTTCODEC_H
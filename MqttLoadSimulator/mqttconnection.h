@@ -0,0 +1,114 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef MQTTCONNECTION_H
+#define MQTTCONNECTION_H
+
+#include <QString>
+#include <QByteArray>
+#include <stddef.h>
+#include <stdint.h>
+
+struct Mqtt5PublishOptions;
+
+enum class PublishAck
+{
+    Puback,
+    Pubrec,
+    Pubcomp
+};
+
+/**
+ * @brief The MqttConnectionHandler class is what an MqttConnection reports to. Calls are made from the connection's thread, and may
+ * come from within a call to the connection.
+ */
+class MqttConnectionHandler
+{
+public:
+    virtual ~MqttConnectionHandler() = default;
+
+    /**
+     * @brief onTcpConnected is for engines that can see it; others only report onConnected.
+     */
+    virtual void onTcpConnected() = 0;
+    virtual void onConnected() = 0;
+    virtual void onSubscribed() = 0;
+    virtual void onDisconnected() = 0;
+    virtual void onError(int code, const QString &description) = 0;
+    virtual void onReceived(const char *payload, size_t length) = 0;
+
+    /**
+     * @brief onPublishAck is for acks of our QoS 1 and 2 publishes. Engines that don't see PUBREC only report PUBCOMP for QoS 2.
+     */
+    virtual void onPublishAck(quint16 packetId, PublishAck ack) = 0;
+};
+
+/**
+ * @brief The MqttConnection class abstracts the MQTT engine, so OneClient doesn't care whether it's QMQTT or our native one.
+ */
+class MqttConnection
+{
+protected:
+    MqttConnectionHandler *handler = nullptr;
+
+public:
+    MqttConnection(MqttConnectionHandler *handler) :
+        handler(handler)
+    {
+
+    }
+
+    virtual ~MqttConnection() = default;
+
+    virtual void setClientId(const QString &clientId) = 0;
+    virtual QString getClientId() const = 0;
+    virtual void setUsername(const QString &username) = 0;
+    virtual void setPassword(const QByteArray &password) = 0;
+    virtual void setCleanSession(bool cleanSession) = 0;
+    virtual void setKeepAlive(quint16 keepAlive) = 0;
+    virtual void setProtocolVersion(quint8 protocolVersion) = 0;
+    virtual void setMqtt5PublishOptions(const Mqtt5PublishOptions *options) = 0;
+
+    virtual void connectToHost() = 0;
+    virtual void disconnectFromHost() = 0;
+    virtual void subscribe(const QString &topic, quint8 qos) = 0;
+    virtual void publish(quint16 packetId, const QString &topic, const QByteArray &payload, quint8 qos, bool retain) = 0;
+
+    /**
+     * @brief beginBatch and endBatch bracket packets that should go out in as few socket writes as possible, like a publish burst.
+     */
+    virtual void beginBatch() = 0;
+    virtual void endBatch() = 0;
+
+    /**
+     * @brief getReceiveMaximum and getMaximumQos are the limits the server gave in its CONNACK, which only MQTT 5 has. The defaults
+     * mean no limit.
+     */
+    virtual uint16_t getReceiveMaximum() const
+    {
+        return 65535;
+    }
+
+    virtual uint8_t getMaximumQos() const
+    {
+        return 2;
+    }
+};
+
+#endif // MQTTCONNECTION_H
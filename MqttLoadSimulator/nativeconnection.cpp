@@ -0,0 +1,684 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "nativeconnection.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define NATIVE_READ_SIZE 16384
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+/**
+ * @brief NativeConnection::NativeConnection
+ * @param bindAddresses optional; when given, the connection always uses the same source address from it.
+ */
+NativeConnection::NativeConnection(MqttConnectionHandler *handler, EpollLoop &loop, AtomicCounters &counters, const QHostAddress &hostAddress, quint16 port,
+                                   BindAddressPool *bindAddresses) :
+    MqttConnection(handler),
+    loop(loop),
+    counters(counters),
+    bindAddresses(bindAddresses)
+{
+    if (bindAddresses)
+        this->bindAddressIndex = bindAddresses->pick();
+
+    memset(&this->address, 0, sizeof(this->address));
+
+    if (hostAddress.protocol() == QAbstractSocket::IPv6Protocol)
+    {
+        struct sockaddr_in6 *a = &this->address.v6;
+        a->sin6_family = AF_INET6;
+        a->sin6_port = htons(port);
+        const Q_IPV6ADDR ip6 = hostAddress.toIPv6Address();
+        memcpy(&a->sin6_addr, &ip6, sizeof(a->sin6_addr));
+        this->addressLength = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        struct sockaddr_in *a = &this->address.v4;
+        a->sin_family = AF_INET;
+        a->sin_port = htons(port);
+        a->sin_addr.s_addr = htonl(hostAddress.toIPv4Address());
+        this->addressLength = sizeof(struct sockaddr_in);
+    }
+}
+
+/**
+ * @brief NativeConnection::~NativeConnection doesn't cancel a pending keep-alive timer. That's fine as long as the EpollLoop is
+ * destroyed together with its connections, like ClientPool does.
+ */
+NativeConnection::~NativeConnection()
+{
+    closeSocket();
+}
+
+void NativeConnection::setClientId(const QString &clientId)
+{
+    connectOptions.clientId = clientId.toUtf8();
+}
+
+QString NativeConnection::getClientId() const
+{
+    return QString::fromUtf8(connectOptions.clientId);
+}
+
+void NativeConnection::setUsername(const QString &username)
+{
+    connectOptions.username = username.toUtf8();
+    connectOptions.hasUsername = !username.isEmpty();
+}
+
+void NativeConnection::setPassword(const QByteArray &password)
+{
+    connectOptions.password = password;
+    connectOptions.hasPassword = !password.isEmpty();
+}
+
+void NativeConnection::setCleanSession(bool cleanSession)
+{
+    connectOptions.cleanSession = cleanSession;
+}
+
+void NativeConnection::setKeepAlive(quint16 keepAlive)
+{
+    connectOptions.keepAlive = keepAlive;
+}
+
+void NativeConnection::setProtocolVersion(quint8 protocolVersion)
+{
+    connectOptions.protocolVersion = protocolVersion;
+}
+
+void NativeConnection::setMqtt5PublishOptions(const Mqtt5PublishOptions *options)
+{
+    this->mqtt5PublishOptions = options;
+}
+
+void NativeConnection::connectToHost()
+{
+    if (state != State::Disconnected)
+        return;
+
+    const struct sockaddr *a = reinterpret_cast<const struct sockaddr*>(&this->address);
+    this->fd = socket(a->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (this->fd < 0)
+    {
+        const int err = errno;
+        handler->onError(err, QString("Error creating socket: %1").arg(strerror(err)));
+        return;
+    }
+
+    int flag = 1;
+    setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
+
+    if (bindAddresses)
+    {
+        // Defers picking the port to connect(), which can then take the whole 4-tuple into account, instead of reserving a port per
+        // source address that can't be shared with other destinations.
+        setsockopt(this->fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &flag, sizeof(int));
+
+        socklen_t bindAddressLength = 0;
+        const struct sockaddr *bindAddress = bindAddresses->getAddress(bindAddressIndex, bindAddressLength);
+
+        if (bind(this->fd, bindAddress, bindAddressLength) != 0)
+        {
+            const int err = errno;
+            closeSocket();
+            handler->onError(err, QString("Error binding to source address: %1").arg(strerror(err)));
+            return;
+        }
+    }
+
+    this->keepAlive = connectOptions.keepAlive;
+
+    const auto now = std::chrono::steady_clock::now();
+    this->lastReceived = now;
+    this->lastSent = now;
+    scheduleKeepAlive(now);
+
+    if (::connect(this->fd, a, this->addressLength) == 0)
+    {
+        loop.add(this->fd, EPOLLIN, this);
+        onTcpConnected();
+        return;
+    }
+
+    if (errno != EINPROGRESS)
+    {
+        const int err = errno;
+        closeSocket();
+        handler->onError(err, err == ECONNREFUSED ? QString("Connection refused") : QString(strerror(err)));
+        return;
+    }
+
+    // Registered for EPOLLOUT only, until the connect completes; wantWrite says so, so onTcpConnected() switches it to EPOLLIN.
+    state = State::TcpConnecting;
+    loop.add(this->fd, EPOLLOUT, this);
+    this->wantWrite = true;
+}
+
+void NativeConnection::onTcpConnected()
+{
+    if (bindAddresses)
+    {
+        bindAddresses->connectionOpened(bindAddressIndex);
+        bindAddressCounted = true;
+    }
+
+    state = State::MqttConnecting;
+    setWantWrite(false);
+    handler->onTcpConnected();
+    MqttCodec::writeConnect(writeBuf, connectOptions);
+    flush();
+}
+
+void NativeConnection::disconnectFromHost()
+{
+    if (state == State::Disconnected)
+        return;
+
+    const bool wasConnected = state == State::Connected;
+
+    if (wasConnected)
+    {
+        MqttCodec::writeEmpty(writeBuf, MqttPacketType::Disconnect);
+        writeToSocket();
+    }
+
+    closeSocket();
+
+    if (wasConnected)
+        handler->onDisconnected();
+}
+
+void NativeConnection::subscribe(const QString &topic, quint8 qos)
+{
+    if (state != State::Connected)
+        return;
+
+    subscribePacketId++;
+    if (subscribePacketId == 0)
+        subscribePacketId++;
+
+    MqttCodec::writeSubscribe(writeBuf, subscribePacketId, topic.toUtf8(), qos, connectOptions.protocolVersion);
+    flush();
+}
+
+void NativeConnection::publish(quint16 packetId, const QString &topic, const QByteArray &payload, quint8 qos, bool retain)
+{
+    if (state != State::Connected)
+        return;
+
+    // A client mostly publishes to the same topic, so this saves a conversion and alias lookup per message.
+    if (topic != cachedTopic)
+        setPublishTopic(topic);
+
+    if (connectOptions.protocolVersion != MQTT_PROTOCOL_VERSION_5)
+    {
+        MqttCodec::writePublish(writeBuf, cachedTopicUtf8.constData(), cachedTopicUtf8.size(), payload.constData(), payload.size(),
+                                qos, retain, packetId);
+    }
+    else
+    {
+        static const QByteArray noProperties;
+        const QByteArray *properties = mqtt5PublishOptions ? &mqtt5PublishOptions->properties : &noProperties;
+
+        // Once the server knows the alias, the topic can be left out.
+        const size_t topicLength = cachedTopicAliasKnown ? 0 : cachedTopicUtf8.size();
+
+        MqttCodec::writePublish(writeBuf, cachedTopicUtf8.constData(), topicLength, payload.constData(), payload.size(),
+                                qos, retain, packetId, properties, cachedTopicAlias);
+
+        cachedTopicAliasKnown = cachedTopicAlias > 0;
+    }
+
+    flush();
+}
+
+/**
+ * @brief NativeConnection::setPublishTopic also picks the topic alias, when those are used. Aliases are given out until the server's
+ * maximum is reached, and topics after that are just sent in full.
+ */
+void NativeConnection::setPublishTopic(const QString &topic)
+{
+    cachedTopic = topic;
+    cachedTopicUtf8 = topic.toUtf8();
+    cachedTopicAlias = 0;
+    cachedTopicAliasKnown = false;
+
+    if (!mqtt5PublishOptions || !mqtt5PublishOptions->topicAliases || serverTopicAliasMaximum == 0)
+        return;
+
+    auto pos = topicAliases.find(topic);
+
+    if (pos != topicAliases.end())
+    {
+        cachedTopicAlias = pos.value();
+        cachedTopicAliasKnown = true;
+    }
+    else if (topicAliases.size() < serverTopicAliasMaximum)
+    {
+        cachedTopicAlias = static_cast<uint16_t>(topicAliases.size() + 1);
+        topicAliases.insert(topic, cachedTopicAlias);
+    }
+}
+
+void NativeConnection::onEpollEvents(uint32_t events)
+{
+    if (state == State::TcpConnecting)
+    {
+        int err = 0;
+        socklen_t len = sizeof(int);
+
+        if (getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+            err = errno;
+
+        if (err != 0)
+        {
+            closeSocket();
+            handler->onError(err, err == ECONNREFUSED ? QString("Connection refused") : QString(strerror(err)));
+            return;
+        }
+
+        if (events & EPOLLOUT)
+            onTcpConnected();
+
+        return;
+    }
+
+    if (events & EPOLLIN)
+        readFromSocket();
+
+    if (state == State::Disconnected)
+        return;
+
+    if (events & EPOLLOUT)
+        flush();
+
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN) && state != State::Disconnected)
+        fail(ECONNRESET, "Remote host closed");
+}
+
+/**
+ * @brief NativeConnection::readFromSocket batches what we send in response, like acks and the subscribe after CONNACK, so that
+ * it's written in one go after everything that was read is handled.
+ */
+void NativeConnection::readFromSocket()
+{
+    beginBatch();
+    readPackets();
+    endBatch();
+}
+
+/**
+ * @brief NativeConnection::readPackets reads into a buffer shared by the connections of the thread, and only keeps a packet that is
+ * incomplete in readBuf, so idle connections don't each hold on to a read buffer.
+ */
+void NativeConnection::readPackets()
+{
+    thread_local std::vector<char> scratch(NATIVE_READ_SIZE);
+
+    while (state != State::Disconnected)
+    {
+        const ssize_t n = recv(this->fd, scratch.data(), NATIVE_READ_SIZE, 0);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            const int err = errno;
+            fail(err, QString(strerror(err)));
+            return;
+        }
+
+        if (n == 0)
+        {
+            fail(ECONNRESET, "Remote host closed");
+            return;
+        }
+
+        this->lastReceived = std::chrono::steady_clock::now();
+
+        const bool continuing = !readBuf.empty();
+        if (continuing)
+            readBuf.append(scratch.data(), n);
+
+        const char *data = continuing ? readBuf.readPtr() : scratch.data();
+        const size_t length = continuing ? readBuf.readable() : static_cast<size_t>(n);
+        size_t pos = 0;
+
+        try
+        {
+            MqttFixedHeader header;
+            while (state != State::Disconnected && MqttCodec::readFixedHeader(data + pos, length - pos, header))
+            {
+                if (length - pos < header.packetLength())
+                    break;
+
+                handlePacket(header, data + pos + header.headerLength);
+                pos += header.packetLength();
+            }
+        }
+        catch (MqttProtocolError &ex)
+        {
+            fail(EPROTO, QString("Protocol error: %1").arg(ex.what()));
+            return;
+        }
+
+        // Closing released readBuf already.
+        if (state == State::Disconnected)
+            return;
+
+        if (continuing)
+        {
+            readBuf.consume(pos);
+
+            if (readBuf.empty())
+                readBuf.release();
+        }
+        else if (pos < length)
+        {
+            readBuf.append(data + pos, length - pos);
+        }
+
+        if (static_cast<size_t>(n) < NATIVE_READ_SIZE)
+            break;
+    }
+}
+
+void NativeConnection::handlePacket(const MqttFixedHeader &header, const char *body)
+{
+    switch (header.type())
+    {
+    case MqttPacketType::Connack:
+        handleConnack(header, body);
+        break;
+    case MqttPacketType::Publish:
+    {
+        MqttPublishView publish;
+        MqttCodec::readPublish(header, body, connectOptions.protocolVersion, publish);
+
+        if (publish.qos == 1)
+            MqttCodec::writeAck(writeBuf, MqttPacketType::Puback, publish.packetId);
+        else if (publish.qos == 2)
+            MqttCodec::writeAck(writeBuf, MqttPacketType::Pubrec, publish.packetId);
+
+        // Before flushing, because a failing flush releases the buffer the payload is in.
+        handler->onReceived(publish.payload, publish.payloadLength);
+
+        if (publish.qos > 0)
+            flush();
+        break;
+    }
+    case MqttPacketType::Pubrec:
+    {
+        const uint16_t packetId = MqttCodec::readPacketId(header, body);
+        MqttCodec::writeAck(writeBuf, MqttPacketType::Pubrel, packetId);
+        handler->onPublishAck(packetId, PublishAck::Pubrec);
+        flush();
+        break;
+    }
+    case MqttPacketType::Pubrel:
+        MqttCodec::writeAck(writeBuf, MqttPacketType::Pubcomp, MqttCodec::readPacketId(header, body));
+        flush();
+        break;
+    case MqttPacketType::Suback:
+    {
+        // A refused subscription doesn't end the connection, but nothing will be received on it.
+        const uint8_t reasonCode = MqttCodec::readSubackReasonCode(header, body, connectOptions.protocolVersion);
+
+        if (reasonCode >= 0x80)
+        {
+            AtomicCounters::increment(counters.subscribeFailed);
+            break;
+        }
+
+        handler->onSubscribed();
+        break;
+    }
+    case MqttPacketType::Puback:
+        handler->onPublishAck(MqttCodec::readPacketId(header, body), PublishAck::Puback);
+        break;
+    case MqttPacketType::Pubcomp:
+        handler->onPublishAck(MqttCodec::readPacketId(header, body), PublishAck::Pubcomp);
+        break;
+    case MqttPacketType::Unsuback:
+    case MqttPacketType::Pingresp:
+        break;
+    case MqttPacketType::Disconnect:
+    {
+        const uint8_t reasonCode = header.remainingLength > 0 ? static_cast<uint8_t>(body[0]) : 0;
+        fail(reasonCode, QString("Disconnected by server, reason code %1").arg(reasonCode));
+        break;
+    }
+    default:
+        throw MqttProtocolError("Unexpected packet type from server");
+    }
+}
+
+void NativeConnection::handleConnack(const MqttFixedHeader &header, const char *body)
+{
+    if (state != State::MqttConnecting)
+        throw MqttProtocolError("Unexpected CONNACK");
+
+    MqttConnackView connack;
+    MqttCodec::readConnack(header, body, connectOptions.protocolVersion, connack);
+
+    const uint8_t returnCode = connack.reasonCode;
+
+    if (returnCode != 0)
+    {
+        QString errStr = QString("MQTT connection refused, return code %1").arg(returnCode);
+        if (returnCode == 4 || returnCode == 0x86)
+            errStr = "MQTT bad user or password";
+        if (returnCode == 5 || returnCode == 0x87)
+            errStr = "MQTT not authorized";
+
+        closeSocket();
+        handler->onError(returnCode, errStr);
+        return;
+    }
+
+    this->serverTopicAliasMaximum = connack.topicAliasMaximum;
+    this->serverReceiveMaximum = connack.receiveMaximum;
+    this->serverMaximumQos = connack.maximumQos;
+
+    if (connack.hasServerKeepAlive)
+        this->keepAlive = connack.serverKeepAlive;
+
+    state = State::Connected;
+    handler->onConnected();
+}
+
+uint16_t NativeConnection::getReceiveMaximum() const
+{
+    return serverReceiveMaximum;
+}
+
+uint8_t NativeConnection::getMaximumQos() const
+{
+    return serverMaximumQos;
+}
+
+void NativeConnection::beginBatch()
+{
+    batchDepth++;
+}
+
+void NativeConnection::endBatch()
+{
+    batchDepth = std::max(0, batchDepth - 1);
+    flush();
+}
+
+/**
+ * @brief NativeConnection::flush writes what is pending, unless we're in a batch, in which case endBatch() will.
+ */
+void NativeConnection::flush()
+{
+    if (batchDepth > 0)
+        return;
+
+    writeToSocket();
+}
+
+/**
+ * @brief NativeConnection::writeToSocket writes as much as the socket takes, and waits for EPOLLOUT for the rest.
+ *
+ * Because everything pending goes out in one send(), there is no need for TCP_CORK to merge small packets.
+ */
+void NativeConnection::writeToSocket()
+{
+    if (this->fd < 0 || state == State::TcpConnecting)
+        return;
+
+    while (!writeBuf.empty())
+    {
+        const ssize_t n = send(this->fd, writeBuf.readPtr(), writeBuf.readable(), MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            const int err = errno;
+            fail(err, QString(strerror(err)));
+            return;
+        }
+
+        // Only writes that sent something count, so a full socket doesn't inflate the writes per message.
+        AtomicCounters::increment(counters.socketWrites);
+        writeBuf.consume(n);
+        this->lastSent = std::chrono::steady_clock::now();
+    }
+
+    setWantWrite(!writeBuf.empty());
+}
+
+void NativeConnection::setWantWrite(bool val)
+{
+    if (this->wantWrite == val)
+        return;
+
+    this->wantWrite = val;
+    loop.modify(this->fd, val ? (EPOLLIN | EPOLLOUT) : EPOLLIN, this);
+}
+
+void NativeConnection::closeSocket()
+{
+    if (this->fd >= 0)
+    {
+        loop.remove(this->fd);
+        close(this->fd);
+        this->fd = -1;
+    }
+
+    if (bindAddressCounted)
+    {
+        bindAddresses->connectionClosed(bindAddressIndex);
+        bindAddressCounted = false;
+    }
+
+    state = State::Disconnected;
+    wantWrite = false;
+    readBuf.release();
+    writeBuf.release();
+
+    // Topic aliases only live as long as the network connection.
+    topicAliases.clear();
+    serverTopicAliasMaximum = 0;
+    serverReceiveMaximum = 65535;
+    serverMaximumQos = 2;
+    cachedTopic.clear();
+    cachedTopicAlias = 0;
+    cachedTopicAliasKnown = false;
+}
+
+/**
+ * @brief NativeConnection::fail closes the connection and reports it the way QMQTT does: disconnected (when we were), then the error.
+ */
+void NativeConnection::fail(int code, const QString &description)
+{
+    const bool wasConnected = state == State::Connected;
+    closeSocket();
+
+    if (wasConnected)
+        handler->onDisconnected();
+
+    handler->onError(code, description);
+}
+
+void NativeConnection::scheduleKeepAlive(std::chrono::time_point<std::chrono::steady_clock> now)
+{
+    if (keepAliveScheduled)
+        return;
+
+    const int64_t keepAliveMs = std::max<int64_t>(1000, this->keepAlive * 1000);
+    loop.scheduleTimer(this, now + std::chrono::milliseconds(keepAliveMs / 4));
+    keepAliveScheduled = true;
+}
+
+/**
+ * @brief NativeConnection::onEpollTimer sends PINGREQ when we've been quiet for 3/4 of the keep-alive, and gives up when the server
+ * has been quiet for one and a half. That also covers connecting that takes too long.
+ */
+void NativeConnection::onEpollTimer(std::chrono::time_point<std::chrono::steady_clock> now)
+{
+    keepAliveScheduled = false;
+
+    if (state == State::Disconnected || this->keepAlive == 0)
+        return;
+
+    const std::chrono::milliseconds keepAlive(this->keepAlive * 1000);
+
+    if (now - this->lastReceived > keepAlive * 3 / 2)
+    {
+        fail(ETIMEDOUT, "Socket timeout");
+        return;
+    }
+
+    if (state == State::Connected && now - this->lastSent >= keepAlive * 3 / 4)
+    {
+        MqttCodec::writeEmpty(writeBuf, MqttPacketType::Pingreq);
+        flush();
+    }
+
+    // Connections that were quiet since the last check, like passive clients, give their write buffer back until they need it again.
+    if (state == State::Connected && writeBuf.empty() && now - this->lastSent >= keepAlive / 4)
+        writeBuf.release();
+
+    if (state != State::Disconnected)
+        scheduleKeepAlive(now);
+}
@@ -0,0 +1,130 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef NATIVECONNECTION_H
+#define NATIVECONNECTION_H
+
+#include <QHostAddress>
+#include <QHash>
+#include <chrono>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "mqttconnection.h"
+#include "mqttcodec.h"
+#include "bytebuffer.h"
+#include "epollloop.h"
+#include "counters.h"
+#include "bindaddresspool.h"
+
+/**
+ * @brief The NativeConnection class is an MQTT 3.1, 3.1.1 and 5 client on a plain non-blocking socket, driven by an EpollLoop. It's meant to
+ * be as cheap as possible per client: no QObject, no QTcpSocket, no timer and no allocations per message.
+ *
+ * There is no TLS support.
+ */
+class NativeConnection : public MqttConnection, public EpollHandler
+{
+    enum class State
+    {
+        Disconnected,
+        TcpConnecting,
+        MqttConnecting,
+        Connected
+    };
+
+    EpollLoop &loop;
+    AtomicCounters &counters;
+    BindAddressPool *bindAddresses = nullptr;
+    size_t bindAddressIndex = 0;
+    bool bindAddressCounted = false;
+    union
+    {
+        struct sockaddr_in v4;
+        struct sockaddr_in6 v6;
+    } address;
+    socklen_t addressLength = 0;
+    int fd = -1;
+    State state = State::Disconnected;
+    bool wantWrite = false;
+    bool keepAliveScheduled = false;
+    int batchDepth = 0;
+
+    MqttConnectOptions connectOptions;
+    uint16_t keepAlive = 0;
+    const Mqtt5PublishOptions *mqtt5PublishOptions = nullptr;
+    ByteBuffer readBuf;
+    ByteBuffer writeBuf;
+    uint16_t subscribePacketId = 0;
+
+    QString cachedTopic;
+    QByteArray cachedTopicUtf8;
+    uint16_t cachedTopicAlias = 0;
+    bool cachedTopicAliasKnown = false;
+    uint16_t serverTopicAliasMaximum = 0;
+    uint16_t serverReceiveMaximum = 65535;
+    uint8_t serverMaximumQos = 2;
+    QHash<QString, uint16_t> topicAliases;
+
+    std::chrono::time_point<std::chrono::steady_clock> lastReceived;
+    std::chrono::time_point<std::chrono::steady_clock> lastSent;
+
+    void onTcpConnected();
+    void readFromSocket();
+    void readPackets();
+    void handlePacket(const MqttFixedHeader &header, const char *body);
+    void handleConnack(const MqttFixedHeader &header, const char *body);
+    void setPublishTopic(const QString &topic);
+    void flush();
+    void writeToSocket();
+    void setWantWrite(bool val);
+    void closeSocket();
+    void fail(int code, const QString &description);
+    void scheduleKeepAlive(std::chrono::time_point<std::chrono::steady_clock> now);
+
+public:
+    NativeConnection(MqttConnectionHandler *handler, EpollLoop &loop, AtomicCounters &counters, const QHostAddress &hostAddress, quint16 port,
+                     BindAddressPool *bindAddresses);
+    NativeConnection(const NativeConnection &other) = delete;
+    NativeConnection &operator=(const NativeConnection &other) = delete;
+    ~NativeConnection();
+
+    void setClientId(const QString &clientId) override;
+    QString getClientId() const override;
+    void setUsername(const QString &username) override;
+    void setPassword(const QByteArray &password) override;
+    void setCleanSession(bool cleanSession) override;
+    void setKeepAlive(quint16 keepAlive) override;
+    void setProtocolVersion(quint8 protocolVersion) override;
+    void setMqtt5PublishOptions(const Mqtt5PublishOptions *options) override;
+
+    void connectToHost() override;
+    void disconnectFromHost() override;
+    void subscribe(const QString &topic, quint8 qos) override;
+    void publish(quint16 packetId, const QString &topic, const QByteArray &payload, quint8 qos, bool retain) override;
+    void beginBatch() override;
+    void endBatch() override;
+    uint16_t getReceiveMaximum() const override;
+    uint8_t getMaximumQos() const override;
+
+    void onEpollEvents(uint32_t events) override;
+    void onEpollTimer(std::chrono::time_point<std::chrono::steady_clock> now) override;
+};
+
+#endif // NATIVECONNECTION_H
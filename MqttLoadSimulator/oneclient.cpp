@@ -21,72 +21,51 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include "utils.h"
 #include "iostream"
 #include <QSslConfiguration>
-#include <QFile>
-#include <QSslKey>
+#include <QHostInfo>
 #include <iostream>
+#include <string.h>
+#include <ctype.h>
 
 #include "globals.h"
 #include "clientnumberpool.h"
+#include "binarypayload.h"
+#include "qmqttconnection.h"
+#include "nativeconnection.h"
 
+#define ACK_TIMEOUT_SECONDS 30
 
-thread_local QHash<QString, QHostInfo> OneClient::dnsCache;
-
-OneClient::OneClient(const QString &hostname, quint16 port, const QString &username, const QString &password, bool pub_and_sub, int clientNr, const QString &clientIdPart,
-                     bool ssl, const QString &clientPoolRandomId, const int totalClients, const int delay, int burst_interval, const uint burst_spread,
-                     int burst_size, int overrideReconnectInterval, const QString &topic, uint qos, bool retain, bool incrementTopicPerBurst,
-                     const QString &clientid, bool cleanSession, const QString &clientCertPath, const QString &clientPrivateKeyPath, QObject *parent) :
-    QObject(parent),
-    client_id(!clientid.isEmpty() ? clientid : QString("%1_%2_%3_%4").arg(QHostInfo::localHostName()).arg(clientIdPart).arg(clientNr).arg(GetRandomString())),
-    clientNr(clientNr),
-    pub_and_sub(pub_and_sub),
-    clientPoolRandomId(clientPoolRandomId),
-    burstSize(burst_size),
-    topicBase(topic),
-    payloadBase(QString("Client %1 publish counter: %2. current_steady_time:%3").arg(client_id)),
-    qos(qos),
-    retain(retain),
-    incrementTopicPerBurst(incrementTopicPerBurst)
+
+std::atomic<uint32_t> OneClient::nextSenderId(1);
+
+/**
+ * @brief localHostName is looked up once, instead of for every client.
+ */
+static const QString &localHostName()
 {
-    if (ssl)
-    {
-        QSslConfiguration sslConfig = QSslConfiguration::defaultConfiguration();
-        sslConfig.setPeerVerifyMode(QSslSocket::VerifyNone);
+    static const QString name = QHostInfo::localHostName();
+    return name;
+}
 
-        if (!clientCertPath.isEmpty() || !clientPrivateKeyPath.isEmpty())
-        {
-            QFile fcert(clientCertPath);
-            if (!fcert.open(QFile::ReadOnly))
-                throw std::runtime_error("Error reading client certificate");
-            const QByteArray fcertData  = fcert.readAll();
-            QSslCertificate _cert(fcertData);
-
-            QFile fkey(clientPrivateKeyPath);
-            if (!fkey.open(QFile::ReadOnly))
-                throw std::runtime_error("Error reading private key");
-            const QByteArray keyData = fkey.readAll();
-            QSslKey _sslKey(keyData, QSsl::KeyAlgorithm::Rsa);
-
-            sslConfig.setLocalCertificate(_cert);
-            sslConfig.setPrivateKey(_sslKey);
-        }
+OneClient::OneClient(const ClientSettings &settings, int clientNr, const QString &hostname, const QList<QHostAddress> &addresses) :
+    settings(settings),
+    clientNr(clientNr)
+{
+    const QString clientId = !settings.clientid.isEmpty() ? settings.clientid
+                                                          : QString("%1_%2_%3_%4").arg(localHostName()).arg(settings.clientIdPart).arg(clientNr).arg(GetRandomString());
 
-        this->client = new QMQTT::Client(hostname, port, sslConfig, true);
+    if (settings.sslConfiguration)
+    {
+        const bool sessionResumption = !settings.sslConfiguration->testSslOption(QSsl::SslOptionDisableSessionPersistence);
+        this->connection.reset(new QmqttConnection(this, new QMQTT::Client(hostname, settings.port, *settings.sslConfiguration, true), sessionResumption));
     }
     else
     {
-        if (!dnsCache.contains(hostname))
-        {
-            dnsCache[hostname] = QHostInfo::fromName(hostname);
-        }
-
-        auto addresses = dnsCache[hostname].addresses();
-
         if (addresses.empty())
         {
             std::cerr << "Hostname '" << hostname.toStdString() << "' doesn't resolve to anything" << std::endl;
 
             // Just making a dummy client because I can't throw exceptions because we're calling this from slots.
-            this->client = new QMQTT::Client("dummy", 1883, false, true, nullptr);
+            this->connection.reset(new QmqttConnection(this, new QMQTT::Client("dummy", 1883, false, true, nullptr)));
 
             return;
         }
@@ -94,140 +73,146 @@ OneClient::OneClient(const QString &hostname, quint16 port, const QString &usern
         {
             const int ran = qrand() % addresses.length();
 
-            // Ehm, why the difference in QMTT::Client's overloaded constructors for SSL and non-SSL?
-            this->client = new QMQTT::Client(addresses.at(ran), port);
+            if (settings.nativeEngineLoop)
+            {
+                this->connection.reset(new NativeConnection(this, *settings.nativeEngineLoop, settings.stats->counters, addresses.at(ran), settings.port,
+                                                            settings.bindAddresses));
+            }
+            else
+            {
+                // Ehm, why the difference in QMTT::Client's overloaded constructors for SSL and non-SSL?
+                this->connection.reset(new QmqttConnection(this, new QMQTT::Client(addresses.at(ran), settings.port)));
+            }
         }
     }
 
-    if (!topic.isEmpty())
-    {
-        if (topic.contains("%1"))
-        {
-            int nr = ClientNumberPool::getClientNr();
-            subscribeTopic = QString(topic).arg(nr);
-
-            if (pub_and_sub)
-                publishTopic = subscribeTopic;
-        }
-        else
-        {
-            subscribeTopic = topic;
-            publishTopic = topic;
-        }
-    }
-    else
-    {
-        if (pub_and_sub)
-        {
-            publishTopic = QString("loadtester/clientpool_%1/%2/hellofromtheloadtester").arg(this->clientPoolRandomId).arg((this->clientNr + 1) % totalClients);
-            subscribeTopic = QString("loadtester/clientpool_%1/%2/#").arg(this->clientPoolRandomId).arg(this->clientNr);
-        }
-        else
-        {
-            QString ran = GetRandomString();
-            subscribeTopic = QString("silentpath/%1/#").arg(ran);
-        }
-    }
+    if (settings.topic.contains("%1"))
+        this->topicNr = ClientNumberPool::getClientNr();
 
-    QString u = username;
-    if (username.contains("%1"))
+    if (settings.pubAndSub)
     {
-        this->usernameBase = username;
-        regenRandomUsername = true;
-        u = QString(this->usernameBase).arg(GetRandomString());
+        this->clientId = clientId;
+        this->publishTopic = getPublishTopic();
+        this->senderId = nextSenderId.fetch_add(1, std::memory_order_relaxed);
+
+        if (settings.qos > 0)
+            inflight.reset(new InflightTable(settings.maxInflight));
+
+        // A spread of 0 means none, instead of a division by zero.
+        int spread = settings.burstSpread > 0 ? settings.burstSpread/2 - (qrand() % settings.burstSpread) : 0;
+        int interval = settings.burstInterval + spread;
+        this->publishIntervalMs = std::max<int>(1, interval);
+        this->nextPublish = std::chrono::steady_clock::now() + std::chrono::milliseconds(this->publishIntervalMs);
     }
 
-    QString p = password;
-    if (password.contains("%1"))
-    {
-        this->passwordBase = password;
-        regenRandomPassword = true;
-        p = QString(this->passwordBase).arg(GetRandomString());
-    }
+    const QString username = settings.randomUsername ? QString(settings.username).arg(GetRandomString()) : settings.username;
+    const QString password = settings.randomPassword ? QString(settings.password).arg(GetRandomString()) : settings.password;
 
-    client->setClientId(client_id);
-    client->setUsername(u);
-    client->setPassword(p.toUtf8());
-    client->setCleanSession(cleanSession);
+    connection->setClientId(clientId);
+    connection->setUsername(username);
+    connection->setPassword(password.toUtf8());
+    connection->setCleanSession(settings.cleanSession);
 
     int keepAlive = 60;
-    client->setKeepAlive(keepAlive);
-
-    connect(client, &QMQTT::Client::connected, this, &OneClient::connected);
-    connect(client, &QMQTT::Client::disconnected, this, &OneClient::onDisconnect);
-    connect(client, &QMQTT::Client::error, this, &OneClient::onClientError);
-    connect(client, &QMQTT::Client::received, this, &OneClient::onReceived);
-
-    int spread = burst_spread/2 - (qrand() % burst_spread);
-    int interval = burst_interval + spread;
-    interval = std::max<int>(1, interval);
+    connection->setKeepAlive(keepAlive);
 
-    this->publishInterval = std::chrono::milliseconds(interval);
-    this->nextPublish = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval);
-
-    const int totalConnectionDuration = ((totalClients + 1) / (1000.0 / (delay + 1))) * 1000;
-    const int reconnectInterval = overrideReconnectInterval >= 0 ? overrideReconnectInterval : 5000 + (qrand() % totalConnectionDuration);
-    reconnectTimer.setInterval(reconnectInterval);
-    reconnectTimer.setSingleShot(true);
-    connect(&reconnectTimer, &QTimer::timeout, this, &OneClient::connectToHost);
+    connection->setProtocolVersion(settings.protocolVersion);
+    connection->setMqtt5PublishOptions(settings.mqtt5PublishOptions);
 }
 
 OneClient::~OneClient()
 {
-    if (client)
+    if (connection)
     {
-        client->disconnectFromHost();
-        delete client;
-        client = nullptr;
+        connection->disconnectFromHost();
+        connection.reset();
     }
 }
 
-Counters OneClient::getCounters() const
-{
-    return counters;
-}
-
 void OneClient::publishIfIntervalExpired(std::chrono::time_point<std::chrono::steady_clock> now)
 {
-    if (!_connected)
+    if (this->nextPublish > now)
         return;
 
-    if (!startPublishing)
-        return;
+    // Also when not publishing, so that the publish schedule doesn't have to revisit us before the next interval.
+    this->nextPublish = now + std::chrono::milliseconds(this->publishIntervalMs);
 
-    if (this->nextPublish > now)
+    if (!_connected)
         return;
 
-    this->nextPublish = now + this->publishInterval;
+    if (!startPublishing)
+        return;
 
     onPublishTimerTimeout();
 
 }
 
-LatencyValues OneClient::getLatencies()
+std::chrono::time_point<std::chrono::steady_clock> OneClient::getNextPublish() const
 {
-    LatencyValues result(this->latencies);
-    return result;
+    return this->nextPublish;
 }
 
 bool OneClient::getPubAndSub() const
 {
-    return this->pub_and_sub;
+    return this->settings.pubAndSub;
 }
 
-void OneClient::setPayloadFormat(const QString &s, int max_value)
+/**
+ * @brief OneClient::getSubscribeTopic makes the topic when it's needed, instead of every client holding on to one.
+ */
+QString OneClient::getSubscribeTopic() const
 {
-    this->payloadBase = s;
-    this->payloadMaxValue = max_value;
+    QString topic;
+
+    if (settings.topic.contains("%1"))
+        topic = QString(settings.topic).arg(this->topicNr);
+    else if (!settings.topic.isEmpty())
+        topic = settings.topic;
+    else if (settings.pubAndSub)
+        topic = QString("loadtester/clientpool_%1/%2/#").arg(settings.clientPoolRandomId).arg(this->clientNr);
+    else
+        topic = QString("silentpath/%1/%2/#").arg(settings.clientPoolRandomId).arg(this->clientNr);
+
+    // Passive clients subscribe as member of a shared subscription, so the server load-balances the messages over them instead of
+    // giving each a copy.
+    if (isSharedSubscriber())
+        topic = QString("$share/%1/%2").arg(settings.sharedSubscriptionGroup, topic);
+
+    return topic;
+}
+
+QString OneClient::getPublishTopic() const
+{
+    if (settings.topic.contains("%1"))
+        return QString(settings.topic).arg(this->topicNr);
+
+    if (!settings.topic.isEmpty())
+        return settings.topic;
+
+    return QString("loadtester/clientpool_%1/%2/hellofromtheloadtester").arg(settings.clientPoolRandomId).arg((this->clientNr + 1) % settings.totalClients);
+}
+
+/**
+ * @brief OneClient::getClientId is for messages. Only publishers keep their client ID, for the payload.
+ */
+QString OneClient::getClientId() const
+{
+    if (!this->clientId.isEmpty())
+        return this->clientId;
+
+    return connection->getClientId();
 }
 
 void OneClient::connectToHost()
 {
+    reconnectScheduled = false;
+
     if (!_connected) // client->isConnectedToHost() checks the wrong thing (whether socket is connected), and is true when SSL is still being negotiated.
     {
         if (Globals::verbose)
             std::cout << "Connecting...\n";
-        client->connectToHost();
+        phaseStartedAt = std::chrono::steady_clock::now();
+        connection->connectToHost();
     }
 }
 
@@ -245,190 +230,349 @@ quint16 OneClient::getNextPacketPacketID()
     return this->packetid;
 }
 
-void OneClient::parseLatency(const QMQTT::Message &message)
+void OneClient::trackSequence(const BinaryPayloadHeader &header)
 {
-    const QByteArray payload = message.payload();
-    const int time_index = payload.indexOf("current_steady_time:");
+    if (!sequences)
+        sequences.reset(new SequenceTracker());
 
-    if (time_index < 0)
-        return;
+    SequenceCounts counts;
+    sequences->track(header.senderId, header.sequence, counts);
 
-    const QByteArray time_section = payload.mid(time_index, -1);
-    QString s = QString::fromUtf8(time_section);
-    QStringList fields = s.split(':');
+    if (counts.lost > 0)
+    {
+        AtomicCounters::increment(settings.stats->counters.lost, counts.lost);
 
-    if (fields.size() < 2)
-        return;
+        if (Globals::verbose)
+            std::cerr << qPrintable(QString("Client %1 lost %2 message(s) of sender %3\n").arg(getClientId()).arg(counts.lost).arg(header.senderId));
+    }
+
+    if (counts.duplicate > 0)
+        AtomicCounters::increment(settings.stats->counters.duplicate, counts.duplicate);
+
+    if (counts.reordered > 0)
+        AtomicCounters::increment(settings.stats->counters.reordered, counts.reordered);
+}
 
-    QString timestamp_numbers;
-    const QString string_tail = fields.at(1);
+bool OneClient::isSharedSubscriber() const
+{
+    return !settings.sharedSubscriptionGroup.isEmpty() && !settings.pubAndSub;
+}
+
+/**
+ * @brief OneClient::tracksSequences says whether we get all of every sender's messages, because only then are gaps loss. A member of a
+ * shared subscription gets part of them, and when senders move to a new topic every burst, we only get the bursts on our topic.
+ */
+bool OneClient::tracksSequences() const
+{
+    if (isSharedSubscriber())
+        return false;
+
+    return !(settings.incrementTopicPerBurst && settings.topic.contains("%1"));
+}
 
-    int end = 0;
-    for (QChar c : string_tail)
+/**
+ * @brief OneClient::parsePayload gets the latency from a received payload, and with a binary payload, also checks its sequence.
+ */
+void OneClient::parsePayload(const char *payload, size_t length)
+{
+    BinaryPayloadHeader header;
+    if (header.parse(payload, length))
     {
-        if (c.isDigit())
-            end++;
-        else
-            break;
+        const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        settings.stats->latency.record(std::max<int64_t>(0, now - header.steadyTimeMicros));
+
+        if (tracksSequences())
+            trackSequence(header);
+        return;
     }
 
-    timestamp_numbers = string_tail.left(end);
+    static const char marker[] = "current_steady_time:";
+    const size_t markerLength = sizeof(marker) - 1;
+    const char *found = static_cast<const char*>(memmem(payload, length, marker, markerLength));
 
-    bool ok = false;
-    long timestamp = timestamp_numbers.toLong(&ok);
+    if (!found)
+        return;
 
-    if (!ok)
+    const char *pos = found + markerLength;
+    const char *end = payload + length;
+
+    if (pos >= end || !isdigit(static_cast<unsigned char>(*pos)))
         return;
 
+    int64_t timestamp = 0;
+    while (pos < end && isdigit(static_cast<unsigned char>(*pos)))
+    {
+        timestamp = timestamp * 10 + (*pos - '0');
+        pos++;
+    }
+
     auto published_at = std::chrono::time_point<std::chrono::steady_clock>() + std::chrono::microseconds(timestamp);
     std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - published_at);
-    latencies[latency_index++ % latencies.size()] = latency;
+    settings.stats->latency.record(std::max<int64_t>(0, latency.count()));
 }
 
-void OneClient::connected()
+/**
+ * @brief OneClient::endPhase gives the duration of the connection phase that just ended, and starts the next one.
+ */
+std::chrono::microseconds OneClient::endPhase()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::microseconds result = std::chrono::duration_cast<std::chrono::microseconds>(now - phaseStartedAt);
+    phaseStartedAt = now;
+    return result;
+}
+
+void OneClient::onTcpConnected()
+{
+    settings.stats->tcpConnect.record(std::max<int64_t>(0, endPhase().count()));
+}
+
+void OneClient::onConnected()
 {
     _connected = true;
-    counters.connect++;
+    failedReconnects = 0;
+
+    // An MQTT 5 server can allow less than we're configured for. Going over that gets us disconnected.
+    qos = std::min<uint>(settings.qos, connection->getMaximumQos());
+    if (inflight)
+        inflight->setServerLimit(connection->getReceiveMaximum());
+
+    if (qos < settings.qos && Globals::verbose)
+        std::cerr << qPrintable(QString("Client %1: server allows QoS %2 at most, publishing with that\n").arg(getClientId()).arg(qos));
+    AtomicCounters::increment(settings.stats->counters.connect);
+    settings.stats->connack.record(std::max<int64_t>(0, endPhase().count()));
+    settings.stats->lastConnectedAt.store(std::chrono::duration_cast<std::chrono::nanoseconds>(phaseStartedAt.time_since_epoch()).count(),
+                                std::memory_order_relaxed);
 
     if (Globals::verbose)
         std::cout << "Connected.\n";
 
-    if (this->pub_and_sub)
+    const QString subscribeTopic = getSubscribeTopic();
+
+    if (settings.pubAndSub)
     {
         if (Globals::verbose)
         {
             std::cout << qPrintable(QString("Subscribing to '%1'\n").arg(subscribeTopic));
 
-            if (incrementTopicPerBurst && topicBase.contains("%1"))
+            if (settings.incrementTopicPerBurst && settings.topic.contains("%1"))
                 std::cout << qPrintable(QString("Publishing to '%1' (and increasing number per publish)\n").arg(publishTopic));
             else
                 std::cout << qPrintable(QString("Publishing to '%1'\n").arg(publishTopic));
         }
-        client->subscribe(subscribeTopic, this->qos);
+        connection->subscribe(subscribeTopic, settings.qos);
         startPublishing = true;
     }
     else
     {
         if (Globals::verbose)
             std::cout << qPrintable(QString("Subscribing to '%1'\n").arg(subscribeTopic));
-        client->subscribe(subscribeTopic);
+        connection->subscribe(subscribeTopic, 0);
     }
 }
 
-void OneClient::onDisconnect()
+void OneClient::onSubscribed()
+{
+    settings.stats->suback.record(std::max<int64_t>(0, endPhase().count()));
+}
+
+void OneClient::onDisconnected()
 {
     _connected = false;
-    counters.disconnect++;
+    AtomicCounters::increment(settings.stats->counters.disconnect);
+    settings.stats->lastDisconnectedAt.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(),
+                                   std::memory_order_relaxed);
+    clearInflight();
 
     if (Globals::verbose)
     {
-        QString msg = QString("Client %1 disconnected\n").arg(this->client_id);
+        QString msg = QString("Client %1 disconnected\n").arg(getClientId());
         std::cout << msg.toLatin1().toStdString().data();
     }
 }
 
-void OneClient::onClientError(const QMQTT::ClientError error)
+void OneClient::onError(int code, const QString &description)
 {
-    counters.error++;
-
-    // TODO: arg, doesn't qmqtt have a better way for this?
-    QString errStr = QString("unknown error");
-    if (error == QMQTT::SocketConnectionRefusedError)
-        errStr = "Connection refused";
-    if (error == QMQTT::SocketRemoteHostClosedError)
-        errStr = "Remote host closed";
-    if (error == QMQTT::SocketHostNotFoundError)
-        errStr = "Remote host not found";
-    if (error == QMQTT::MqttBadUserNameOrPasswordError)
-        errStr = "MQTT bad user or password";
-    if (error == QMQTT::MqttNotAuthorizedError)
-        errStr = "MQTT not authorized";
-    if (error == QMQTT::SocketResourceError)
-        errStr = "Socket resource error. Is your OS limiting you? Ulimit, etc?";
-    if (error == QMQTT::SocketSslInternalError)
-        errStr = "Socket SSL internal error.";
-    if (error == QMQTT::SocketTimeoutError)
-        errStr = "Socket timeout";
+    AtomicCounters::increment(settings.stats->counters.error);
+    clearInflight();
 
     if (Globals::verbose)
     {
-        QString msg = QString("Client %1 error code: %2 (%3). Initiated delayed reconnect.\n").arg(this->client_id).arg(error).arg(errStr);
+        QString msg = QString("Client %1 error code: %2 (%3). Initiated delayed reconnect.\n").arg(getClientId()).arg(code).arg(description);
         std::cerr << msg.toLatin1().toStdString().data();
     }
 
-    if (regenRandomUsername)
+    if (settings.randomUsername)
     {
-        const QString newUsername = QString(this->usernameBase).arg(GetRandomString());
-        client->setUsername(newUsername);
+        const QString newUsername = QString(settings.username).arg(GetRandomString());
+        connection->setUsername(newUsername);
     }
 
-    if (regenRandomPassword)
+    if (settings.randomPassword)
     {
-        const QString newPassword = QString(this->passwordBase).arg(GetRandomString());
-        client->setPassword(newPassword.toLatin1());
+        const QString newPassword = QString(settings.password).arg(GetRandomString());
+        connection->setPassword(newPassword.toLatin1());
     }
 
-    this->reconnectTimer.start();
+    if (!reconnectScheduled)
+    {
+        reconnectScheduled = true;
+        settings.reconnectScheduler->scheduleReconnect(this, failedReconnects);
 
+        if (failedReconnects < UINT8_MAX)
+            failedReconnects++;
+    }
 }
 
 void OneClient::onPublishTimerTimeout()
 {
     // https://github.com/emqx/qmqtt/issues/230
-    if (!_connected)
+    if (!canPublish())
         return;
 
-    if (this->publishTopic.isEmpty())
-        return;
+    connection->beginBatch();
 
-    for (int i = 0; i < burstSize; i++)
+    for (int i = 0; i < settings.burstSize; i++)
     {
-        const long stamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
-        QString payload;
+        // The rest of the burst is dropped, like with open-loop publishing, instead of sending it late.
+        if (inflight && inflight->isFull())
+            break;
 
-        if (payloadBase.contains("%1") || payloadBase.contains("%2"))
-        {
-            payload = payloadBase.arg(counters.publish).arg(stamp);
-        }
-        else
-        {
-            int value = rand() % this->payloadMaxValue;
-            payload = payloadBase;
-            payload.replace("%%utc_time%%", QString::fromStdString(utc_time()));
-            payload.replace("%%random_value%%", QString::number(value));
+        publish(std::chrono::steady_clock::now());
+    }
 
-            QString latency_stamp = QString("current_steady_time:%1").arg(stamp);
-            payload.replace("%%latency%%", latency_stamp);
-        }
+    connection->endBatch();
+
+    if (settings.incrementTopicPerBurst)
+    {
+        const int nr = ClientNumberPool::getClientNr();
+        publishTopic = QString(settings.topic).arg(nr);
+    }
+}
 
-        QMQTT::Message msg(getNextPacketPacketID(), publishTopic, payload.toUtf8(), this->qos, this->retain);
-        client->publish(msg);
-        counters.publish++;
+/**
+ * @brief OneClient::publish publishes one message.
+ * @param intendedAt the moment the message should have been sent, which goes into the latency stamp.
+ */
+void OneClient::publish(std::chrono::time_point<std::chrono::steady_clock> intendedAt)
+{
+    const long stamp = std::chrono::duration_cast<std::chrono::microseconds>(intendedAt.time_since_epoch()).count();
+
+    // Reused by all clients in the thread, so producing a payload doesn't allocate.
+    thread_local QByteArray payload;
+
+    if (settings.binaryPayload)
+    {
+        BinaryPayloadHeader header;
+        header.senderId = this->senderId;
+        header.sequence = publishCounter;
+        header.steadyTimeMicros = stamp;
+        payload.resize(sizeof(BinaryPayloadHeader));
+        memcpy(payload.data(), &header, sizeof(BinaryPayloadHeader));
+    }
+    else
+    {
+        PayloadContext context;
+        context.sequence = publishCounter;
+        context.steadyTimeMicros = stamp;
+        context.clientId = &this->clientId;
+        context.topic = &this->publishTopic;
+        settings.payloadTemplate->render(payload, context);
     }
 
-    if (incrementTopicPerBurst)
+    const quint16 packetId = getNextPacketPacketID();
+
+    if (inflight && qos > 0)
     {
-        const int nr = ClientNumberPool::getClientNr();
-        publishTopic = QString(topicBase).arg(nr);
+        const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        const int evicted = inflight->add(packetId, qos, now);
+
+        if (evicted > 0)
+            AtomicCounters::increment(settings.stats->counters.ackTimeout, evicted);
     }
+
+    connection->publish(packetId, publishTopic, payload, qos, settings.retain);
+    publishCounter++;
+    AtomicCounters::increment(settings.stats->counters.publish);
 }
 
-void OneClient::onReceived(const QMQTT::Message &message)
+/**
+ * @brief OneClient::publishScheduled is for open-loop publishing, in which the pool decides when a message is due, and this client
+ * is merely the one to send it. It counts as a burst of one message.
+ */
+void OneClient::publishScheduled(std::chrono::time_point<std::chrono::steady_clock> intendedAt)
 {
-    Q_UNUSED(message)
-    counters.received++;
+    if (!canPublish())
+        return;
 
-    parseLatency(message);
+    publish(intendedAt);
+
+    if (settings.incrementTopicPerBurst)
+    {
+        const int nr = ClientNumberPool::getClientNr();
+        publishTopic = QString(settings.topic).arg(nr);
+    }
 }
 
+/**
+ * @brief OneClient::canPublish also applies the in-flight window. That's also when unacknowledged publishes time out: right away
+ * when the window is full, and otherwise at most once a second.
+ */
+bool OneClient::canPublish()
+{
+    if (!(_connected && startPublishing && !this->publishTopic.isEmpty()))
+        return false;
 
+    if (inflight)
+    {
+        const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        const int expired = inflight->expireIfDue(now, ACK_TIMEOUT_SECONDS * 1000000LL);
 
+        if (expired > 0)
+            AtomicCounters::increment(settings.stats->counters.ackTimeout, expired);
+
+        return !inflight->isFull();
+    }
 
+    return true;
+}
 
+void OneClient::onPublishAck(quint16 packetId, PublishAck ack)
+{
+    if (!inflight)
+        return;
 
+    const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t latency = 0;
 
+    if (!inflight->ack(packetId, ack, now, latency))
+    {
+        AtomicCounters::increment(settings.stats->counters.ackDuplicate);
+        return;
+    }
 
+    if (ack == PublishAck::Puback)
+        settings.stats->puback.record(latency);
+    else if (ack == PublishAck::Pubrec)
+        settings.stats->pubrec.record(latency);
+    else
+        settings.stats->pubcomp.record(latency);
+}
 
+/**
+ * @brief OneClient::clearInflight is for when the connection is gone. We don't retransmit, so the acks will never come.
+ */
+void OneClient::clearInflight()
+{
+    if (!inflight)
+        return;
 
+    AtomicCounters::increment(settings.stats->counters.ackTimeout, inflight->clear());
+}
 
+void OneClient::onReceived(const char *payload, size_t length)
+{
+    AtomicCounters::increment(settings.stats->counters.received);
 
+    parsePayload(payload, length);
+}
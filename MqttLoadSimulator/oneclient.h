@@ -20,81 +20,89 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #ifndef DOSSER_H
 #define DOSSER_H
 
-#include <qmqtt.h>
-#include <QTimer>
-#include <QHostInfo>
-#include <QHash>
+#include <QHostAddress>
+#include <QList>
 #include <chrono>
-
-#include "counters.h"
-
-class OneClient : public QObject
+#include <atomic>
+#include <memory>
+
+#include "clientsettings.h"
+#include "mqttconnection.h"
+#include "inflighttable.h"
+#include "sequencetracker.h"
+
+struct BinaryPayloadHeader;
+
+/**
+ * @brief The OneClient class is one simulated client. Because there can be millions, it only holds what differs per client; the rest
+ * is in the pool's ClientSettings. Topics are made when needed, and the fields for publishing stay empty for passive clients.
+ *
+ * It can't be copied or moved, because the connection and the schedules point at the client. A pool keeps its clients in a
+ * std::deque, which constructs them in place and never moves them.
+ */
+class OneClient : public MqttConnectionHandler
 {
-    Q_OBJECT
+    const ClientSettings &settings;
 
-    QString client_id;
-    int clientNr = 0;
-    bool pub_and_sub = false;
+    std::unique_ptr<MqttConnection> connection;
+    std::unique_ptr<InflightTable> inflight;
+    std::unique_ptr<SequenceTracker> sequences;
 
-    QMQTT::Client *client = nullptr;
-    QTimer reconnectTimer;
-    QString clientPoolRandomId;
-
-    const int burstSize;
-    const QString topicBase;
+    QString clientId;
     QString publishTopic;
-    QString subscribeTopic;
-    QString payloadBase;
-    const uint qos;
-    const bool retain;
-    int payloadMaxValue = 100;
-
-    Counters counters;
-
-    thread_local static QHash<QString, QHostInfo> dnsCache;
-
-    bool _connected = false;
 
-    QString usernameBase;
-    QString passwordBase;
-    bool regenRandomUsername = false;
-    bool regenRandomPassword = false;
-    const bool incrementTopicPerBurst;
+    std::chrono::time_point<std::chrono::steady_clock> nextPublish;
+    std::chrono::time_point<std::chrono::steady_clock> phaseStartedAt;
+    uint64_t publishCounter = 0;
 
+    const int clientNr;
+    int topicNr = 0;
+    uint32_t senderId = 0;
+    int publishIntervalMs = 0;
     quint16 packetid = 0;
+    uint8_t failedReconnects = 0;
+    uint8_t qos = 0;
 
+    bool _connected = false;
+    bool reconnectScheduled = false;
     bool startPublishing = false;
-    std::chrono::milliseconds publishInterval;
-    std::chrono::time_point<std::chrono::steady_clock> nextPublish;
 
-    std::vector<std::chrono::microseconds> latencies = std::vector<std::chrono::microseconds>(100);
-    unsigned int latency_index = 0;
+    static std::atomic<uint32_t> nextSenderId;
 
 private:
     quint16 getNextPacketPacketID();
-    void parseLatency(const QMQTT::Message& message);
+    QString getSubscribeTopic() const;
+    QString getPublishTopic() const;
+    QString getClientId() const;
+    bool isSharedSubscriber() const;
+    bool tracksSequences() const;
+    void parsePayload(const char *payload, size_t length);
+    void trackSequence(const BinaryPayloadHeader &header);
+    void publish(std::chrono::time_point<std::chrono::steady_clock> intendedAt);
+    void onPublishTimerTimeout();
 
-private slots:
+    std::chrono::microseconds endPhase();
+
+    void onTcpConnected() override;
+    void onConnected() override;
+    void onSubscribed() override;
+    void onDisconnected() override;
+    void onError(int code, const QString &description) override;
+    void onReceived(const char *payload, size_t length) override;
+    void onPublishAck(quint16 packetId, PublishAck ack) override;
+    void clearInflight();
 
-    void connected();
-    void onDisconnect();
-    void onClientError(const QMQTT::ClientError error);
-    void onPublishTimerTimeout();
-    void onReceived(const QMQTT::Message& message);
 public:
-    OneClient(const QString &hostname, quint16 port, const QString &username, const QString &password, bool pub_and_sub, int clientNr, const QString &clientIdPart,
-              bool ssl, const QString &clientPoolRandomId, const int totalClients, const int delay, int burst_interval, const uint burst_spread,
-              int burst_size, int overrideReconnectInterval, const QString &topic, uint qos, bool retain, bool incrementTopicPerBurst,
-              const QString &clientid, bool cleanSession, const QString &clientCertPath, const QString &clientPrivateKeyPath, QObject *parent = nullptr);
+    OneClient(const ClientSettings &settings, int clientNr, const QString &hostname, const QList<QHostAddress> &addresses);
+    OneClient(const OneClient &other) = delete;
+    OneClient(OneClient &&other) = delete;
     ~OneClient();
 
-    Counters getCounters() const;
     void publishIfIntervalExpired(std::chrono::time_point<std::chrono::steady_clock> now);
-    LatencyValues getLatencies();
+    std::chrono::time_point<std::chrono::steady_clock> getNextPublish() const;
+    void publishScheduled(std::chrono::time_point<std::chrono::steady_clock> intendedAt);
+    bool canPublish();
     bool getPubAndSub() const;
-    void setPayloadFormat(const QString &s, int max_value);
-
-public slots:
     void connectToHost();
 };
 
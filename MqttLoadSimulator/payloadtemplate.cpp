@@ -0,0 +1,329 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "payloadtemplate.h"
+
+#include <random>
+#include <time.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define LATENCY_PREFIX "current_steady_time:"
+
+static void appendNumber(QByteArray &buffer, uint64_t value)
+{
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+
+    do
+    {
+        *--p = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    buffer.append(p, end - p);
+}
+
+static void appendNumber(QByteArray &buffer, int64_t value)
+{
+    if (value < 0)
+    {
+        buffer.append('-');
+        appendNumber(buffer, static_cast<uint64_t>(-(value + 1)) + 1);
+        return;
+    }
+
+    appendNumber(buffer, static_cast<uint64_t>(value));
+}
+
+/**
+ * @brief appendString appends as UTF-8, but without a temporary QByteArray for the common case of ASCII strings.
+ */
+static void appendString(QByteArray &buffer, const QString *s)
+{
+    if (!s)
+        return;
+
+    const int start = buffer.size();
+    buffer.resize(start + s->size());
+    char *d = buffer.data() + start;
+
+    for (const QChar c : *s)
+    {
+        if (c.unicode() >= 0x80)
+        {
+            buffer.resize(start);
+            buffer.append(s->toUtf8());
+            return;
+        }
+
+        *d++ = static_cast<char>(c.unicode());
+    }
+}
+
+/**
+ * @brief appendUtcTime appends an ISO 8601 UTC time with milliseconds. The part up to the seconds only changes once a second, so that is cached.
+ */
+static void appendUtcTime(QByteArray &buffer)
+{
+    thread_local int64_t cachedSecond = -1;
+    thread_local char cachedPrefix[32];
+    thread_local int cachedPrefixLength = 0;
+
+    const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t second = ms / 1000;
+
+    if (second != cachedSecond)
+    {
+        const time_t timer = static_cast<time_t>(second);
+        struct tm my_tm;
+        memset(&my_tm, 0, sizeof(struct tm));
+
+        if (!gmtime_r(&timer, &my_tm))
+        {
+            buffer.append("localtime-failed");
+            return;
+        }
+
+        cachedPrefixLength = strftime(cachedPrefix, sizeof(cachedPrefix), "%FT%T", &my_tm);
+        cachedSecond = second;
+    }
+
+    const int millis = ms % 1000;
+    const char tail[5] = {'.', static_cast<char>('0' + millis / 100), static_cast<char>('0' + (millis / 10) % 10), static_cast<char>('0' + millis % 10), 'Z'};
+
+    buffer.append(cachedPrefix, cachedPrefixLength);
+    buffer.append(tail, sizeof(tail));
+}
+
+static int getRandomValue(int maxValue)
+{
+    thread_local std::minstd_rand generator(std::random_device{}());
+
+    if (maxValue <= 0)
+        return 0;
+
+    return generator() % maxValue;
+}
+
+/**
+ * @brief PayloadTemplate::PayloadTemplate compiles a --payload-format.
+ * @param format can use %1 and %2 for the publish counter and latency stamp (the old style), or the %%placeholder%% style.
+ * @param maxRandomValue upper bound (exclusive) of %%random_value%%.
+ */
+PayloadTemplate::PayloadTemplate(const QString &format, int maxRandomValue) :
+    maxRandomValue(maxRandomValue)
+{
+    if (isPositional(format))
+        parsePositional(format);
+    else
+        parsePlaceholders(format);
+}
+
+/**
+ * @brief PayloadTemplate::isPositional says whether the format is the old style, in which %%placeholders%% aren't recognized.
+ */
+bool PayloadTemplate::isPositional(const QString &format)
+{
+    return format.contains("%1") || format.contains("%2");
+}
+
+QString PayloadTemplate::defaultFormat()
+{
+    return QString("Client %%client_id%% publish counter: %%seq%%. %%latency%%");
+}
+
+void PayloadTemplate::addLiteral(const QByteArray &literal)
+{
+    if (literal.isEmpty())
+        return;
+
+    // Merging adjacent literals saves an append per message.
+    if (!segments.empty() && segments.back().type == SegmentType::Literal)
+    {
+        segments.back().literal.append(literal);
+    }
+    else
+    {
+        Segment segment;
+        segment.literal = literal;
+        segments.push_back(segment);
+    }
+
+    sizeHint += literal.size();
+}
+
+void PayloadTemplate::addPlaceholder(SegmentType type)
+{
+    Segment segment;
+    segment.type = type;
+    segments.push_back(segment);
+
+    sizeHint += 64;
+}
+
+/**
+ * @brief PayloadTemplate::parsePositional does what QString::arg(counter).arg(stamp) used to do: the lowest numbered %N gets the
+ * publish counter, the next the latency stamp.
+ */
+void PayloadTemplate::parsePositional(const QString &format)
+{
+    const QByteArray f = format.toUtf8();
+
+    char firstDigit = 0;
+    char secondDigit = 0;
+    for (char d = '1'; d <= '9'; d++)
+    {
+        const char marker[3] = {'%', d, 0};
+
+        if (f.indexOf(marker) < 0)
+            continue;
+
+        if (firstDigit == 0)
+            firstDigit = d;
+        else if (secondDigit == 0)
+            secondDigit = d;
+    }
+
+    QByteArray literal;
+    for (int i = 0; i < f.size(); i++)
+    {
+        const char c = f.at(i);
+        const char next = i + 1 < f.size() ? f.at(i + 1) : 0;
+
+        if (c == '%' && next != 0 && (next == firstDigit || next == secondDigit))
+        {
+            addLiteral(literal);
+            literal.clear();
+            addPlaceholder(next == firstDigit ? SegmentType::Sequence : SegmentType::SteadyTime);
+            i++;
+            continue;
+        }
+
+        literal.append(c);
+    }
+
+    addLiteral(literal);
+}
+
+void PayloadTemplate::parsePlaceholders(const QString &format)
+{
+    const QByteArray f = format.toUtf8();
+
+    int pos = 0;
+    while (pos < f.size())
+    {
+        const int start = f.indexOf("%%", pos);
+        const int end = start >= 0 ? f.indexOf("%%", start + 2) : -1;
+
+        if (start < 0 || end < 0)
+        {
+            addLiteral(f.mid(pos));
+            break;
+        }
+
+        addLiteral(f.mid(pos, start - pos));
+
+        const QByteArray name = f.mid(start + 2, end - start - 2);
+        pos = end + 2;
+
+        if (name == "utc_time")
+            addPlaceholder(SegmentType::UtcTime);
+        else if (name == "random_value" || name == "value")
+            addPlaceholder(SegmentType::RandomValue);
+        else if (name == "latency")
+            addPlaceholder(SegmentType::Latency);
+        else if (name == "seq")
+            addPlaceholder(SegmentType::Sequence);
+        else if (name == "client_id")
+            addPlaceholder(SegmentType::ClientId);
+        else if (name == "topic")
+            addPlaceholder(SegmentType::Topic);
+        else if (name.startsWith("padding:"))
+        {
+            bool ok = false;
+            const int size = name.mid(8).toInt(&ok);
+
+            if (!ok || size < 0)
+                throw ArgumentException(formatString("Invalid padding size in placeholder '%%%%%s%%%%'", name.constData()));
+
+            // Random, but generated only once, because being unpredictable per message isn't worth the cost.
+            QByteArray padding;
+            padding.reserve(size);
+            while (padding.size() < size)
+            {
+                padding.append(GetRandomString().toLatin1());
+            }
+            padding.truncate(size);
+            addLiteral(padding);
+        }
+        else
+        {
+            // Not ours; leave it as-is, and continue looking from the closing %%, which may start a placeholder.
+            addLiteral(f.mid(start, end - start));
+            pos = end;
+        }
+    }
+}
+
+/**
+ * @brief PayloadTemplate::render replaces the contents of buffer with a payload. Reusing one buffer means it only allocates when it
+ * has to grow, or when a previous payload is still referenced elsewhere.
+ */
+void PayloadTemplate::render(QByteArray &buffer, const PayloadContext &context) const
+{
+    if (buffer.capacity() < sizeHint)
+        buffer.reserve(sizeHint);
+
+    buffer.resize(0);
+
+    for (const Segment &segment : segments)
+    {
+        switch (segment.type)
+        {
+        case SegmentType::Literal:
+            buffer.append(segment.literal);
+            break;
+        case SegmentType::UtcTime:
+            appendUtcTime(buffer);
+            break;
+        case SegmentType::RandomValue:
+            appendNumber(buffer, static_cast<int64_t>(getRandomValue(maxRandomValue)));
+            break;
+        case SegmentType::Latency:
+            buffer.append(LATENCY_PREFIX, sizeof(LATENCY_PREFIX) - 1);
+            appendNumber(buffer, context.steadyTimeMicros);
+            break;
+        case SegmentType::SteadyTime:
+            appendNumber(buffer, context.steadyTimeMicros);
+            break;
+        case SegmentType::Sequence:
+            appendNumber(buffer, context.sequence);
+            break;
+        case SegmentType::ClientId:
+            appendString(buffer, context.clientId);
+            break;
+        case SegmentType::Topic:
+            appendString(buffer, context.topic);
+            break;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef PAYLOADTEMPLATE_H
+#define PAYLOADTEMPLATE_H
+
+#include <QString>
+#include <QByteArray>
+#include <vector>
+#include <stdint.h>
+
+struct PayloadContext
+{
+    uint64_t sequence = 0;
+    int64_t steadyTimeMicros = 0;
+    const QString *clientId = nullptr;
+    const QString *topic = nullptr;
+};
+
+/**
+ * @brief The PayloadTemplate class is a --payload-format compiled into literal segments and placeholder slots, so that producing a
+ * payload is only appending to a buffer, without searching and replacing strings for every message.
+ *
+ * It's immutable after construction, so one instance can be shared by all clients and threads.
+ */
+class PayloadTemplate
+{
+    enum class SegmentType
+    {
+        Literal,
+        UtcTime,
+        RandomValue,
+        Latency,
+        SteadyTime,
+        Sequence,
+        ClientId,
+        Topic
+    };
+
+    struct Segment
+    {
+        SegmentType type = SegmentType::Literal;
+        QByteArray literal;
+    };
+
+    std::vector<Segment> segments;
+    int maxRandomValue = 100;
+    int sizeHint = 0;
+
+    void addLiteral(const QByteArray &literal);
+    void addPlaceholder(SegmentType type);
+    void parsePositional(const QString &format);
+    void parsePlaceholders(const QString &format);
+
+public:
+    PayloadTemplate(const QString &format, int maxRandomValue);
+    static QString defaultFormat();
+    static bool isPositional(const QString &format);
+
+    void render(QByteArray &buffer, const PayloadContext &context) const;
+};
+
+#endif // PAYLOADTEMPLATE_H
@@ -17,5 +17,42 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 02110-1301, USA.
 */
 
+#include "poolarguments.h"
 
+#include <QHostInfo>
 
+#include "utils.h"
+
+QStringList PoolArguments::getHostnames() const
+{
+    QStringList result = hostnameList.split(",", QString::SplitBehavior::SkipEmptyParts);
+
+    if (result.isEmpty() && !hostname.isEmpty())
+        result.append(hostname);
+
+    return result;
+}
+
+/**
+ * @brief PoolArguments::resolveHostnames looks up all hostnames once, before the pools are made, so clients don't have to. The result
+ * is shared read-only by all pools and their threads.
+ */
+void PoolArguments::resolveHostnames()
+{
+    std::shared_ptr<ResolvedHosts> result(new ResolvedHosts());
+
+    for (const QString &name : getHostnames())
+    {
+        if (result->contains(name))
+            continue;
+
+        const QList<QHostAddress> addresses = QHostInfo::fromName(name).addresses();
+
+        if (addresses.isEmpty())
+            throw ArgumentException(formatString("Hostname '%s' doesn't resolve to anything", qPrintable(name)));
+
+        result->insert(name, addresses);
+    }
+
+    this->resolvedHosts = result;
+}
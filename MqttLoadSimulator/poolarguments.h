@@ -21,11 +21,32 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #define POOLARGUMENTS_H
 
 #include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QList>
+#include <QHostAddress>
+#include <QSslConfiguration>
+#include <memory>
+
+#include "payloadtemplate.h"
+#include "mqttcodec.h"
+#include "bindaddresspool.h"
+#include "reconnectscheduler.h"
+
+enum class MqttEngine
+{
+    Qmqtt,
+    Native
+};
+
+typedef QHash<QString, QList<QHostAddress>> ResolvedHosts;
 
 struct PoolArguments
 {
     QString hostname;
     QString hostnameList;
+    std::shared_ptr<const ResolvedHosts> resolvedHosts;
+    std::shared_ptr<BindAddressPool> bindAddresses;
     quint16 port;
     QString username;
     QString password;
@@ -33,22 +54,30 @@ struct PoolArguments
     int amount = 0;
     QString clientIdPart;
     uint delay = 0;
-    bool ssl = false;
-    QString clientCertificatePath;
-    QString clientPrivateKeyPath;
+    std::shared_ptr<const QSslConfiguration> sslConfiguration;
     int burst_interval = 0;
     uint burst_spread = 0;
     int burst_size = 0;
-    int overrideReconnectInterval = -1;
+    double rate = 0;
+    ReconnectPolicy reconnectPolicy;
+    std::shared_ptr<ReconnectRateLimiter> reconnectRateLimiter;
     bool incrementTopicPerBurst = false;
     QString topic;
     uint qos;
+    uint maxInflight = 0;
     bool retain = false;
     QString clientid;
     bool cleanSession = true;
     bool deferPublishing = false;
-    QString payloadFormat;
-    int payload_max_value = 100;
+    std::shared_ptr<const PayloadTemplate> payloadTemplate;
+    bool binaryPayload = false;
+    MqttEngine engine = MqttEngine::Qmqtt;
+    quint8 protocolVersion = MQTT_PROTOCOL_VERSION_3_1_1;
+    std::shared_ptr<const Mqtt5PublishOptions> mqtt5PublishOptions;
+    QString sharedSubscriptionGroup;
+
+    QStringList getHostnames() const;
+    void resolveHostnames();
 };
 
 #endif // POOLARGUMENTS_H
@@ -20,31 +20,51 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include "poolstarter.h"
 #include "utils.h"
 
-std::mutex PoolStarter::clientCreateMutex;
+#include <qmqtt.h>
 
-PoolStarter::PoolStarter(const PoolArguments &args) :
-    args(args)
+PoolStarter::PoolStarter(const PoolArguments &args, int threadIndex) :
+    args(args),
+    threadIndex(threadIndex),
+    published(nullptr)
 {
 
 }
 
-std::unique_ptr<ClientPool> &PoolStarter::getClientPool()
+/**
+ * @brief PoolStarter::warmUpNetworkStack creates and destroys the network objects the clients use, in the main thread, before the
+ * pools are made. That way, Qt's one-time registrations are done, and pools can construct their clients in parallel.
+ *
+ * Otherwise, concurrent first use gives: "Type conversion already registered from type QSharedPointer<QNetworkSession> to type QObject*".
+ */
+void PoolStarter::warmUpNetworkStack(const PoolArguments &args)
 {
-    return c;
+    QMQTT::Client plain(QHostAddress(QHostAddress::LocalHost), args.port);
+
+    if (args.sslConfiguration)
+    {
+        QMQTT::Client ssl(QString("localhost"), args.port, *args.sslConfiguration, true);
+    }
+}
+
+/**
+ * @brief PoolStarter::getClientPool can be called from any thread.
+ * @return the pool, or nullptr when it's not made yet.
+ */
+const ClientPool *PoolStarter::getClientPool() const
+{
+    return published.load(std::memory_order_acquire);
+}
+
+int PoolStarter::getThreadIndex() const
+{
+    return threadIndex;
 }
 
 void PoolStarter::makeClientPool()
 {
     seedQtrand();
 
-    /* This proved necessary to avoid:
-     *
-     * "Type conversion already registered from type QSharedPointer<QNetworkSession> to type QObject*"
-     *
-     * I didn't see any real deleterious effects, but still better safe than sorry.
-     */
-    std::lock_guard<std::mutex> locker(clientCreateMutex);
-
     c.reset(new ClientPool(this->args));
+    published.store(c.get(), std::memory_order_release);
     QTimer::singleShot(0, c.get(), &ClientPool::startClients);
 }
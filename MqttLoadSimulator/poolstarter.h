@@ -24,7 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <poolarguments.h>
 #include <clientpool.h>
 #include <memory>
-#include <mutex>
+#include <atomic>
 
 
 /**
@@ -33,13 +33,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 class PoolStarter : public QObject
 {
     PoolArguments args;
+    const int threadIndex;
     std::unique_ptr<ClientPool> c;
 
-    static std::mutex clientCreateMutex;
+    // The main thread reads the pool for the stats, while the pool's thread makes it, so it's published with release/acquire.
+    std::atomic<const ClientPool*> published;
 
 public:
-    PoolStarter(const PoolArguments &args);
-    std::unique_ptr<ClientPool> &getClientPool();
+    PoolStarter(const PoolArguments &args, int threadIndex);
+    static void warmUpNetworkStack(const PoolArguments &args);
+    const ClientPool *getClientPool() const;
+    int getThreadIndex() const;
 
 public slots:
     void makeClientPool();
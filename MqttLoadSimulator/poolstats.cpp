@@ -0,0 +1,60 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "poolstats.h"
+
+void StatsHistograms::operator+=(const StatsHistograms &rhs)
+{
+    latency += rhs.latency;
+    tcpConnect += rhs.tcpConnect;
+    connack += rhs.connack;
+    suback += rhs.suback;
+    puback += rhs.puback;
+    pubrec += rhs.pubrec;
+    pubcomp += rhs.pubcomp;
+}
+
+StatsHistograms StatsHistograms::operator-(const StatsHistograms &rhs) const
+{
+    StatsHistograms r;
+    r.latency = latency - rhs.latency;
+    r.tcpConnect = tcpConnect - rhs.tcpConnect;
+    r.connack = connack - rhs.connack;
+    r.suback = suback - rhs.suback;
+    r.puback = puback - rhs.puback;
+    r.pubrec = pubrec - rhs.pubrec;
+    r.pubcomp = pubcomp - rhs.pubcomp;
+    return r;
+}
+
+/**
+ * @brief PoolStats::getHistograms can be called from any thread, like HistogramRecorder::getSnapshot.
+ */
+StatsHistograms PoolStats::getHistograms() const
+{
+    StatsHistograms r;
+    r.latency = latency.getSnapshot();
+    r.tcpConnect = tcpConnect.getSnapshot();
+    r.connack = connack.getSnapshot();
+    r.suback = suback.getSnapshot();
+    r.puback = puback.getSnapshot();
+    r.pubrec = pubrec.getSnapshot();
+    r.pubcomp = pubcomp.getSnapshot();
+    return r;
+}
@@ -0,0 +1,76 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef POOLSTATS_H
+#define POOLSTATS_H
+
+#include <atomic>
+
+#include "histogram.h"
+#include "counters.h"
+
+/**
+ * @brief The StatsHistograms struct is a snapshot of all histograms of one or more pools. Values are in microseconds.
+ */
+struct StatsHistograms
+{
+    Histogram latency;
+    Histogram tcpConnect;
+    Histogram connack;
+    Histogram suback;
+    Histogram puback;
+    Histogram pubrec;
+    Histogram pubcomp;
+
+    void operator+=(const StatsHistograms &rhs);
+    StatsHistograms operator-(const StatsHistograms &rhs) const;
+};
+
+/**
+ * @brief The PoolStats struct holds the statistics a ClientPool's clients record into. Only the pool's thread writes to it, but
+ * it can be read from the stats timer in the main thread at any time.
+ *
+ * It's cache line aligned, so that the pool's other members don't share a line with what its thread writes to constantly.
+ *
+ * The connection phases are: TCP connect (native engine only), CONNECT to CONNACK (with QMQTT, that includes TCP and TLS), and
+ * SUBSCRIBE to SUBACK.
+ *
+ * The ack latencies of QoS 1 and 2 publishes are all measured from sending the PUBLISH.
+ */
+struct alignas(64) PoolStats
+{
+    AtomicCounters counters;
+    HistogramRecorder latency;
+    HistogramRecorder tcpConnect;
+    HistogramRecorder connack;
+    HistogramRecorder suback;
+    HistogramRecorder puback;
+    HistogramRecorder pubrec;
+    HistogramRecorder pubcomp;
+
+    /**
+     * @brief lastConnectedAt and lastDisconnectedAt are steady clock times, in nanoseconds since its epoch.
+     */
+    std::atomic<int64_t> lastConnectedAt{0};
+    std::atomic<int64_t> lastDisconnectedAt{0};
+
+    StatsHistograms getHistograms() const;
+};
+
+#endif // POOLSTATS_H
@@ -0,0 +1,194 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "qmqttconnection.h"
+
+#include <stdexcept>
+
+#include "mqttcodec.h"
+
+/**
+ * @brief QmqttConnection::QmqttConnection
+ * @param client is owned by us from now on.
+ * @param sslSessionResumption reuse the SSL session of the previous connection when reconnecting.
+ */
+QmqttConnection::QmqttConnection(MqttConnectionHandler *handler, QMQTT::Client *client, bool sslSessionResumption) :
+    MqttConnection(handler),
+    client(client),
+    sslSessionResumption(sslSessionResumption)
+{
+    QObject::connect(client, &QMQTT::Client::connected, client, [this]() {
+        onClientConnected();
+    });
+
+    QObject::connect(client, &QMQTT::Client::disconnected, client, [this]() {
+        this->handler->onDisconnected();
+    });
+
+    QObject::connect(client, &QMQTT::Client::error, client, [this](const QMQTT::ClientError error) {
+        onClientError(error);
+    });
+
+    QObject::connect(client, &QMQTT::Client::received, client, [this](const QMQTT::Message &message) {
+        onClientReceived(message);
+    });
+
+    QObject::connect(client, &QMQTT::Client::subscribed, client, [this]() {
+        this->handler->onSubscribed();
+    });
+
+    // QMQTT emits this on PUBACK and PUBCOMP, and right away for QoS 0.
+    QObject::connect(client, &QMQTT::Client::published, client, [this](const QMQTT::Message &message, quint16 msgid) {
+        if (message.qos() > 0)
+            this->handler->onPublishAck(msgid, message.qos() == 1 ? PublishAck::Puback : PublishAck::Pubcomp);
+    });
+}
+
+QmqttConnection::~QmqttConnection()
+{
+    delete client;
+    client = nullptr;
+}
+
+void QmqttConnection::onClientConnected()
+{
+    if (sslSessionResumption)
+        sslSessionTicket = client->sslConfiguration().sessionTicket();
+
+    handler->onConnected();
+}
+
+void QmqttConnection::onClientError(const QMQTT::ClientError error)
+{
+    // TODO: arg, doesn't qmqtt have a better way for this?
+    QString errStr = QString("unknown error");
+    if (error == QMQTT::SocketConnectionRefusedError)
+        errStr = "Connection refused";
+    if (error == QMQTT::SocketRemoteHostClosedError)
+        errStr = "Remote host closed";
+    if (error == QMQTT::SocketHostNotFoundError)
+        errStr = "Remote host not found";
+    if (error == QMQTT::MqttBadUserNameOrPasswordError)
+        errStr = "MQTT bad user or password";
+    if (error == QMQTT::MqttNotAuthorizedError)
+        errStr = "MQTT not authorized";
+    if (error == QMQTT::SocketResourceError)
+        errStr = "Socket resource error. Is your OS limiting you? Ulimit, etc?";
+    if (error == QMQTT::SocketSslInternalError)
+        errStr = "Socket SSL internal error.";
+    if (error == QMQTT::SocketTimeoutError)
+        errStr = "Socket timeout";
+
+    handler->onError(error, errStr);
+}
+
+void QmqttConnection::onClientReceived(const QMQTT::Message &message)
+{
+    const QByteArray payload = message.payload();
+    handler->onReceived(payload.constData(), payload.size());
+}
+
+void QmqttConnection::setClientId(const QString &clientId)
+{
+    client->setClientId(clientId);
+}
+
+QString QmqttConnection::getClientId() const
+{
+    return client->clientId();
+}
+
+void QmqttConnection::setUsername(const QString &username)
+{
+    client->setUsername(username);
+}
+
+void QmqttConnection::setPassword(const QByteArray &password)
+{
+    client->setPassword(password);
+}
+
+void QmqttConnection::setCleanSession(bool cleanSession)
+{
+    client->setCleanSession(cleanSession);
+}
+
+void QmqttConnection::setKeepAlive(quint16 keepAlive)
+{
+    client->setKeepAlive(keepAlive);
+}
+
+/**
+ * @brief QmqttConnection::setProtocolVersion only knows MQTT 3.1 and 3.1.1, because that's all QMQTT does.
+ */
+void QmqttConnection::setProtocolVersion(quint8 protocolVersion)
+{
+    if (protocolVersion > MQTT_PROTOCOL_VERSION_3_1_1)
+        throw std::runtime_error("QMQTT doesn't support MQTT 5");
+
+    client->setVersion(protocolVersion == MQTT_PROTOCOL_VERSION_3_1 ? QMQTT::V3_1_0 : QMQTT::V3_1_1);
+}
+
+void QmqttConnection::setMqtt5PublishOptions(const Mqtt5PublishOptions *options)
+{
+    if (options)
+        throw std::runtime_error("QMQTT doesn't support MQTT 5");
+}
+
+void QmqttConnection::connectToHost()
+{
+    if (sslSessionResumption && !sslSessionTicket.isEmpty())
+    {
+        QSslConfiguration sslConfig = client->sslConfiguration();
+        sslConfig.setSessionTicket(sslSessionTicket);
+        client->setSslConfiguration(sslConfig);
+    }
+
+    client->connectToHost();
+}
+
+void QmqttConnection::disconnectFromHost()
+{
+    client->disconnectFromHost();
+}
+
+void QmqttConnection::subscribe(const QString &topic, quint8 qos)
+{
+    client->subscribe(topic, qos);
+}
+
+void QmqttConnection::publish(quint16 packetId, const QString &topic, const QByteArray &payload, quint8 qos, bool retain)
+{
+    QMQTT::Message msg(packetId, topic, payload, qos, retain);
+    client->publish(msg);
+}
+
+/**
+ * @brief QmqttConnection::beginBatch does nothing, because QTcpSocket already buffers what is written until control returns to the
+ * event loop.
+ */
+void QmqttConnection::beginBatch()
+{
+
+}
+
+void QmqttConnection::endBatch()
+{
+
+}
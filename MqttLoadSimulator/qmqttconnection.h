@@ -0,0 +1,61 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef QMQTTCONNECTION_H
+#define QMQTTCONNECTION_H
+
+#include <qmqtt.h>
+
+#include "mqttconnection.h"
+
+/**
+ * @brief The QmqttConnection class is the MqttConnection that uses QMQTT.
+ */
+class QmqttConnection : public MqttConnection
+{
+    QMQTT::Client *client = nullptr;
+    const bool sslSessionResumption = false;
+    QByteArray sslSessionTicket;
+
+    void onClientConnected();
+    void onClientError(const QMQTT::ClientError error);
+    void onClientReceived(const QMQTT::Message &message);
+
+public:
+    QmqttConnection(MqttConnectionHandler *handler, QMQTT::Client *client, bool sslSessionResumption = false);
+    ~QmqttConnection();
+
+    void setClientId(const QString &clientId) override;
+    QString getClientId() const override;
+    void setUsername(const QString &username) override;
+    void setPassword(const QByteArray &password) override;
+    void setCleanSession(bool cleanSession) override;
+    void setKeepAlive(quint16 keepAlive) override;
+    void setProtocolVersion(quint8 protocolVersion) override;
+    void setMqtt5PublishOptions(const Mqtt5PublishOptions *options) override;
+
+    void connectToHost() override;
+    void disconnectFromHost() override;
+    void subscribe(const QString &topic, quint8 qos) override;
+    void publish(quint16 packetId, const QString &topic, const QByteArray &payload, quint8 qos, bool retain) override;
+    void beginBatch() override;
+    void endBatch() override;
+};
+
+#endif // QMQTTCONNECTION_H
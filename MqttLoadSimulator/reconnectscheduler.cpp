@@ -0,0 +1,111 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "reconnectscheduler.h"
+
+#include <QtGlobal>
+#include <cmath>
+
+#include "oneclient.h"
+
+#define RECONNECT_RESOLUTION 10
+#define MAX_RECONNECT_SCHEDULE_BUCKETS 4096
+
+std::chrono::milliseconds ReconnectPolicy::getDelay(int attempt) const
+{
+    const double backoff = std::min<double>(initialDelay.count() * std::pow(2.0, std::min(attempt, 30)), maxDelay.count());
+    const double random = static_cast<double>(qrand()) / (static_cast<double>(RAND_MAX) + 1.0);
+    const double delay = backoff * (1.0 - jitter * random);
+    return std::chrono::milliseconds(static_cast<int64_t>(delay));
+}
+
+ReconnectRateLimiter::ReconnectRateLimiter(double rate) :
+    interval(static_cast<int64_t>(1e9 / rate)),
+    burst(interval * std::max<int64_t>(1, static_cast<int64_t>(rate / 10.0))),
+    emptyAt(0)
+{
+
+}
+
+/**
+ * @brief ReconnectRateLimiter::tryAcquire takes a token, if there is one. Can be called from any thread.
+ */
+bool ReconnectRateLimiter::tryAcquire(std::chrono::time_point<std::chrono::steady_clock> now)
+{
+    const int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    int64_t cur = emptyAt.load(std::memory_order_relaxed);
+
+    for(;;)
+    {
+        // A full bucket holds 'burst' worth of time, so an idle period doesn't save up more than that.
+        const int64_t next = std::max(cur, nowNs - burst) + interval;
+
+        if (next > nowNs)
+            return false;
+
+        if (emptyAt.compare_exchange_weak(cur, next, std::memory_order_relaxed))
+            return true;
+    }
+}
+
+ReconnectScheduler::ReconnectScheduler(const ReconnectPolicy &policy, const std::shared_ptr<ReconnectRateLimiter> &rateLimiter) :
+    QObject(nullptr),
+    policy(policy),
+    schedule(std::chrono::milliseconds(RECONNECT_RESOLUTION),
+             std::min<size_t>(policy.maxDelay.count() / RECONNECT_RESOLUTION + 1, MAX_RECONNECT_SCHEDULE_BUCKETS)),
+    rateLimiter(rateLimiter)
+{
+    timer.setInterval(RECONNECT_RESOLUTION);
+    connect(&timer, &QTimer::timeout, this, &ReconnectScheduler::onTimer);
+}
+
+/**
+ * @brief ReconnectScheduler::scheduleReconnect
+ * @param attempt how many reconnects failed in a row, for the backoff.
+ */
+void ReconnectScheduler::scheduleReconnect(OneClient *client, int attempt)
+{
+    schedule.schedule(client, std::chrono::steady_clock::now() + policy.getDelay(attempt));
+
+    // The timer only runs while there is something to do, so idle pools don't wake up for it.
+    if (!timer.isActive())
+        timer.start();
+}
+
+void ReconnectScheduler::onTimer()
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    schedule.advance(now, [this](OneClient *c) {
+        due.push_back(c);
+    });
+
+    while (!due.empty())
+    {
+        if (rateLimiter && !rateLimiter->tryAcquire(now))
+            break;
+
+        OneClient *c = due.front();
+        due.pop_front();
+        c->connectToHost();
+    }
+
+    if (due.empty() && schedule.size() == 0)
+        timer.stop();
+}
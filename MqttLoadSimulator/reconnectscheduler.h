@@ -0,0 +1,93 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef RECONNECTSCHEDULER_H
+#define RECONNECTSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+
+#include "timingwheel.h"
+
+class OneClient;
+
+/**
+ * @brief The ReconnectPolicy struct is how long clients wait before reconnecting: exponential backoff, with jitter.
+ */
+struct ReconnectPolicy
+{
+    std::chrono::milliseconds initialDelay = std::chrono::milliseconds(5000);
+    std::chrono::milliseconds maxDelay = std::chrono::milliseconds(60000);
+
+    /**
+     * @brief jitter is the fraction of the delay that is random: 0 is none, 1 is anywhere between 0 and the delay.
+     */
+    double jitter = 1.0;
+
+    std::chrono::milliseconds getDelay(int attempt) const;
+};
+
+/**
+ * @brief The ReconnectRateLimiter class is the cap on the amount of reconnects per second of the whole process. One instance is
+ * shared by the schedulers of all pools, in all threads, so the cap doesn't depend on how clients are divided over them.
+ *
+ * It's a token bucket that allows bursts of 100 ms worth of reconnects, kept as the time at which the bucket is empty, so taking a
+ * token is one compare-and-swap.
+ */
+class ReconnectRateLimiter
+{
+    const int64_t interval;
+    const int64_t burst;
+    std::atomic<int64_t> emptyAt;
+
+public:
+    ReconnectRateLimiter(double rate);
+
+    bool tryAcquire(std::chrono::time_point<std::chrono::steady_clock> now);
+};
+
+/**
+ * @brief The ReconnectScheduler class reconnects the clients of one ClientPool, so they don't each need a timer. Clients that are
+ * due wait in line when the rate limiter has no tokens, so that's the shape of the reconnect storm.
+ *
+ * It lives in the pool's thread, and is not thread safe.
+ */
+class ReconnectScheduler : public QObject
+{
+    Q_OBJECT
+
+    const ReconnectPolicy policy;
+    TimingWheel<OneClient*> schedule;
+    std::deque<OneClient*> due;
+    QTimer timer;
+    const std::shared_ptr<ReconnectRateLimiter> rateLimiter;
+
+    void onTimer();
+
+public:
+    ReconnectScheduler(const ReconnectPolicy &policy, const std::shared_ptr<ReconnectRateLimiter> &rateLimiter);
+
+    void scheduleReconnect(OneClient *client, int attempt);
+};
+
+#endif // RECONNECTSCHEDULER_H
@@ -0,0 +1,208 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#include "scenario.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QSet>
+#include <cmath>
+#include <limits>
+
+#include "utils.h"
+
+/**
+ * @brief scenarioPoolKeys are the keys a pool can have. They're named after the command line options they override.
+ */
+static const QStringList &scenarioPoolKeys()
+{
+    static const QStringList keys {"name", "clients", "publish", "topic", "qos", "retain", "max-inflight", "burst-interval", "burst-spread",
+                                   "msg-per-burst", "rate", "increment-topic-per-burst", "defer-publishing", "payload-format",
+                                   "payload-max-value", "payload-padding", "binary-payload", "shared-subscription-group", "username",
+                                   "password", "delay"};
+    return keys;
+}
+
+static double readNumber(const QJsonObject &pool, const QString &poolName, const QString &key, double defaultValue, double min, double max)
+{
+    const QJsonValue v = pool.value(key);
+
+    if (v.isUndefined())
+        return defaultValue;
+
+    if (!v.isDouble() || v.toDouble() < min || v.toDouble() > max)
+        throw ArgumentException(formatString("Pool '%s': '%s' must be a number from %g to %g", qPrintable(poolName), qPrintable(key), min, max));
+
+    return v.toDouble();
+}
+
+static int64_t readInt(const QJsonObject &pool, const QString &poolName, const QString &key, int64_t defaultValue, int64_t min, int64_t max)
+{
+    const double d = readNumber(pool, poolName, key, defaultValue, min, max);
+
+    if (d != std::floor(d))
+        throw ArgumentException(formatString("Pool '%s': '%s' must be a whole number", qPrintable(poolName), qPrintable(key)));
+
+    return static_cast<int64_t>(d);
+}
+
+static bool readBool(const QJsonObject &pool, const QString &poolName, const QString &key, bool defaultValue)
+{
+    const QJsonValue v = pool.value(key);
+
+    if (v.isUndefined())
+        return defaultValue;
+
+    if (!v.isBool())
+        throw ArgumentException(formatString("Pool '%s': '%s' must be true or false", qPrintable(poolName), qPrintable(key)));
+
+    return v.toBool();
+}
+
+static QString readString(const QJsonObject &pool, const QString &poolName, const QString &key, const QString &defaultValue)
+{
+    const QJsonValue v = pool.value(key);
+
+    if (v.isUndefined())
+        return defaultValue;
+
+    if (!v.isString())
+        throw ArgumentException(formatString("Pool '%s': '%s' must be a string", qPrintable(poolName), qPrintable(key)));
+
+    return v.toString();
+}
+
+static PoolArguments readPool(const QJsonObject &pool, const PoolArguments &defaults, const QString &payloadFormat, int payloadMaxValue)
+{
+    const QJsonValue nameValue = pool.value("name");
+
+    if (!nameValue.isString() || nameValue.toString().isEmpty())
+        throw ArgumentException("Every pool in the scenario needs a 'name'");
+
+    const QString name = nameValue.toString();
+
+    for (const QString &key : pool.keys())
+    {
+        if (!scenarioPoolKeys().contains(key))
+            throw ArgumentException(formatString("Pool '%s': unknown key '%s'", qPrintable(name), qPrintable(key)));
+    }
+
+    if (!pool.contains("clients"))
+        throw ArgumentException(formatString("Pool '%s' needs 'clients'", qPrintable(name)));
+
+    const int intMax = std::numeric_limits<int>::max();
+
+    PoolArguments args(defaults);
+    args.clientIdPart = name;
+    args.amount = readInt(pool, name, "clients", 0, 0, intMax);
+    args.pub_and_sub = readBool(pool, name, "publish", false);
+    args.topic = readString(pool, name, "topic", defaults.topic);
+    args.qos = readInt(pool, name, "qos", defaults.qos, 0, 2);
+    args.retain = readBool(pool, name, "retain", defaults.retain);
+    args.maxInflight = readInt(pool, name, "max-inflight", defaults.maxInflight, 0, intMax);
+    args.burst_interval = readInt(pool, name, "burst-interval", defaults.burst_interval, 1, intMax);
+    args.burst_spread = readInt(pool, name, "burst-spread", defaults.burst_spread, 1, intMax);
+    args.burst_size = readInt(pool, name, "msg-per-burst", defaults.burst_size, 0, intMax);
+    args.rate = readNumber(pool, name, "rate", defaults.rate, 0, std::numeric_limits<double>::max());
+    args.incrementTopicPerBurst = readBool(pool, name, "increment-topic-per-burst", defaults.incrementTopicPerBurst);
+    args.deferPublishing = readBool(pool, name, "defer-publishing", defaults.deferPublishing);
+    args.binaryPayload = readBool(pool, name, "binary-payload", defaults.binaryPayload);
+    args.sharedSubscriptionGroup = readString(pool, name, "shared-subscription-group", defaults.sharedSubscriptionGroup);
+    args.username = readString(pool, name, "username", defaults.username);
+    args.password = readString(pool, name, "password", defaults.password);
+    args.delay = readInt(pool, name, "delay", defaults.delay, 0, intMax);
+
+    if (pool.contains("payload-format") || pool.contains("payload-max-value") || pool.contains("payload-padding"))
+    {
+        QString format = readString(pool, name, "payload-format", payloadFormat);
+        const int maxValue = readInt(pool, name, "payload-max-value", payloadMaxValue, 0, intMax);
+        const int padding = readInt(pool, name, "payload-padding", 0, 0, 256 * 1024 * 1024);
+
+        if (padding > 0)
+        {
+            // The padding is a placeholder, which the old %1/%2 style doesn't have.
+            if (PayloadTemplate::isPositional(format))
+                throw ArgumentException(formatString("Pool '%s': 'payload-padding' can't be used with a payload format that uses %%1 or %%2",
+                                                     qPrintable(name)));
+
+            format += QString("%%padding:%1%%").arg(padding);
+        }
+
+        args.payloadTemplate.reset(new PayloadTemplate(format, maxValue));
+    }
+
+    return args;
+}
+
+/**
+ * @brief loadScenario reads a JSON file with a list of client pools, to simulate a mix of clients, like many slow publishers, a few
+ * fast ones, and some subscribers on a wildcard, instead of one active and one passive pool.
+ *
+ * It looks like {"pools": [{"name": "sensors", "clients": 10000, "publish": true, "burst-interval": 60000, ...}, ...]}. Keys are
+ * named after the command line options, and what a pool doesn't specify comes from the command line. 'publish' defaults to false.
+ *
+ * @param defaults are the arguments made from the command line.
+ * @param payloadFormat and payloadMaxValue are from the command line too, for pools that change only one of them.
+ */
+std::vector<PoolArguments> loadScenario(const QString &path, const PoolArguments &defaults, const QString &payloadFormat, int payloadMaxValue)
+{
+    // All clients of all pools would have the same ID, and keep kicking each other off.
+    if (!defaults.clientid.isEmpty())
+        throw ArgumentException("A scenario can't be combined with a fixed client ID");
+
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly))
+        throw ArgumentException(formatString("Can't open scenario '%s': %s", qPrintable(path), qPrintable(file.errorString())));
+
+    QJsonParseError error;
+    const QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+
+    if (error.error != QJsonParseError::NoError)
+        throw ArgumentException(formatString("Scenario '%s' at offset %d: %s", qPrintable(path), error.offset, qPrintable(error.errorString())));
+
+    const QJsonValue pools = doc.object().value("pools");
+
+    if (!doc.isObject() || !pools.isArray() || pools.toArray().isEmpty())
+        throw ArgumentException(formatString("Scenario '%s' needs a list of 'pools'", qPrintable(path)));
+
+    std::vector<PoolArguments> result;
+    QSet<QString> names;
+
+    for (const QJsonValue &pool : pools.toArray())
+    {
+        if (!pool.isObject())
+            throw ArgumentException(formatString("Scenario '%s': pools must be objects", qPrintable(path)));
+
+        result.push_back(readPool(pool.toObject(), defaults, payloadFormat, payloadMaxValue));
+
+        const QString &name = result.back().clientIdPart;
+
+        if (names.contains(name))
+            throw ArgumentException(formatString("Scenario '%s': there is more than one pool named '%s'", qPrintable(path), qPrintable(name)));
+
+        names.insert(name);
+    }
+
+    return result;
+}
@@ -0,0 +1,31 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <QString>
+#include <vector>
+
+#include "poolarguments.h"
+
+std::vector<PoolArguments> loadScenario(const QString &path, const PoolArguments &defaults, const QString &payloadFormat, int payloadMaxValue);
+
+#endif // SCENARIO_H
@@ -0,0 +1,564 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#include "selftestbroker.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+#include <algorithm>
+
+#include "globals.h"
+
+#define SELF_TEST_READ_SIZE 16384
+
+SelfTestSession::SelfTestSession(SelfTestBroker &broker, int fd) :
+    broker(broker),
+    fd(fd)
+{
+    broker.getLoop().add(fd, EPOLLIN, this);
+}
+
+SelfTestSession::~SelfTestSession()
+{
+    close();
+}
+
+void SelfTestSession::markDirty()
+{
+    if (dirty)
+        return;
+
+    dirty = true;
+    broker.markDirty(this);
+}
+
+/**
+ * @brief SelfTestSession::deliver only queues the message. The broker flushes all sessions it wrote to after handling the events of
+ * the round, so a subscriber gets the messages of many publishers in one write.
+ */
+void SelfTestSession::deliver(const MqttPublishView &publish)
+{
+    static const QByteArray noProperties;
+    const QByteArray *properties = protocolVersion == MQTT_PROTOCOL_VERSION_5 ? &noProperties : nullptr;
+
+    MqttCodec::writePublish(writeBuf, publish.topic, publish.topicLength, publish.payload, publish.payloadLength, 0, false, 0, properties);
+    markDirty();
+}
+
+void SelfTestSession::flush()
+{
+    dirty = false;
+
+    if (this->fd < 0)
+        return;
+
+    while (!writeBuf.empty())
+    {
+        const ssize_t n = send(this->fd, writeBuf.readPtr(), writeBuf.readable(), MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            close();
+            return;
+        }
+
+        writeBuf.consume(n);
+    }
+
+    setWantWrite(!writeBuf.empty());
+}
+
+void SelfTestSession::setWantWrite(bool val)
+{
+    if (this->wantWrite == val)
+        return;
+
+    this->wantWrite = val;
+    broker.getLoop().modify(this->fd, val ? (EPOLLIN | EPOLLOUT) : EPOLLIN, this);
+}
+
+/**
+ * @brief SelfTestSession::close is safe to call while the broker is routing, because the broker only deletes the session later.
+ */
+void SelfTestSession::close()
+{
+    if (this->fd < 0)
+        return;
+
+    broker.getLoop().remove(this->fd);
+    ::close(this->fd);
+    this->fd = -1;
+    readBuf.release();
+    writeBuf.release();
+    broker.unsubscribeAll(this);
+    subscriptions.clear();
+    broker.sessionClosed(this);
+}
+
+bool SelfTestSession::isClosed() const
+{
+    return this->fd < 0;
+}
+
+const std::vector<QByteArray> &SelfTestSession::getSubscriptions() const
+{
+    return this->subscriptions;
+}
+
+void SelfTestSession::onEpollEvents(uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        close();
+        return;
+    }
+
+    if (events & EPOLLOUT)
+        flush();
+
+    if (events & EPOLLIN)
+        readPackets();
+}
+
+/**
+ * @brief SelfTestSession::readPackets reads like NativeConnection does: into a buffer shared by the thread, keeping only a packet that
+ * is incomplete.
+ */
+void SelfTestSession::readPackets()
+{
+    thread_local std::vector<char> scratch(SELF_TEST_READ_SIZE);
+
+    while (this->fd >= 0)
+    {
+        const ssize_t n = recv(this->fd, scratch.data(), SELF_TEST_READ_SIZE, 0);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            close();
+            return;
+        }
+
+        if (n == 0)
+        {
+            close();
+            return;
+        }
+
+        const bool continuing = !readBuf.empty();
+        if (continuing)
+            readBuf.append(scratch.data(), n);
+
+        const char *data = continuing ? readBuf.readPtr() : scratch.data();
+        const size_t length = continuing ? readBuf.readable() : static_cast<size_t>(n);
+        size_t pos = 0;
+
+        try
+        {
+            MqttFixedHeader header;
+            while (this->fd >= 0 && MqttCodec::readFixedHeader(data + pos, length - pos, header))
+            {
+                if (length - pos < header.packetLength())
+                    break;
+
+                handlePacket(header, data + pos + header.headerLength);
+                pos += header.packetLength();
+            }
+        }
+        catch (MqttProtocolError &ex)
+        {
+            if (Globals::verbose)
+                fprintf(stderr, "Self-test broker: protocol error: %s\n", ex.what());
+
+            close();
+            return;
+        }
+
+        if (this->fd < 0)
+            return;
+
+        if (continuing)
+        {
+            readBuf.consume(pos);
+
+            if (readBuf.empty())
+                readBuf.release();
+        }
+        else if (pos < length)
+        {
+            readBuf.append(data + pos, length - pos);
+        }
+
+        if (static_cast<size_t>(n) < SELF_TEST_READ_SIZE)
+            break;
+    }
+}
+
+void SelfTestSession::handlePacket(const MqttFixedHeader &header, const char *body)
+{
+    switch (header.type())
+    {
+    case MqttPacketType::Connect:
+    {
+        MqttConnectView connect;
+        MqttCodec::readConnect(header, body, connect);
+        this->protocolVersion = connect.protocolVersion;
+        MqttCodec::writeConnack(writeBuf, 0, this->protocolVersion);
+        markDirty();
+        break;
+    }
+    case MqttPacketType::Subscribe:
+        handleSubscribe(header, body);
+        break;
+    case MqttPacketType::Publish:
+    {
+        MqttPublishView publish;
+        MqttCodec::readPublish(header, body, this->protocolVersion, publish);
+
+        if (publish.qos == 1)
+            MqttCodec::writeAck(writeBuf, MqttPacketType::Puback, publish.packetId);
+        else if (publish.qos == 2)
+            MqttCodec::writeAck(writeBuf, MqttPacketType::Pubrec, publish.packetId);
+
+        if (publish.qos > 0)
+            markDirty();
+
+        broker.route(publish);
+        break;
+    }
+    case MqttPacketType::Pubrel:
+        MqttCodec::writeAck(writeBuf, MqttPacketType::Pubcomp, MqttCodec::readPacketId(header, body));
+        markDirty();
+        break;
+    case MqttPacketType::Pingreq:
+        MqttCodec::writeEmpty(writeBuf, MqttPacketType::Pingresp);
+        markDirty();
+        break;
+    case MqttPacketType::Disconnect:
+        close();
+        break;
+    default:
+        break;
+    }
+}
+
+void SelfTestSession::handleSubscribe(const MqttFixedHeader &header, const char *body)
+{
+    thread_local std::vector<MqttTopicFilterView> filters;
+    const uint16_t packetId = MqttCodec::readSubscribe(header, body, this->protocolVersion, filters);
+
+    for (const MqttTopicFilterView &f : filters)
+    {
+        QByteArray filter(f.filter, static_cast<int>(f.filterLength));
+
+        // Shared subscriptions are treated as normal ones.
+        if (filter.startsWith("$share/"))
+        {
+            const int slash = filter.indexOf('/', 7);
+            filter = slash > 0 ? filter.mid(slash + 1) : QByteArray();
+        }
+
+        if (filter.isEmpty() || std::find(subscriptions.begin(), subscriptions.end(), filter) != subscriptions.end())
+            continue;
+
+        subscriptions.push_back(filter);
+        broker.subscribe(this, filter);
+    }
+
+    MqttCodec::writeSuback(writeBuf, packetId, filters, this->protocolVersion);
+    markDirty();
+}
+
+/**
+ * @brief SelfTestBroker::SelfTestBroker opens the listening socket right away, so the port is known before the clients are made.
+ * @param port 0 for any free port.
+ */
+SelfTestBroker::SelfTestBroker(quint16 port) : QObject(nullptr),
+    sessionCount(0),
+    received(0),
+    delivered(0)
+{
+    this->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (this->listenFd < 0)
+        throw std::runtime_error(std::string("Error creating self-test broker socket: ") + strerror(errno));
+
+    const int one = 1;
+    setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(struct sockaddr_in));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(this->listenFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(struct sockaddr_in)) != 0 || listen(this->listenFd, SOMAXCONN) != 0)
+    {
+        const int err = errno;
+        ::close(this->listenFd);
+        this->listenFd = -1;
+        throw std::runtime_error(std::string("Error listening on loopback for the self-test broker: ") + strerror(err));
+    }
+
+    socklen_t addressLength = sizeof(struct sockaddr_in);
+    getsockname(this->listenFd, reinterpret_cast<struct sockaddr*>(&address), &addressLength);
+    this->port = ntohs(address.sin_port);
+}
+
+/**
+ * @brief SelfTestBroker::~SelfTestBroker has to run after the broker's thread has stopped, like for the client pools.
+ */
+SelfTestBroker::~SelfTestBroker()
+{
+    afterEventsTimer.reset();
+
+    for (SelfTestSession *s : std::vector<SelfTestSession*>(sessions.begin(), sessions.end()))
+        s->close();
+
+    for (SelfTestSession *s : closedSessions)
+        delete s;
+    closedSessions.clear();
+
+    if (this->listenFd >= 0)
+    {
+        if (loop)
+            loop->remove(this->listenFd);
+
+        ::close(this->listenFd);
+        this->listenFd = -1;
+    }
+}
+
+/**
+ * @brief SelfTestBroker::start has to be called in the broker's thread, because the epoll loop and timer belong to that.
+ */
+void SelfTestBroker::start()
+{
+    loop.reset(new EpollLoop());
+
+    afterEventsTimer.reset(new QTimer());
+    afterEventsTimer->setSingleShot(true);
+    afterEventsTimer->setInterval(0);
+    connect(afterEventsTimer.get(), &QTimer::timeout, this, &SelfTestBroker::onAfterEvents);
+
+    loop->add(this->listenFd, EPOLLIN, this);
+}
+
+quint16 SelfTestBroker::getPort() const
+{
+    return this->port;
+}
+
+EpollLoop &SelfTestBroker::getLoop()
+{
+    return *loop;
+}
+
+void SelfTestBroker::onEpollEvents(uint32_t events)
+{
+    (void)events;
+    acceptConnections();
+}
+
+void SelfTestBroker::acceptConnections()
+{
+    for (;;)
+    {
+        const int fd = accept4(this->listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK && Globals::verbose)
+                fprintf(stderr, "Self-test broker: error accepting connection: %s\n", strerror(errno));
+
+            break;
+        }
+
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        sessions.insert(new SelfTestSession(*this, fd));
+        sessionCount.store(sessions.size(), std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief SelfTestBroker::subscribe files 'prefix/#' under 'prefix', so routing can look it up without making strings.
+ */
+void SelfTestBroker::subscribe(SelfTestSession *session, const QByteArray &filter)
+{
+    if (filter == "#")
+        allSubscribers.push_back(session);
+    else if (filter.endsWith("/#"))
+        prefixSubscribers[filter.left(filter.size() - 2)].push_back(session);
+    else
+        exactSubscribers[filter].push_back(session);
+}
+
+static void removeSession(std::vector<SelfTestSession*> &subscribers, SelfTestSession *session)
+{
+    auto pos = std::find(subscribers.begin(), subscribers.end(), session);
+
+    if (pos == subscribers.end())
+        return;
+
+    *pos = subscribers.back();
+    subscribers.pop_back();
+}
+
+void SelfTestBroker::unsubscribeAll(SelfTestSession *session)
+{
+    for (const QByteArray &filter : session->getSubscriptions())
+    {
+        if (filter == "#")
+        {
+            removeSession(allSubscribers, session);
+            continue;
+        }
+
+        QHash<QByteArray, std::vector<SelfTestSession*>> &subscribers = filter.endsWith("/#") ? prefixSubscribers : exactSubscribers;
+        const QByteArray key = filter.endsWith("/#") ? filter.left(filter.size() - 2) : filter;
+        auto pos = subscribers.find(key);
+
+        if (pos == subscribers.end())
+            continue;
+
+        removeSession(pos.value(), session);
+
+        if (pos.value().empty())
+            subscribers.erase(pos);
+    }
+}
+
+void SelfTestBroker::deliverTo(const std::vector<SelfTestSession*> *subscribers, const MqttPublishView &publish)
+{
+    if (!subscribers)
+        return;
+
+    for (SelfTestSession *s : *subscribers)
+        s->deliver(publish);
+
+    delivered.fetch_add(subscribers->size(), std::memory_order_relaxed);
+}
+
+static const std::vector<SelfTestSession*> *findSubscribers(const QHash<QByteArray, std::vector<SelfTestSession*>> &subscribers,
+                                                            const char *topic, size_t length)
+{
+    // Doesn't copy the topic.
+    auto pos = subscribers.find(QByteArray::fromRawData(topic, static_cast<int>(length)));
+    return pos == subscribers.end() ? nullptr : &pos.value();
+}
+
+/**
+ * @brief SelfTestBroker::route delivers a message to the exact subscribers of its topic, and to those of 'prefix/#' for every level of
+ * it, which according to MQTT includes the topic itself.
+ */
+void SelfTestBroker::route(const MqttPublishView &publish)
+{
+    received.fetch_add(1, std::memory_order_relaxed);
+
+    if (publish.topicLength == 0)
+        return;
+
+    deliverTo(findSubscribers(exactSubscribers, publish.topic, publish.topicLength), publish);
+
+    if (!prefixSubscribers.isEmpty())
+    {
+        for (size_t i = 0; i < publish.topicLength; i++)
+        {
+            if (publish.topic[i] == '/')
+                deliverTo(findSubscribers(prefixSubscribers, publish.topic, i), publish);
+        }
+
+        deliverTo(findSubscribers(prefixSubscribers, publish.topic, publish.topicLength), publish);
+    }
+
+    if (publish.topic[0] != '$')
+        deliverTo(&allSubscribers, publish);
+}
+
+void SelfTestBroker::markDirty(SelfTestSession *session)
+{
+    dirtySessions.push_back(session);
+
+    if (!afterEventsTimer->isActive())
+        afterEventsTimer->start();
+}
+
+void SelfTestBroker::sessionClosed(SelfTestSession *session)
+{
+    sessions.erase(session);
+    sessionCount.store(sessions.size(), std::memory_order_relaxed);
+    closedSessions.push_back(session);
+
+    if (afterEventsTimer && !afterEventsTimer->isActive())
+        afterEventsTimer->start();
+}
+
+/**
+ * @brief SelfTestBroker::onAfterEvents runs when the epoll loop is done with a round of events: it writes what was queued for the
+ * sessions, and deletes the sessions that were closed, which can't be done while their events may still be pending.
+ */
+void SelfTestBroker::onAfterEvents()
+{
+    // By index, because flushing can close sessions, which doesn't add to this list, but let's not depend on that.
+    for (size_t i = 0; i < dirtySessions.size(); i++)
+        dirtySessions[i]->flush();
+    dirtySessions.clear();
+
+    for (SelfTestSession *s : closedSessions)
+        delete s;
+    closedSessions.clear();
+}
+
+int64_t SelfTestBroker::getSessionCount() const
+{
+    return sessionCount.load(std::memory_order_relaxed);
+}
+
+uint64_t SelfTestBroker::getReceived() const
+{
+    return received.load(std::memory_order_relaxed);
+}
+
+uint64_t SelfTestBroker::getDelivered() const
+{
+    return delivered.load(std::memory_order_relaxed);
+}
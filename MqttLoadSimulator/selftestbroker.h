@@ -0,0 +1,129 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#ifndef SELFTESTBROKER_H
+#define SELFTESTBROKER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QHash>
+#include <QByteArray>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_set>
+
+#include "epollloop.h"
+#include "bytebuffer.h"
+#include "mqttcodec.h"
+
+class SelfTestBroker;
+
+/**
+ * @brief The SelfTestSession class is one client connection of the SelfTestBroker.
+ */
+class SelfTestSession : public EpollHandler
+{
+    SelfTestBroker &broker;
+    int fd = -1;
+    uint8_t protocolVersion = MQTT_PROTOCOL_VERSION_3_1_1;
+    bool wantWrite = false;
+    bool dirty = false;
+    ByteBuffer readBuf;
+    ByteBuffer writeBuf;
+    std::vector<QByteArray> subscriptions;
+
+    void readPackets();
+    void handlePacket(const MqttFixedHeader &header, const char *body);
+    void handleSubscribe(const MqttFixedHeader &header, const char *body);
+    void setWantWrite(bool val);
+    void markDirty();
+
+public:
+    SelfTestSession(SelfTestBroker &broker, int fd);
+    SelfTestSession(const SelfTestSession &other) = delete;
+    SelfTestSession &operator=(const SelfTestSession &other) = delete;
+    ~SelfTestSession();
+
+    void deliver(const MqttPublishView &publish);
+    void flush();
+    void close();
+    bool isClosed() const;
+    const std::vector<QByteArray> &getSubscriptions() const;
+
+    void onEpollEvents(uint32_t events) override;
+};
+
+/**
+ * @brief The SelfTestBroker class is a minimal MQTT broker on loopback, for --self-test. It has as little to do as possible, so that
+ * what's measured against it is the ceiling of the tester itself.
+ *
+ * It accepts every CONNECT, acks QoS 1 and 2, and delivers messages with QoS 0. Topic filters are matched exactly, or as 'prefix/#'
+ * and '#'; '+' is not supported. Shared subscriptions are treated as normal ones. There is no retain, no sessions and no keep-alive
+ * checking.
+ *
+ * It runs in one thread of its own, with an EpollLoop. Only the getters can be called from other threads.
+ */
+class SelfTestBroker : public QObject, public EpollHandler
+{
+    Q_OBJECT
+
+    int listenFd = -1;
+    quint16 port = 0;
+    std::unique_ptr<EpollLoop> loop;
+    std::unique_ptr<QTimer> afterEventsTimer;
+    std::unordered_set<SelfTestSession*> sessions;
+    std::vector<SelfTestSession*> closedSessions;
+    std::vector<SelfTestSession*> dirtySessions;
+
+    QHash<QByteArray, std::vector<SelfTestSession*>> exactSubscribers;
+    QHash<QByteArray, std::vector<SelfTestSession*>> prefixSubscribers;
+    std::vector<SelfTestSession*> allSubscribers;
+
+    std::atomic<int64_t> sessionCount;
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> delivered;
+
+    void acceptConnections();
+    void deliverTo(const std::vector<SelfTestSession*> *subscribers, const MqttPublishView &publish);
+    void onAfterEvents();
+
+public:
+    SelfTestBroker(quint16 port);
+    ~SelfTestBroker();
+
+    void start();
+    quint16 getPort() const;
+
+    EpollLoop &getLoop();
+    void subscribe(SelfTestSession *session, const QByteArray &filter);
+    void unsubscribeAll(SelfTestSession *session);
+    void route(const MqttPublishView &publish);
+    void markDirty(SelfTestSession *session);
+    void sessionClosed(SelfTestSession *session);
+
+    int64_t getSessionCount() const;
+    uint64_t getReceived() const;
+    uint64_t getDelivered() const;
+
+    void onEpollEvents(uint32_t events) override;
+};
+
+#endif // SELFTESTBROKER_H
@@ -0,0 +1,83 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "sequencetracker.h"
+
+#define SEQUENCE_WINDOW 64
+
+void SequenceTracker::track(uint32_t senderId, uint64_t sequence, SequenceCounts &counts)
+{
+    auto pos = senders.find(senderId);
+
+    if (pos == senders.end())
+    {
+        Window w;
+        w.highest = sequence;
+        w.received = ~static_cast<uint64_t>(0);
+        senders.insert(senderId, w);
+        return;
+    }
+
+    Window &w = pos.value();
+
+    if (sequence > w.highest)
+    {
+        const uint64_t shift = sequence - w.highest;
+
+        if (shift >= SEQUENCE_WINDOW)
+        {
+            // The whole window drops out, and so do the sequences in between that never made it into it.
+            counts.lost += SEQUENCE_WINDOW - __builtin_popcountll(w.received) + (shift - SEQUENCE_WINDOW);
+            w.received = 1;
+        }
+        else
+        {
+            const uint64_t droppedOut = w.received >> (SEQUENCE_WINDOW - shift);
+            counts.lost += shift - __builtin_popcountll(droppedOut);
+            w.received = (w.received << shift) | 1;
+        }
+
+        w.highest = sequence;
+        return;
+    }
+
+    const uint64_t age = w.highest - sequence;
+
+    if (age >= SEQUENCE_WINDOW)
+    {
+        counts.reordered++;
+        return;
+    }
+
+    const uint64_t bit = static_cast<uint64_t>(1) << age;
+
+    if (w.received & bit)
+    {
+        counts.duplicate++;
+        return;
+    }
+
+    w.received |= bit;
+    counts.reordered++;
+}
+
+int SequenceTracker::getSenderCount() const
+{
+    return senders.size();
+}
@@ -0,0 +1,58 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef SEQUENCETRACKER_H
+#define SEQUENCETRACKER_H
+
+#include <QHash>
+#include <stdint.h>
+
+struct SequenceCounts
+{
+    uint64_t lost = 0;
+    uint64_t duplicate = 0;
+    uint64_t reordered = 0;
+};
+
+/**
+ * @brief The SequenceTracker class checks the sequence numbers a subscriber receives, per publisher, for loss, duplicates and
+ * reordering.
+ *
+ * Per publisher, it keeps the highest sequence seen and a 64-bit bitmap of which of the 64 sequences up to it were received. A
+ * sequence counts as lost once it drops out of that window without having been received, so loss is reported with a delay of 64
+ * messages of that publisher. Something older than the window was already counted as lost, and counts as reordered when it arrives.
+ *
+ * Sequences before the first one we see of a publisher are not counted, because we may have subscribed later.
+ */
+class SequenceTracker
+{
+    struct Window
+    {
+        uint64_t highest = 0;
+        uint64_t received = 0;
+    };
+
+    QHash<uint32_t, Window> senders;
+
+public:
+    void track(uint32_t senderId, uint64_t sequence, SequenceCounts &counts);
+    int getSenderCount() const;
+};
+
+#endif // SEQUENCETRACKER_H
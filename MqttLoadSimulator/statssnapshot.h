@@ -0,0 +1,80 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef STATSSNAPSHOT_H
+#define STATSSNAPSHOT_H
+
+#include <QString>
+#include <vector>
+#include <stdint.h>
+
+#include "counters.h"
+
+/**
+ * @brief The ThreadLoad struct is the event loop lag and busy ratio of one worker thread, over one stats interval.
+ */
+struct ThreadLoad
+{
+    double lagP99Ms = 0;
+    double lagMaxMs = 0;
+    double busyRatio = 0;
+};
+
+/**
+ * @brief The PoolSnapshot struct is one ClientPool, so one pool of the command line or scenario on one thread. The counters are totals,
+ * the latency is of the interval.
+ */
+struct PoolSnapshot
+{
+    QString name;
+    int thread = 0;
+    int clients = 0;
+    Counters counters;
+    LatencyValues latency;
+};
+
+/**
+ * @brief The StatsSnapshot struct is the state of one stats interval, as a value, so it can be handed to other threads for output.
+ */
+struct StatsSnapshot
+{
+    int64_t unixTimeMs = 0;
+    double elapsedSeconds = 0;
+    int clients = 0;
+    int disconnectedClients = 0;
+
+    /**
+     * @brief lastRecoverySeconds is how long it took for all clients to be connected again, the last time some weren't. -1 if never.
+     */
+    double lastRecoverySeconds = -1;
+    double targetRate = 0;
+    Counters totals;
+    Counters rates;
+    LatencyValues latency;
+    LatencyValues tcpConnect;
+    LatencyValues connack;
+    LatencyValues suback;
+    LatencyValues puback;
+    LatencyValues pubrec;
+    LatencyValues pubcomp;
+    std::vector<ThreadLoad> threadLoads;
+    std::vector<PoolSnapshot> pools;
+};
+
+#endif // STATSSNAPSHOT_H
@@ -0,0 +1,218 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "statswriter.h"
+
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+
+StatsWriter::StatsWriter(const QString &path) : QObject(nullptr)
+{
+    if (path.endsWith(".csv", Qt::CaseInsensitive))
+        this->format = Format::Csv;
+
+    this->f = fopen(path.toLocal8Bit().constData(), "w");
+
+    if (!this->f)
+        throw ArgumentException(formatString("Can't open stats output '%s': %s", qPrintable(path), strerror(errno)));
+}
+
+StatsWriter::~StatsWriter()
+{
+    if (this->f)
+    {
+        fclose(this->f);
+        this->f = nullptr;
+    }
+}
+
+/**
+ * @brief StatsWriter::write writes one record and flushes it, so that an aborted run still has all data up to then.
+ */
+void StatsWriter::write(const StatsSnapshot &snapshot)
+{
+    if (this->format == Format::Csv)
+        writeCsv(snapshot);
+    else
+        writeJson(snapshot);
+
+    fflush(this->f);
+}
+
+static QJsonObject countersToJson(const Counters &counters)
+{
+    QJsonObject o;
+    o["sent"] = static_cast<qint64>(counters.publish);
+    o["received"] = static_cast<qint64>(counters.received);
+    o["connects"] = static_cast<qint64>(counters.connect);
+    o["disconnects"] = static_cast<qint64>(counters.disconnect);
+    o["errors"] = static_cast<qint64>(counters.error);
+    o["socket_writes"] = static_cast<qint64>(counters.socketWrites);
+    o["ack_timeouts"] = static_cast<qint64>(counters.ackTimeout);
+    o["ack_duplicates"] = static_cast<qint64>(counters.ackDuplicate);
+    o["lost"] = static_cast<qint64>(counters.lost);
+    o["duplicates"] = static_cast<qint64>(counters.duplicate);
+    o["reordered"] = static_cast<qint64>(counters.reordered);
+    o["subscribe_failures"] = static_cast<qint64>(counters.subscribeFailed);
+    return o;
+}
+
+static QString isoTime(int64_t unixTimeMs)
+{
+    return QDateTime::fromMSecsSinceEpoch(unixTimeMs, Qt::UTC).toString(Qt::ISODateWithMs);
+}
+
+static QJsonObject latencyToJson(const LatencyValues &values)
+{
+    QJsonObject o;
+    o["min"] = static_cast<qint64>(values.min.count());
+    o["avg"] = static_cast<qint64>(values.avg.count());
+    o["p50"] = static_cast<qint64>(values.p50.count());
+    o["p90"] = static_cast<qint64>(values.p90.count());
+    o["p99"] = static_cast<qint64>(values.p99.count());
+    o["p999"] = static_cast<qint64>(values.p999.count());
+    o["max"] = static_cast<qint64>(values.max.count());
+    return o;
+}
+
+void StatsWriter::writeJson(const StatsSnapshot &snapshot)
+{
+    QJsonObject connectPhases;
+    connectPhases["tcp_connect"] = latencyToJson(snapshot.tcpConnect);
+    connectPhases["connack"] = latencyToJson(snapshot.connack);
+    connectPhases["suback"] = latencyToJson(snapshot.suback);
+
+    QJsonObject acks;
+    acks["puback"] = latencyToJson(snapshot.puback);
+    acks["pubrec"] = latencyToJson(snapshot.pubrec);
+    acks["pubcomp"] = latencyToJson(snapshot.pubcomp);
+
+    QJsonArray threads;
+    for (const ThreadLoad &t : snapshot.threadLoads)
+    {
+        QJsonObject thread;
+        thread["lag_p99_ms"] = t.lagP99Ms;
+        thread["lag_max_ms"] = t.lagMaxMs;
+        thread["busy"] = t.busyRatio;
+        threads.append(thread);
+    }
+
+    QJsonArray pools;
+    for (const PoolSnapshot &p : snapshot.pools)
+    {
+        QJsonObject pool = countersToJson(p.counters);
+        pool["name"] = p.name;
+        pool["thread"] = p.thread;
+        pool["clients"] = p.clients;
+        pool["latency_us"] = latencyToJson(p.latency);
+        pools.append(pool);
+    }
+
+    QJsonObject record;
+    record["time"] = isoTime(snapshot.unixTimeMs);
+    record["elapsed_s"] = snapshot.elapsedSeconds;
+    record["clients"] = snapshot.clients;
+    record["disconnected_clients"] = snapshot.disconnectedClients;
+    record["last_recovery_s"] = snapshot.lastRecoverySeconds >= 0 ? QJsonValue(snapshot.lastRecoverySeconds) : QJsonValue();
+    record["target_rate"] = snapshot.targetRate;
+    record["totals"] = countersToJson(snapshot.totals);
+    record["per_second"] = countersToJson(snapshot.rates);
+    record["latency_us"] = latencyToJson(snapshot.latency);
+    record["connect_phases_us"] = connectPhases;
+    record["ack_latency_us"] = acks;
+    record["threads"] = threads;
+    record["pools"] = pools;
+
+    const QByteArray line = QJsonDocument(record).toJson(QJsonDocument::Compact);
+    fwrite(line.constData(), 1, line.size(), this->f);
+    fputc('\n', this->f);
+}
+
+/**
+ * @brief StatsWriter::writeCsv writes the header based on the first record, which is fine because the amount of threads and pools
+ * doesn't change during a run.
+ */
+void StatsWriter::writeCsv(const StatsSnapshot &snapshot)
+{
+    if (!csvHeaderWritten)
+    {
+        std::string header = "time,elapsed_s,clients,target_rate,sent,received,connects,disconnects,errors,socket_writes,"
+                             "sent_per_s,received_per_s,connects_per_s,disconnects_per_s,errors_per_s,"
+                             "latency_min_us,latency_avg_us,latency_p50_us,latency_p90_us,latency_p99_us,latency_p999_us,latency_max_us,"
+                             "tcp_connect_p50_us,tcp_connect_p99_us,tcp_connect_max_us,connack_p50_us,connack_p99_us,connack_max_us,"
+                             "suback_p50_us,suback_p99_us,suback_max_us,"
+                             "puback_p50_us,puback_p99_us,puback_max_us,pubrec_p50_us,pubrec_p99_us,pubrec_max_us,"
+                             "pubcomp_p50_us,pubcomp_p99_us,pubcomp_max_us,ack_timeouts,ack_duplicates,lost,duplicates,reordered,lost_per_s,"
+                             "disconnected_clients,last_recovery_s";
+
+        for (size_t i = 0; i < snapshot.threadLoads.size(); i++)
+        {
+            header += formatString(",thread_%zu_lag_p99_ms,thread_%zu_lag_max_ms,thread_%zu_busy", i, i, i);
+        }
+
+        for (size_t i = 0; i < snapshot.pools.size(); i++)
+        {
+            header += formatString(",pool_%zu_clients,pool_%zu_sent,pool_%zu_received,pool_%zu_errors,pool_%zu_latency_p50_us,pool_%zu_latency_p99_us",
+                                   i, i, i, i, i, i);
+        }
+
+        fprintf(this->f, "%s\n", header.c_str());
+        csvHeaderWritten = true;
+    }
+
+    const Counters &t = snapshot.totals;
+    const Counters &r = snapshot.rates;
+    const LatencyValues &l = snapshot.latency;
+
+    std::string line = formatString("%s,%.3f,%d,%.1f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+                                    qPrintable(isoTime(snapshot.unixTimeMs)), snapshot.elapsedSeconds, snapshot.clients, snapshot.targetRate,
+                                    t.publish, t.received, t.connect, t.disconnect, t.error, t.socketWrites,
+                                    r.publish, r.received, r.connect, r.disconnect, r.error,
+                                    l.min.count(), l.avg.count(), l.p50.count(), l.p90.count(), l.p99.count(), l.p999.count(), l.max.count());
+
+    for (const LatencyValues *v : {&snapshot.tcpConnect, &snapshot.connack, &snapshot.suback, &snapshot.puback, &snapshot.pubrec, &snapshot.pubcomp})
+    {
+        line += formatString(",%ld,%ld,%ld", v->p50.count(), v->p99.count(), v->max.count());
+    }
+
+    line += formatString(",%lu,%lu,%lu,%lu,%lu,%lu", t.ackTimeout, t.ackDuplicate, t.lost, t.duplicate, t.reordered, r.lost);
+    line += formatString(",%d,", snapshot.disconnectedClients);
+
+    if (snapshot.lastRecoverySeconds >= 0)
+        line += formatString("%.3f", snapshot.lastRecoverySeconds);
+
+    for (const ThreadLoad &t : snapshot.threadLoads)
+    {
+        line += formatString(",%.3f,%.3f,%.3f", t.lagP99Ms, t.lagMaxMs, t.busyRatio);
+    }
+
+    for (const PoolSnapshot &p : snapshot.pools)
+    {
+        line += formatString(",%d,%lu,%lu,%lu,%ld,%ld", p.clients, p.counters.publish, p.counters.received, p.counters.error,
+                             p.latency.p50.count(), p.latency.p99.count());
+    }
+
+    fprintf(this->f, "%s\n", line.c_str());
+}
@@ -0,0 +1,60 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef STATSWRITER_H
+#define STATSWRITER_H
+
+#include <QObject>
+#include <QString>
+#include <stdio.h>
+
+#include "statssnapshot.h"
+
+/**
+ * @brief The StatsWriter class appends stats snapshots to a file, as JSON lines, or as CSV when the file name ends in '.csv'.
+ *
+ * It's meant to live in its own thread, so that a slow disk never holds up the stats timer.
+ */
+class StatsWriter : public QObject
+{
+    Q_OBJECT
+
+    enum class Format
+    {
+        JsonLines,
+        Csv
+    };
+
+    FILE *f = nullptr;
+    Format format = Format::JsonLines;
+    bool csvHeaderWritten = false;
+
+    void writeJson(const StatsSnapshot &snapshot);
+    void writeCsv(const StatsSnapshot &snapshot);
+
+public:
+    StatsWriter(const QString &path);
+    StatsWriter(const StatsWriter &other) = delete;
+    StatsWriter &operator=(const StatsWriter &other) = delete;
+    ~StatsWriter();
+
+    void write(const StatsSnapshot &snapshot);
+};
+
+#endif // STATSWRITER_H
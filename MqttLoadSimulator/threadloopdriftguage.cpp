@@ -19,25 +19,86 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 
 #include "threadloopdriftguage.h"
 
-ThreadLoopDriftGuage::ThreadLoopDriftGuage(QObject *parent) : QObject(parent)
+#include <QAbstractEventDispatcher>
+
+ThreadLoopDriftGuage::ThreadLoopDriftGuage(QObject *parent) : QObject(parent),
+    timer(this),
+    busyNanos(0),
+    busySinceNanos(0)
 {
     connect(&timer, &QTimer::timeout, this, &ThreadLoopDriftGuage::onTimout);
+    timer.setTimerType(Qt::PreciseTimer);
     timer.setInterval(HEARTBEAT);
 }
 
+int64_t ThreadLoopDriftGuage::nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief ThreadLoopDriftGuage::start has to be called in the guage's thread, because it hooks into that thread's event dispatcher.
+ */
 void ThreadLoopDriftGuage::start()
 {
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+
+    if (dispatcher)
+    {
+        connect(dispatcher, &QAbstractEventDispatcher::aboutToBlock, this, &ThreadLoopDriftGuage::onAboutToBlock, Qt::DirectConnection);
+        connect(dispatcher, &QAbstractEventDispatcher::awake, this, &ThreadLoopDriftGuage::onAwake, Qt::DirectConnection);
+    }
+
+    busySinceNanos.store(nowNanos(), std::memory_order_relaxed);
+    prevTick = std::chrono::steady_clock::now();
     timer.start();
 }
 
-int ThreadLoopDriftGuage::getMainLoopDrift() const
+/**
+ * @brief ThreadLoopDriftGuage::getLagSnapshot gives the lag of all ticks so far, in microseconds. Subtract an earlier snapshot to
+ * get an interval.
+ */
+Histogram ThreadLoopDriftGuage::getLagSnapshot() const
 {
-    return mainLoopDrift;
+    return lagMicros.getSnapshot();
+}
+
+/**
+ * @brief ThreadLoopDriftGuage::getBusyTime is the total time the event loop was not waiting, including the handler that may be
+ * running right now, so a loop that is stuck shows as busy.
+ */
+std::chrono::nanoseconds ThreadLoopDriftGuage::getBusyTime() const
+{
+    int64_t result = busyNanos.load(std::memory_order_relaxed);
+    const int64_t since = busySinceNanos.load(std::memory_order_relaxed);
+
+    if (since > 0)
+        result += std::max<int64_t>(0, nowNanos() - since);
+
+    return std::chrono::nanoseconds(result);
 }
 
 void ThreadLoopDriftGuage::onTimout()
 {
-    std::chrono::milliseconds msSinceLastTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - prevCountWhen);
-    mainLoopDrift = std::abs(HEARTBEAT - msSinceLastTime.count());
-    prevCountWhen = std::chrono::steady_clock::now();
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::microseconds lag = std::chrono::duration_cast<std::chrono::microseconds>(now - prevTick - std::chrono::milliseconds(HEARTBEAT));
+    lagMicros.record(std::max<int64_t>(0, lag.count()));
+    prevTick = now;
+}
+
+void ThreadLoopDriftGuage::onAboutToBlock()
+{
+    const int64_t since = busySinceNanos.load(std::memory_order_relaxed);
+
+    if (since <= 0)
+        return;
+
+    // Only this thread writes, so no read-modify-write needed.
+    busyNanos.store(busyNanos.load(std::memory_order_relaxed) + nowNanos() - since, std::memory_order_relaxed);
+    busySinceNanos.store(0, std::memory_order_relaxed);
+}
+
+void ThreadLoopDriftGuage::onAwake()
+{
+    busySinceNanos.store(nowNanos(), std::memory_order_relaxed);
 }
@@ -23,24 +23,44 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <QObject>
 #include <QTimer>
 #include <chrono>
+#include <atomic>
 
-#define HEARTBEAT 1000
+#include "histogram.h"
 
+#define HEARTBEAT 10
+
+/**
+ * @brief The ThreadLoopDriftGuage class measures how responsive the event loop of the thread it lives in is.
+ *
+ * It ticks every HEARTBEAT ms and records how late each tick is into a histogram, so stalls that are short compared to the stats
+ * interval still show up. It also keeps the time the loop spends handling events, as opposed to waiting for them.
+ *
+ * Only its own thread writes; the getters can be called from any thread.
+ */
 class ThreadLoopDriftGuage : public QObject
 {
     Q_OBJECT
 
+    // A child, so that moveToThread() takes it along; it can only be started in the thread it belongs to.
     QTimer timer;
-    int mainLoopDrift = 0;
-    std::chrono::time_point<std::chrono::steady_clock> prevCountWhen = std::chrono::steady_clock::now();
+    std::chrono::time_point<std::chrono::steady_clock> prevTick;
+    HistogramRecorder lagMicros;
+
+    std::atomic<int64_t> busyNanos;
+    std::atomic<int64_t> busySinceNanos;
+
+    static int64_t nowNanos();
 
 private slots:
     void onTimout();
+    void onAboutToBlock();
+    void onAwake();
 public:
     explicit ThreadLoopDriftGuage(QObject *parent = nullptr);
 
     void start();
-    int getMainLoopDrift() const;
+    Histogram getLagSnapshot() const;
+    std::chrono::nanoseconds getBusyTime() const;
 
 signals:
 
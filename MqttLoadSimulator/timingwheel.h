@@ -0,0 +1,125 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+
+/**
+ * @brief The TimingWheel class is a hashed timing wheel: items are put in the bucket of the tick they expire in, so advancing
+ * the wheel only touches the items that are (almost) due, instead of all of them.
+ *
+ * Items scheduled further ahead than one revolution of the wheel share a bucket with earlier ones and are simply put back
+ * when that bucket comes by before their time. Not thread safe; it's meant to be owned and driven by one thread.
+ */
+template<typename T>
+class TimingWheel
+{
+    struct Entry
+    {
+        T item;
+        int64_t tick;
+    };
+
+    const std::chrono::milliseconds resolution;
+    const std::chrono::time_point<std::chrono::steady_clock> epoch = std::chrono::steady_clock::now();
+    std::vector<std::vector<Entry>> buckets;
+    std::vector<Entry> processing;
+    int64_t currentTick = 0;
+    size_t count = 0;
+
+    int64_t tickOf(std::chrono::time_point<std::chrono::steady_clock> when) const
+    {
+        const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(when - epoch).count();
+        return ms / resolution.count();
+    }
+
+public:
+    TimingWheel(std::chrono::milliseconds resolution, size_t bucketCount) :
+        resolution(std::max<std::chrono::milliseconds>(resolution, std::chrono::milliseconds(1))),
+        buckets(std::max<size_t>(bucketCount, 1))
+    {
+
+    }
+
+    /**
+     * @brief schedule puts item in the wheel. Moments that lie in the current tick or the past are due on the next advance().
+     */
+    void schedule(const T &item, std::chrono::time_point<std::chrono::steady_clock> when)
+    {
+        const int64_t tick = std::max<int64_t>(tickOf(when), currentTick + 1);
+        Entry e;
+        e.item = item;
+        e.tick = tick;
+        buckets[tick % buckets.size()].push_back(e);
+        count++;
+    }
+
+    /**
+     * @brief advance moves the wheel to 'now' and calls f(item) for everything that expired. It's safe for f to schedule again.
+     */
+    template<typename F>
+    void advance(std::chrono::time_point<std::chrono::steady_clock> now, F f)
+    {
+        const int64_t targetTick = tickOf(now);
+
+        if (targetTick <= currentTick)
+            return;
+
+        // Ticks we missed (like when the timer is only started after a while) don't need more than one full turn.
+        const int64_t steps = std::min<int64_t>(targetTick - currentTick, buckets.size());
+        const int64_t firstTick = targetTick - steps + 1;
+        currentTick = targetTick;
+
+        for (int64_t tick = firstTick; tick <= targetTick; tick++)
+        {
+            std::vector<Entry> &bucket = buckets[tick % buckets.size()];
+
+            if (bucket.empty())
+                continue;
+
+            // Swapping, so that items rescheduled by f() can't end up in the bucket we're iterating over.
+            processing.clear();
+            processing.swap(bucket);
+
+            for (const Entry &e : processing)
+            {
+                if (e.tick > targetTick)
+                {
+                    bucket.push_back(e);
+                    continue;
+                }
+
+                count--;
+                f(e.item);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+};
+
+#endif // TIMINGWHEEL_H
@@ -17,12 +17,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 02110-1301, USA.
 */
 
-#include <sstream>
-#include <iomanip>
-
 #include "utils.h"
 
 #include "sys/random.h"
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <QFile>
+#include <QSslKey>
+#include <QSslCipher>
 
 QString GetRandomString()
 {
@@ -78,16 +81,26 @@ void seedQtrand()
 
 std::string formatString(const std::string str, ...)
 {
-    char buf[512];
-
     va_list valist;
     va_start(valist, str);
-    vsnprintf(buf, 512, str.c_str(), valist);
+
+    va_list valist2;
+    va_copy(valist2, valist);
+
+    const int len = vsnprintf(nullptr, 0, str.c_str(), valist);
     va_end(valist);
 
-    size_t len = strlen(buf);
-    std::string result(buf, len);
+    if (len < 0)
+    {
+        va_end(valist2);
+        return std::string();
+    }
+
+    std::vector<char> buf(len + 1);
+    vsnprintf(buf.data(), buf.size(), str.c_str(), valist2);
+    va_end(valist2);
 
+    std::string result(buf.data(), len);
     return result;
 }
 
@@ -96,24 +109,118 @@ ArgumentException::ArgumentException(const std::string &s) : std::runtime_error(
 
 }
 
-std::string utc_time()
+/**
+ * @brief parseCpuList parses a list like "0-3,8,10-11", like taskset does.
+ */
+std::vector<int> parseCpuList(const QString &list)
+{
+    std::vector<int> result;
+
+    for (const QString &part : list.split(",", QString::SkipEmptyParts))
+    {
+        const QStringList range = part.trimmed().split("-");
+        bool ok1 = false;
+        bool ok2 = false;
+
+        const int first = range.first().toInt(&ok1);
+        const int last = range.size() == 2 ? range.last().toInt(&ok2) : first;
+
+        if (!ok1 || (range.size() == 2 && !ok2) || range.size() > 2 || first < 0 || last < first || last >= CPU_SETSIZE)
+            throw ArgumentException(formatString("Invalid CPU list part '%s'", qPrintable(part)));
+
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            result.push_back(cpu);
+        }
+    }
+
+    if (result.empty())
+        throw ArgumentException("The CPU list is empty");
+
+    return result;
+}
+
+/**
+ * @brief createSslConfiguration makes the SSL configuration for all clients, so that certificate and key are read and parsed once.
+ * @param ciphers colon separated OpenSSL cipher names, or empty for Qt's default.
+ * @param sessionResumption keep the session, so a client can resume it on reconnect instead of doing a full handshake.
+ */
+QSslConfiguration createSslConfiguration(const QString &clientCertPath, const QString &clientPrivateKeyPath, const QString &ciphers,
+                                         bool sessionResumption)
 {
-    const auto now = std::chrono::system_clock::now();
-    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    const time_t timer = std::chrono::system_clock::to_time_t(now);
+    QSslConfiguration sslConfig = QSslConfiguration::defaultConfiguration();
+    sslConfig.setPeerVerifyMode(QSslSocket::VerifyNone);
 
-    struct tm my_tm;
-    memset(&my_tm, 0, sizeof(struct tm));
-    struct tm *my_tm_result = gmtime_r(&timer, &my_tm);
+    if (!clientCertPath.isEmpty() || !clientPrivateKeyPath.isEmpty())
+    {
+        QFile fcert(clientCertPath);
+        if (!fcert.open(QFile::ReadOnly))
+            throw ArgumentException("Error reading client certificate");
+        const QByteArray fcertData  = fcert.readAll();
+        QSslCertificate _cert(fcertData);
+
+        if (_cert.isNull())
+            throw ArgumentException("Error parsing client certificate");
+
+        QFile fkey(clientPrivateKeyPath);
+        if (!fkey.open(QFile::ReadOnly))
+            throw ArgumentException("Error reading private key");
+        const QByteArray keyData = fkey.readAll();
+        QSslKey _sslKey(keyData, QSsl::KeyAlgorithm::Rsa);
+
+        if (_sslKey.isNull())
+            _sslKey = QSslKey(keyData, QSsl::KeyAlgorithm::Ec);
+
+        if (_sslKey.isNull())
+            throw ArgumentException("Error parsing private key");
+
+        sslConfig.setLocalCertificate(_cert);
+        sslConfig.setPrivateKey(_sslKey);
+    }
+
+    if (!ciphers.isEmpty())
+    {
+        QList<QSslCipher> cipherList;
+
+        for (const QString &name : ciphers.split(':', QString::SkipEmptyParts))
+        {
+            QSslCipher cipher(name);
+
+            if (cipher.isNull())
+                throw ArgumentException(formatString("Unknown or unsupported cipher '%s'", qPrintable(name)));
+
+            cipherList.append(cipher);
+        }
+
+        sslConfig.setCiphers(cipherList);
+    }
+
+    if (sessionResumption)
+    {
+        sslConfig.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+        sslConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    }
+
+    return sslConfig;
+}
+
+/**
+ * @brief getResidentMemory gives how much memory the process uses, in bytes, or 0 when that's unknown.
+ */
+size_t getResidentMemory()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
 
-    if (!my_tm_result)
-        return std::string("localtime-failed");
+    if (!f)
+        return 0;
 
-    std::ostringstream oss;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int fields = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
 
-    oss << std::put_time(my_tm_result, "%FT%T");
-    oss << '.' << std::setfill('0') << std::setw(3) << ms.count();
-    oss << "Z";
+    if (fields != 2)
+        return 0;
 
-    return oss.str();
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
 }
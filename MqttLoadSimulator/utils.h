@@ -22,7 +22,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 
 #include <QString>
 #include <QCommandLineParser>
+#include <QSslConfiguration>
 #include <type_traits>
+#include <vector>
 
 class ArgumentException : public std::runtime_error
 {
@@ -33,6 +35,10 @@ public:
 QString GetRandomString();
 void seedQtrand();
 std::string formatString(const std::string str, ...);
+std::vector<int> parseCpuList(const QString &list);
+size_t getResidentMemory();
+QSslConfiguration createSslConfiguration(const QString &clientCertPath, const QString &clientPrivateKeyPath, const QString &ciphers,
+                                         bool sessionResumption);
 
 template<class T>
 typename std::enable_if<std::is_signed<T>::value, T>::type
@@ -64,6 +70,4 @@ parseIntOption(QCommandLineParser &parser, QCommandLineOption &option)
     return val;
 }
 
-std::string utc_time();
-
 #endif // UTILS_H
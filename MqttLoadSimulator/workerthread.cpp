@@ -0,0 +1,51 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#include "workerthread.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+
+/**
+ * @brief WorkerThread::WorkerThread
+ * @param cpu the CPU to pin to, or -1 to let the scheduler decide.
+ */
+WorkerThread::WorkerThread(int cpu) :
+    cpu(cpu)
+{
+
+}
+
+void WorkerThread::run()
+{
+    if (this->cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(this->cpu, &cpuset);
+
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        if (err != 0)
+            fprintf(stderr, "WARNING: pinning thread to CPU %d failed: %s\n", this->cpu, strerror(err));
+    }
+
+    QThread::run();
+}
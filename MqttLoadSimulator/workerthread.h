@@ -0,0 +1,42 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+#ifndef WORKERTHREAD_H
+#define WORKERTHREAD_H
+
+#include <QThread>
+
+/**
+ * @brief The WorkerThread class is a QThread that optionally pins itself to one CPU before running its event loop.
+ *
+ * Because the pinning happens before anything runs in it, memory that the thread allocates and touches first ends up on the NUMA
+ * node of that CPU, with Linux's default memory policy.
+ */
+class WorkerThread : public QThread
+{
+    const int cpu = -1;
+
+protected:
+    void run() override;
+
+public:
+    WorkerThread(int cpu);
+};
+
+#endif // WORKERTHREAD_H
@@ -0,0 +1,38 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <stdint.h>
+
+/**
+ * @brief The AllocationCounter class counts calls to malloc and friends in the whole process, including those by Qt and the
+ * C++ runtime, by replacing them with wrappers around glibc's own.
+ *
+ * That's Linux only, but so is the native engine.
+ */
+class AllocationCounter
+{
+public:
+    static uint64_t get();
+};
+
+#endif // ALLOCATIONCOUNTER_H
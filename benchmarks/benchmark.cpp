@@ -0,0 +1,46 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#include "benchmark.h"
+
+#include <stdio.h>
+
+/**
+ * @brief printBenchmarkHeader prints the column names. The format of the lines is meant to stay the same, so results of different
+ * versions can be compared with a diff or a script. Lines starting with '#' are comments.
+ */
+void printBenchmarkHeader()
+{
+    printf("# %-22s %8s %8s %12s %12s %10s\n", "name", "clients", "payload", "ops", "ns/op", "allocs/op");
+}
+
+/**
+ * @brief printBenchmarkResult prints one result line. A negative clients or payloadSize means the benchmark doesn't depend on it,
+ * which shows as '-'.
+ */
+void printBenchmarkResult(const std::string &name, int clients, int payloadSize, const BenchmarkResult &result)
+{
+    const std::string clientsString = clients >= 0 ? std::to_string(clients) : "-";
+    const std::string payloadString = payloadSize >= 0 ? std::to_string(payloadSize) : "-";
+
+    printf("%-24s %8s %8s %12llu %12.1f %10.3f\n", name.c_str(), clientsString.c_str(), payloadString.c_str(),
+           static_cast<unsigned long long>(result.ops), result.nsPerOp, result.allocsPerOp);
+    fflush(stdout);
+}
@@ -0,0 +1,76 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+#include "allocationcounter.h"
+
+struct BenchmarkResult
+{
+    uint64_t ops = 0;
+    double nsPerOp = 0;
+    double allocsPerOp = 0;
+};
+
+/**
+ * @brief runBenchmark calls batch(n), which must do n operations, with a growing n until one batch takes at least minTime. Only
+ * that last batch is measured, so the earlier ones double as warm-up.
+ */
+template<typename F>
+BenchmarkResult runBenchmark(std::chrono::milliseconds minTime, F batch)
+{
+    const uint64_t maxOps = static_cast<uint64_t>(1) << 40;
+    uint64_t ops = 1;
+
+    batch(ops);
+
+    for (;;)
+    {
+        const uint64_t allocationsBefore = AllocationCounter::get();
+        const auto start = std::chrono::steady_clock::now();
+        batch(ops);
+        const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        const uint64_t allocations = AllocationCounter::get() - allocationsBefore;
+
+        if (elapsed >= minTime || ops >= maxOps)
+        {
+            BenchmarkResult r;
+            r.ops = ops;
+            r.nsPerOp = static_cast<double>(elapsed.count()) / ops;
+            r.allocsPerOp = static_cast<double>(allocations) / ops;
+            return r;
+        }
+
+        // Aim a bit past minTime, but don't grow too fast on timer noise of tiny batches.
+        const double factor = static_cast<double>(std::chrono::nanoseconds(minTime).count()) / std::max<int64_t>(elapsed.count(), 1) * 1.2;
+        ops = std::min<uint64_t>(maxOps, ops * std::min(std::max(factor, 2.0), 100.0));
+    }
+}
+
+void printBenchmarkHeader();
+void printBenchmarkResult(const std::string &name, int clients, int payloadSize, const BenchmarkResult &result);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,41 @@
+QT -= gui
+QT += network qmqtt
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# The code under test is compiled in from the simulator's own directory.
+SIM = ../MqttLoadSimulator
+INCLUDEPATH += $$SIM
+
+SOURCES += \
+        allocationcounter.cpp \
+        benchmark.cpp \
+        main.cpp \
+        $$SIM/bindaddresspool.cpp \
+        $$SIM/clientpool.cpp \
+        $$SIM/clientnumberpool.cpp \
+        $$SIM/counters.cpp \
+        $$SIM/epollloop.cpp \
+        $$SIM/globals.cpp \
+        $$SIM/histogram.cpp \
+        $$SIM/inflighttable.cpp \
+        $$SIM/mqttcodec.cpp \
+        $$SIM/nativeconnection.cpp \
+        $$SIM/oneclient.cpp \
+        $$SIM/payloadtemplate.cpp \
+        $$SIM/poolarguments.cpp \
+        $$SIM/poolstats.cpp \
+        $$SIM/qmqttconnection.cpp \
+        $$SIM/reconnectscheduler.cpp \
+        $$SIM/sequencetracker.cpp \
+        $$SIM/utils.cpp
+
+HEADERS += \
+    allocationcounter.h \
+    benchmark.h \
+    $$SIM/clientpool.h \
+    $$SIM/epollloop.h \
+    $$SIM/reconnectscheduler.h
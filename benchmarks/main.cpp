@@ -0,0 +1,509 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#include <QtCore>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <memory>
+
+#include "benchmark.h"
+
+#include "binarypayload.h"
+#include "bytebuffer.h"
+#include "clientpool.h"
+#include "clientsettings.h"
+#include "counters.h"
+#include "epollloop.h"
+#include "histogram.h"
+#include "mqttcodec.h"
+#include "oneclient.h"
+#include "payloadtemplate.h"
+#include "poolarguments.h"
+#include "poolstats.h"
+#include "utils.h"
+
+// The interval of ClientPool's publish timer.
+#define PUBLISH_INTERVAL 10
+#define STATS_POOLS 8
+
+// To keep the compiler from optimizing away results nobody looks at.
+static volatile int64_t sink = 0;
+
+/**
+ * @brief parseIntList parses a comma-separated list of numbers, to run the benchmarks with each.
+ */
+static std::vector<int> parseIntList(const QString &list, const QString &optionName)
+{
+    std::vector<int> result;
+
+    for (const QString &part : list.split(",", QString::SkipEmptyParts))
+    {
+        bool ok = false;
+        const int value = part.trimmed().toInt(&ok);
+
+        if (!ok || value <= 0)
+            throw ArgumentException(formatString("Option %s needs numbers > 0, not '%s'", qPrintable(optionName), qPrintable(part)));
+
+        result.push_back(value);
+    }
+
+    if (result.empty())
+        throw ArgumentException(formatString("Option %s is empty", qPrintable(optionName)));
+
+    return result;
+}
+
+/**
+ * @brief referenceClientId looks like the client IDs OneClient makes, so rendering the default payload format gives the same size.
+ */
+static const QString &referenceClientId()
+{
+    static const QString id = QString("%1_%2_%3_%4").arg(QHostInfo::localHostName()).arg("benchmark").arg(0).arg(GetRandomString());
+    return id;
+}
+
+/**
+ * @brief makePayloadTemplate gives the default payload format, padded so its payloads are about payloadSize bytes.
+ * @param renderedSize is set to the actual size, which is more when payloadSize is smaller than the default format.
+ */
+static std::unique_ptr<PayloadTemplate> makePayloadTemplate(int payloadSize, int &renderedSize)
+{
+    const QString topic("loadtester/clientpool_benchmark/1/hellofromtheloadtester");
+    PayloadContext context;
+    context.steadyTimeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    context.clientId = &referenceClientId();
+    context.topic = &topic;
+
+    QByteArray payload;
+    PayloadTemplate(PayloadTemplate::defaultFormat(), 100).render(payload, context);
+    const int padding = std::max(0, payloadSize - payload.size());
+
+    std::unique_ptr<PayloadTemplate> result(new PayloadTemplate(PayloadTemplate::defaultFormat() + QString(padding, QChar('x')), 100));
+    result->render(payload, context);
+    renderedSize = payload.size();
+    return result;
+}
+
+/**
+ * @brief The ClientFixture class is a pool's worth of clients on the native engine, without a server. They're told they're
+ * connected, so they publish like normal, but their connection isn't, so it drops what they send before the codec and socket get it.
+ */
+class ClientFixture
+{
+    EpollLoop loop;
+    std::unique_ptr<PoolStats> stats;
+    std::unique_ptr<PayloadTemplate> payloadTemplate;
+    ClientSettings settings;
+
+public:
+    std::deque<OneClient> clients;
+    int payloadSize = 0;
+
+    ClientFixture(int clientCount, int payloadSize, bool binaryPayload)
+    {
+        stats.reset(new PoolStats());
+        payloadTemplate = makePayloadTemplate(payloadSize, this->payloadSize);
+
+        if (binaryPayload)
+            this->payloadSize = sizeof(BinaryPayloadHeader);
+
+        settings.port = 1883;
+        settings.nativeEngineLoop = &loop;
+        settings.clientIdPart = "benchmark";
+        settings.clientPoolRandomId = "benchmark";
+        settings.pubAndSub = true;
+        settings.totalClients = clientCount;
+        settings.burstInterval = 1000;
+        settings.burstSpread = 1;
+        settings.burstSize = 1;
+        settings.payloadTemplate = payloadTemplate.get();
+        settings.binaryPayload = binaryPayload;
+        settings.stats = stats.get();
+
+        const QList<QHostAddress> addresses { QHostAddress(QHostAddress::LocalHost) };
+
+        for (int i = 0; i < clientCount; i++)
+        {
+            clients.emplace_back(settings, i, "localhost", addresses);
+            static_cast<MqttConnectionHandler&>(clients.back()).onConnected();
+        }
+    }
+
+    ~ClientFixture()
+    {
+        clients.clear();
+    }
+};
+
+class Benchmarks
+{
+    const std::chrono::milliseconds minTime;
+    const QString filter;
+
+    bool selected(const char *name) const
+    {
+        return filter.isEmpty() || QString(name).contains(filter);
+    }
+
+    void payloadRender(int payloadSize);
+    void encodePublish(int payloadSize);
+    void publish(int clientCount, int payloadSize, bool binaryPayload);
+    void publishSchedule(int clientCount);
+    void receive(int clientCount, int payloadSize, bool binaryPayload);
+    void latencyValues();
+    void statsAggregation();
+
+public:
+    Benchmarks(std::chrono::milliseconds minTime, const QString &filter);
+    void run(const std::vector<int> &clientCounts, const std::vector<int> &payloadSizes);
+};
+
+Benchmarks::Benchmarks(std::chrono::milliseconds minTime, const QString &filter) :
+    minTime(minTime),
+    filter(filter)
+{
+
+}
+
+/**
+ * @brief Benchmarks::payloadRender measures producing one text payload from the payload template.
+ */
+void Benchmarks::payloadRender(int payloadSize)
+{
+    const char *name = "payload_render";
+    if (!selected(name))
+        return;
+
+    int renderedSize = 0;
+    const std::unique_ptr<PayloadTemplate> t = makePayloadTemplate(payloadSize, renderedSize);
+    const QString topic("loadtester/clientpool_benchmark/1/hellofromtheloadtester");
+    PayloadContext context;
+    context.steadyTimeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    context.clientId = &referenceClientId();
+    context.topic = &topic;
+    QByteArray payload;
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            context.sequence++;
+            t->render(payload, context);
+        }
+        sink = payload.size();
+    });
+
+    printBenchmarkResult(name, -1, renderedSize, r);
+}
+
+/**
+ * @brief Benchmarks::encodePublish measures writing one QoS 0 PUBLISH packet into a connection's write buffer.
+ */
+void Benchmarks::encodePublish(int payloadSize)
+{
+    const char *name = "encode_publish";
+    if (!selected(name))
+        return;
+
+    const QByteArray topic("loadtester/clientpool_benchmark/1/hellofromtheloadtester");
+    const QByteArray payload(payloadSize, 'x');
+    ByteBuffer out;
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            MqttCodec::writePublish(out, topic.constData(), topic.size(), payload.constData(), payload.size(), 0, false, 0);
+            out.consume(out.readable());
+        }
+    });
+
+    printBenchmarkResult(name, -1, payloadSize, r);
+}
+
+/**
+ * @brief Benchmarks::publish measures the client's side of one publish: the check whether it can publish, producing the payload
+ * and counting it. The connection isn't connected, so it drops the message before encoding it; encode_publish measures that part.
+ */
+void Benchmarks::publish(int clientCount, int payloadSize, bool binaryPayload)
+{
+    const char *name = binaryPayload ? "publish_prepare_binary" : "publish_prepare_text";
+    if (!selected(name))
+        return;
+
+    ClientFixture fixture(clientCount, payloadSize, binaryPayload);
+    size_t next = 0;
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        auto now = std::chrono::steady_clock::now();
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            fixture.clients[next].publishScheduled(now);
+
+            if (++next == fixture.clients.size())
+            {
+                next = 0;
+                now = std::chrono::steady_clock::now();
+            }
+        }
+    });
+
+    printBenchmarkResult(name, clientCount, fixture.payloadSize, r);
+}
+
+/**
+ * @brief Benchmarks::publishSchedule measures one call of ClientPool::publishNextRound, with the default burst interval and spread,
+ * on time that is faked to advance by one timer interval per call. The clients aren't connected, so it's only the scheduling.
+ */
+void Benchmarks::publishSchedule(int clientCount)
+{
+    const char *name = "publish_schedule_round";
+    if (!selected(name))
+        return;
+
+    PoolArguments args;
+    args.hostname = "localhost";
+    args.port = 1883;
+    args.pub_and_sub = true;
+    args.amount = clientCount;
+    args.clientIdPart = "benchmark";
+    args.burst_interval = 3000;
+    args.burst_spread = 1000;
+    args.burst_size = 1;
+    args.qos = 0;
+    args.deferPublishing = true;
+    args.binaryPayload = true;
+    args.engine = MqttEngine::Native;
+
+    ClientPool pool(args);
+    auto now = std::chrono::steady_clock::now();
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            now += std::chrono::milliseconds(PUBLISH_INTERVAL);
+            pool.publishNextRound(now);
+        }
+    });
+
+    printBenchmarkResult(name, clientCount, -1, r);
+}
+
+/**
+ * @brief Benchmarks::receive measures handling one received message: counting it, and parsing the latency from the payload. With
+ * a binary payload, that includes tracking the sequence; every client receives from one sender.
+ */
+void Benchmarks::receive(int clientCount, int payloadSize, bool binaryPayload)
+{
+    const char *name = binaryPayload ? "receive_binary" : "receive_text";
+    if (!selected(name))
+        return;
+
+    ClientFixture fixture(clientCount, payloadSize, binaryPayload);
+
+    QByteArray payload;
+    if (binaryPayload)
+    {
+        payload.resize(sizeof(BinaryPayloadHeader));
+    }
+    else
+    {
+        int renderedSize = 0;
+        const QString topic("loadtester/clientpool_benchmark/1/hellofromtheloadtester");
+        PayloadContext context;
+        context.steadyTimeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        context.clientId = &referenceClientId();
+        context.topic = &topic;
+        makePayloadTemplate(payloadSize, renderedSize)->render(payload, context);
+    }
+
+    BinaryPayloadHeader header;
+    header.steadyTimeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    size_t next = 0;
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            if (binaryPayload)
+            {
+                header.senderId = next;
+                memcpy(payload.data(), &header, sizeof(BinaryPayloadHeader));
+            }
+
+            static_cast<MqttConnectionHandler&>(fixture.clients[next]).onReceived(payload.constData(), payload.size());
+
+            if (++next == fixture.clients.size())
+            {
+                next = 0;
+                header.sequence++;
+            }
+        }
+    });
+
+    printBenchmarkResult(name, clientCount, payload.size(), r);
+}
+
+/**
+ * @brief Benchmarks::latencyValues measures getting the percentiles of an interval's latency histogram, like every stats line does.
+ */
+void Benchmarks::latencyValues()
+{
+    const char *name = "latency_values";
+    if (!selected(name))
+        return;
+
+    Histogram h;
+    for (uint64_t i = 0; i < 1000000; i++)
+    {
+        // A spread over four orders of magnitude, so many buckets are used.
+        h.record(100 + (i * 7919) % 1000000 / (1 + i % 100));
+    }
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            const LatencyValues values(h);
+            sink = values.p99.count();
+        }
+    });
+
+    printBenchmarkResult(name, -1, -1, r);
+}
+
+/**
+ * @brief Benchmarks::statsAggregation measures what the stats timer does per pool: loading its counters and taking snapshots of its
+ * histograms, and adding them to the totals.
+ */
+void Benchmarks::statsAggregation()
+{
+    const char *name = "stats_aggregate_pool";
+    if (!selected(name))
+        return;
+
+    std::vector<std::unique_ptr<PoolStats>> pools;
+    for (int p = 0; p < STATS_POOLS; p++)
+    {
+        pools.emplace_back(new PoolStats());
+
+        for (uint64_t i = 0; i < 100000; i++)
+        {
+            AtomicCounters::increment(pools.back()->counters.received);
+            pools.back()->latency.record(100 + (i * 7919) % 100000);
+            pools.back()->puback.record(50 + (i * 104729) % 10000);
+        }
+    }
+
+    const BenchmarkResult r = runBenchmark(minTime, [&](uint64_t ops) {
+        Counters counts;
+        StatsHistograms histograms;
+        size_t next = 0;
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            const PoolStats &stats = *pools[next];
+            counts += stats.counters.load();
+            histograms += stats.getHistograms();
+
+            if (++next == pools.size())
+                next = 0;
+        }
+
+        sink = counts.received + histograms.latency.getTotalCount();
+    });
+
+    printBenchmarkResult(name, -1, -1, r);
+}
+
+void Benchmarks::run(const std::vector<int> &clientCounts, const std::vector<int> &payloadSizes)
+{
+    printBenchmarkHeader();
+
+    for (int payloadSize : payloadSizes)
+    {
+        payloadRender(payloadSize);
+        encodePublish(payloadSize);
+    }
+
+    for (int clientCount : clientCounts)
+    {
+        for (int payloadSize : payloadSizes)
+        {
+            publish(clientCount, payloadSize, false);
+            receive(clientCount, payloadSize, false);
+        }
+
+        // Binary payloads are always just the header.
+        publish(clientCount, 0, true);
+        receive(clientCount, 0, true);
+        publishSchedule(clientCount);
+    }
+
+    latencyValues();
+    statsAggregation();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    seedQtrand();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Microbenchmarks of MqttLoadSimulator's hot paths. It needs no server or network. Every result is a "
+                                     "line with the name, the number of clients and payload size ('-' when not applicable), the number "
+                                     "of operations measured, and the nanoseconds and memory allocations per operation.");
+    parser.addHelpOption();
+
+    QCommandLineOption clientsOption("clients", "Comma-separated list of client counts to run the per-client benchmarks with. Default: 1000", "list", "1000");
+    parser.addOption(clientsOption);
+
+    QCommandLineOption payloadSizeOption("payload-size", "Comma-separated list of payload sizes in bytes, to pad text payloads to. Default: 100", "list", "100");
+    parser.addOption(payloadSizeOption);
+
+    QCommandLineOption minTimeOption("min-time", "Minimum time one measurement takes, in ms. Default: 500", "ms", "500");
+    parser.addOption(minTimeOption);
+
+    QCommandLineOption filterOption("filter", "Only run benchmarks with this in their name.", "text");
+    parser.addOption(filterOption);
+
+    parser.process(a);
+
+    try
+    {
+        const std::vector<int> clientCounts = parseIntList(parser.value(clientsOption), "clients");
+        const std::vector<int> payloadSizes = parseIntList(parser.value(payloadSizeOption), "payload-size");
+        const int minTime = parseIntOption<int>(parser, minTimeOption);
+
+        if (minTime <= 0)
+            throw ArgumentException("Min time must be > 0");
+
+        Benchmarks benchmarks(std::chrono::milliseconds(minTime), parser.value(filterOption));
+        benchmarks.run(clientCounts, payloadSizes);
+    }
+    catch (std::exception &ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
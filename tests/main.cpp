@@ -0,0 +1,263 @@
+/*
+This file is part of MqttLoadSimulator
+Copyright (C) 2023  Wiebe Cazemier
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+*/
+
+
+#include <QtCore>
+#include <QHostAddress>
+#include <QTimer>
+#include <stdio.h>
+#include <functional>
+#include <vector>
+
+#include "counters.h"
+#include "epollloop.h"
+#include "inflighttable.h"
+#include "mqttcodec.h"
+#include "nativeconnection.h"
+#include "selftestbroker.h"
+
+/**
+ * @brief The TestHandler class records what a connection reports, and stops the event loop once 'done' says so.
+ */
+class TestHandler : public MqttConnectionHandler
+{
+public:
+    bool tcpConnected = false;
+    bool connected = false;
+    bool subscribed = false;
+    int errors = 0;
+    QString lastError;
+    std::function<void()> onConnectedHook;
+    std::function<bool()> done;
+
+    void onTcpConnected() override
+    {
+        tcpConnected = true;
+    }
+
+    void onConnected() override
+    {
+        connected = true;
+
+        if (onConnectedHook)
+            onConnectedHook();
+
+        checkDone();
+    }
+
+    void onSubscribed() override
+    {
+        subscribed = true;
+        checkDone();
+    }
+
+    void onDisconnected() override
+    {
+        checkDone();
+    }
+
+    void onError(int, const QString &description) override
+    {
+        errors++;
+        lastError = description;
+        QCoreApplication::quit();
+    }
+
+    void onReceived(const char *, size_t) override
+    {
+
+    }
+
+    void onPublishAck(quint16, PublishAck) override
+    {
+
+    }
+
+    void checkDone()
+    {
+        if (done && done())
+            QCoreApplication::quit();
+    }
+};
+
+/**
+ * @brief runEventLoop runs until the handler is done, or the timeout passes.
+ */
+static void runEventLoop(std::chrono::milliseconds timeout)
+{
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &QCoreApplication::quit);
+    timer.start(timeout.count());
+    QCoreApplication::exec();
+}
+
+static bool check(bool condition, const char *test, const char *what)
+{
+    if (!condition)
+        fprintf(stderr, "FAIL: %s: %s\n", test, what);
+
+    return condition;
+}
+
+/**
+ * @brief testConnectAndSubscribe makes one native connection to the self-test broker on loopback, which has to get through TCP
+ * connect, CONNECT/CONNACK and SUBSCRIBE/SUBACK.
+ */
+static bool testConnectAndSubscribe(quint8 protocolVersion)
+{
+    const char *name = protocolVersion == MQTT_PROTOCOL_VERSION_5 ? "connect and subscribe, MQTT 5" : "connect and subscribe, MQTT 3.1.1";
+
+    SelfTestBroker broker(0);
+    broker.start();
+
+    EpollLoop loop;
+    AtomicCounters counters;
+    TestHandler handler;
+    NativeConnection connection(&handler, loop, counters, QHostAddress(QHostAddress::LocalHost), broker.getPort(), nullptr);
+
+    connection.setClientId("test");
+    connection.setKeepAlive(60);
+    connection.setProtocolVersion(protocolVersion);
+
+    handler.onConnectedHook = [&connection]() {
+        connection.subscribe("test/#", 0);
+    };
+    handler.done = [&handler]() {
+        return handler.subscribed;
+    };
+
+    connection.connectToHost();
+    runEventLoop(std::chrono::seconds(5));
+
+    bool ok = check(handler.errors == 0, name, qPrintable(QString("error: %1").arg(handler.lastError)));
+    ok = check(handler.tcpConnected, name, "no TCP connect") && ok;
+    ok = check(handler.connected, name, "no CONNACK") && ok;
+    ok = check(handler.subscribed, name, "no SUBACK") && ok;
+
+    connection.disconnectFromHost();
+    return ok;
+}
+
+/**
+ * @brief testConnackLimits reads an MQTT 5 CONNACK with a receive maximum and maximum QoS, and SUBACKs with and without failure.
+ */
+static bool testConnackLimits()
+{
+    const char *name = "CONNACK limits and SUBACK reason codes";
+
+    // Session present 0, reason code 0, 5 bytes of properties: receive maximum 10 and maximum QoS 1.
+    const char connack[] = {0x20, 0x08, 0x00, 0x00, 0x05, 0x21, 0x00, 0x0A, 0x24, 0x01};
+    MqttFixedHeader header;
+    bool ok = check(MqttCodec::readFixedHeader(connack, sizeof(connack), header), name, "incomplete CONNACK");
+
+    MqttConnackView view;
+    MqttCodec::readConnack(header, connack + header.headerLength, MQTT_PROTOCOL_VERSION_5, view);
+    ok = check(view.receiveMaximum == 10, name, "wrong receive maximum") && ok;
+    ok = check(view.maximumQos == 1, name, "wrong maximum QoS") && ok;
+
+    // Packet id 1, no properties, reason code 0x87 (not authorized).
+    const char subackFailed[] = {static_cast<char>(0x90), 0x04, 0x00, 0x01, 0x00, static_cast<char>(0x87)};
+    MqttCodec::readFixedHeader(subackFailed, sizeof(subackFailed), header);
+    ok = check(MqttCodec::readSubackReasonCode(header, subackFailed + header.headerLength, MQTT_PROTOCOL_VERSION_5) == 0x87, name,
+               "wrong MQTT 5 SUBACK reason code") && ok;
+
+    // MQTT 3: packet id 1, granted QoS 1.
+    const char suback[] = {static_cast<char>(0x90), 0x03, 0x00, 0x01, 0x01};
+    MqttCodec::readFixedHeader(suback, sizeof(suback), header);
+    ok = check(MqttCodec::readSubackReasonCode(header, suback + header.headerLength, MQTT_PROTOCOL_VERSION_3_1_1) == 0x01, name,
+               "wrong MQTT 3 SUBACK return code") && ok;
+
+    return ok;
+}
+
+/**
+ * @brief testInflightWrap publishes with --max-inflight 10 across the packet id wrap from 65535 to 1, with acks in order and out of
+ * order, and checks that nothing is evicted and every ack is recognized.
+ */
+static bool testInflightWrap()
+{
+    const char *name = "In-flight packet ids wrapping";
+
+    InflightTable table(10);
+    int64_t latency = 0;
+    int evicted = 0;
+    bool ok = true;
+
+    // A full window that straddles the wrap: 65531..65535 and 1..5.
+    const std::vector<uint16_t> window {65531, 65532, 65533, 65534, 65535, 1, 2, 3, 4, 5};
+
+    for (uint16_t id : window)
+    {
+        evicted += table.add(id, 1, 0);
+    }
+
+    ok = check(table.isFull(), name, "window not full") && ok;
+
+    // Out of order: the newest first.
+    for (auto it = window.rbegin(); it != window.rend(); ++it)
+    {
+        ok = check(table.ack(*it, PublishAck::Puback, 0, latency), name, "out of order ack not recognized") && ok;
+    }
+
+    ok = check(table.size() == 0, name, "entries left after acking all") && ok;
+
+    // In order, keeping the window full, for more than one wrap.
+    uint16_t next = 1;
+    uint16_t oldest = 1;
+
+    for (int i = 0; i < 10; i++)
+    {
+        evicted += table.add(next++, 1, 0);
+    }
+
+    for (int i = 0; i < 70000; i++)
+    {
+        ok = check(table.ack(oldest, PublishAck::Puback, 0, latency), name, "in order ack not recognized") && ok;
+        oldest = oldest == 65535 ? 1 : oldest + 1;
+
+        evicted += table.add(next, 1, 0);
+        next = next == 65535 ? 1 : next + 1;
+
+        if (!ok)
+            break;
+    }
+
+    ok = check(evicted == 0, name, "entries evicted") && ok;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    int failed = 0;
+    int total = 0;
+
+    for (bool ok : {testConnectAndSubscribe(MQTT_PROTOCOL_VERSION_3_1_1), testConnectAndSubscribe(MQTT_PROTOCOL_VERSION_5), testConnackLimits(), testInflightWrap()})
+    {
+        total++;
+
+        if (!ok)
+            failed++;
+    }
+
+    printf("%d of %d tests passed.\n", total - failed, total);
+    return failed > 0 ? 1 : 0;
+}
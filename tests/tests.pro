@@ -0,0 +1,28 @@
+QT -= gui
+QT += network
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# The code under test is compiled in from the simulator's own directory.
+SIM = ../MqttLoadSimulator
+INCLUDEPATH += $$SIM
+
+SOURCES += \
+        main.cpp \
+        $$SIM/bindaddresspool.cpp \
+        $$SIM/counters.cpp \
+        $$SIM/epollloop.cpp \
+        $$SIM/globals.cpp \
+        $$SIM/histogram.cpp \
+        $$SIM/inflighttable.cpp \
+        $$SIM/mqttcodec.cpp \
+        $$SIM/nativeconnection.cpp \
+        $$SIM/selftestbroker.cpp \
+        $$SIM/utils.cpp
+
+HEADERS += \
+    $$SIM/epollloop.h \
+    $$SIM/selftestbroker.h